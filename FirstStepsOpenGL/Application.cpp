@@ -3,10 +3,29 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #include "shaderProgram.h"
+#include "transformStore.h"
+#include "meshOptimizer.h"
+#include "vertexFormat.h"
+#include "gpuArena.h"
+#include "frameRing.h"
+#include "uniformBlocks.h"
+#include "shaderInterface.h"
+#include "shaderBuilder.h"
+#include "shaderPipeline.h"
+#include "shaderPermutations.h"
+#include "shaderHotReload.h"
+#include "uniformShadow.h"
+#include "texturePacker.h"
+#include "texture.h"
+#include "textureResidency.h"
+#include "textureScheduler.h"
+#include "virtualTexture.h"
+#include "universalTexture.h"
+#include "textureCache.h"
+#include "textureDiskCache.h"
 
 #include <iostream>
 #include <windows.h>
@@ -17,6 +36,21 @@ void processInput(GLFWwindow *window);
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
 
+//Interface of the cube shader program, declared once and checked against the program at load
+typedef VertexLayout<VertexAttribute<0, float, 3>, VertexAttribute<1, float, 2> > CubeVertex;
+SHADER_UNIFORM(Texture1, "texture1", Sampler);
+SHADER_UNIFORM(Texture2, "texture2", Sampler);
+SHADER_UNIFORM_BLOCK(CameraUniforms, "Camera", CameraBlock, CAMERA_BLOCK_BINDING);
+SHADER_UNIFORM_BLOCK(ObjectUniforms, "Object", glm::mat4, OBJECT_BLOCK_BINDING);
+typedef ShaderInterface<Texture1, Texture2, CameraUniforms, ObjectUniforms> CubeShaderInterface;
+
+//current framebuffer size, kept up to date by framebuffer_size_callback
+int viewportWidth = SCR_WIDTH;
+int viewportHeight = SCR_HEIGHT;
+
+//Uncomment to run the benchmarks instead of the render loop
+//#define RUN_BENCHMARKS
+
 int main()
 {
 	//GLFW
@@ -47,10 +81,38 @@ int main()
 		return -1;
 	}
 
+#ifdef RUN_BENCHMARKS
+	benchmarkTransformStore(10000, 100);
+	benchmarkVertexFormats(1024, 20);
+	benchmarkArenaChurn(64 * 1024 * 1024, 100000);
+	benchmarkShaderInterface(100000);
+	benchmarkShaderBuilder("shaders.manifest");
+	benchmarkShaderStageCache(64);
+	benchmarkShaderPipelines(8, 8);
+	benchmarkShaderPermutations(1000);
+	benchmarkSpirvLoading();
+	benchmarkUniformShadow(10000, 10);
+	benchmarkTexturePacker(512, 10000, 10);
+	benchmarkMipGeneration(".\\resources\\texture\\container.jpg", 10);
+	benchmarkTextureUpload(".\\resources\\texture\\container.jpg", 50);
+	benchmarkProgressiveJpeg(".\\resources\\texture\\container.jpg", 10); // baseline, point it at a progressive JPEG for previews
+	benchmarkTextureResidency(96, 16, 200);
+	benchmarkTextureScheduler(20, 16.0);
+	benchmarkVirtualTexture(240);
+	benchmarkUniversalTexture(".\\resources\\texture\\container.jpg", 10);
+	benchmarkTextureCache({ ".\\resources\\texture\\container.jpg", ".\\resources\\texture\\awesomeface.jpg" }, 32);
+	benchmarkTextureDiskCache({ ".\\resources\\texture\\container.jpg", ".\\resources\\texture\\awesomeface.jpg" }, 5);
+	glfwTerminate();
+	return 0;
+#endif
+
 	//Shader
 	//---------------------------------------------------------------------------
-	//Use our shader program with the filenames of the vertex and fragment shaders.
-	Shader ourShader("basicVertexShader.vs", "textureFragment.fs");
+	//Start building every program of the manifest, the driver compiles them while the
+	//textures below are decoded and each program is only waited for when it is first used.
+	ShaderBuilder shaderBuilder;
+	shaderBuilder.addManifest("shaders.manifest");
+	shaderBuilder.submit();
 
 	//Global OpenGL attributes
 	//---------------------------------------------------------------------------
@@ -103,79 +165,57 @@ int main()
 	};
 
 
-	unsigned int VBO, VAO;
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-
-	glBindVertexArray(VAO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	//weld the duplicated corners into an index buffer and reorder for the vertex cache
+	Mesh cube = processMesh("CUBE", vertices, 36, 5);
 
-	// position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// texture coord attribute
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	//every mesh with the position + uv float layout lives in one shared buffer and VAO
+	MeshArena *meshArena = new MeshArena(4 * 1024 * 1024, CubeVertex::stride, []() { CubeVertex::setup(); });
+	ArenaMesh cubeMesh = meshArena->add(&cube.vertices[0], cube.vertices.size() * sizeof(float), &cube.indices[0], cube.indices.size());
 
 	//Texture
 	//---------------------------------------------------------------------------
-	//generate and bind the texture pointer
-	unsigned int texture1, texture2;
-	glGenTextures(1, &texture1);
-	glBindTexture(GL_TEXTURE_2D, texture1);
-
-	//set the shape and repeating pattern for the texture
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	//texture filtering parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	int width, height, nrChannels;
+	//the residency manager allocates immutable storage, uploads the mip chains level by level
+	//and keeps every texture within the video memory budget
+	TextureResidency *textures = new TextureResidency(256 * 1024 * 1024);
+	//textures are read, decoded and get their mip chains on worker threads, the ones that
+	//cover most of the screen first; until a texture arrives its unit samples black
+	TextureScheduler *textureLoads = new TextureScheduler(textures);
+	//decoded chains are kept in textureCache between runs, the next launch skips the decode
+	TextureDiskCache *decodedTextures = new TextureDiskCache("textureCache", 256 * 1024 * 1024, true, true);
+	textureLoads->diskCache = decodedTextures;
+	//mips are filtered in linear light since the pixels are sRGB encoded. The file headers pick
+	//the layout: the RGB container.jpg is expanded to RGBA, the RGBA PNG behind awesomeface.jpg kept as is.
 	stbi_set_flip_vertically_on_load(true);
-	//use stb_image.h to load the designated image as a texture
-	unsigned char *data = stbi_load(".\\resources\\texture\\container.jpg", &width, &height, &nrChannels, 0);
-	if (data)
-	{
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
-	else
-	{
-		std::cout << "Failed to load texture" << std::endl;
-	}
-	stbi_image_free(data);
-	//Texture 2
-	glGenTextures(1, &texture2);
-	glBindTexture(GL_TEXTURE_2D, texture2);
-	// set the texture wrapping parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// set texture filtering parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	// load image, create texture and generate mipmaps
-	data = stbi_load(".\\resources\\texture\\awesomeface.jpg", &width, &height, &nrChannels, 0);
-	if (data)
-	{
-		// note that the awesomeface.png has transparency and thus an alpha channel, so make sure to tell OpenGL the data type is of GL_RGBA
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-	}
-	else
-	{
-		std::cout << "Failed to load texture" << std::endl;
-	}
-	stbi_image_free(data);
+	MipSettings photoMips;
+	photoMips.filter = MIP_FILTER_KAISER;
+	photoMips.srgb = true;
 
 	//Uncomment to display vertices in wireframe
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
+	//Check the program against the declared interface
+	Shader &ourShader = shaderBuilder.get("cube");
+	CubeShaderInterface cubeInterface;
+	if (!cubeInterface.load(ourShader.ID) || !CubeVertex::validate(ourShader.ID))
+		std::cout << "ERROR::SHADER::INTERFACE_MISMATCH basicVertexShader.vs / textureFragment.fs" << std::endl;
+
 	//Tell OpenGL which texture unit each sampler belongs to
 	ourShader.use(); //Activate shader before setting uniforms
-	ourShader.setInt("texture1", 0);
-	ourShader.setInt("texture2", 1); //set it via the texture class
+	Sampler unit0 = { 0 }, unit1 = { 1 };
+	cubeInterface.set<Texture1>(unit0);
+	cubeInterface.set<Texture2>(unit1);
+	//from here on the Shader setters only record changes, flush() uploads them before the draws
+	ourShader.shadowUniforms();
+
+	//Edits to the cube shaders are compiled in the background and swapped in between frames
+	ShaderHotReload *hotReload = new ShaderHotReload(window);
+	hotReload->watch(ourShader, "basicVertexShader.vs", "textureFragment.fs", "", [&](Shader &shader)
+	{
+		cubeInterface.load(shader.ID);
+		shader.use();
+		cubeInterface.set<Texture1>(unit0);
+		cubeInterface.set<Texture2>(unit1);
+	});
 
 	glm::vec3 cubePositions[] = {
 		glm::vec3(0.0f,  0.0f,  0.0f),
@@ -190,50 +230,94 @@ int main()
 		glm::vec3(-1.3f,  1.0f, -1.5f)
 	};
 
+	//both textures are drawn on every cube, their requests cover all of them
+	glm::vec3 cubesMin(cubePositions[0]), cubesMax(cubePositions[0]);
+	for (const glm::vec3 &position : cubePositions)
+	{
+		cubesMin = glm::min(cubesMin, position - glm::vec3(0.87f));
+		cubesMax = glm::max(cubesMax, position + glm::vec3(0.87f));
+	}
+	//a .utex cooked next to an image (cookUniversalTexture) is loaded instead of it
+	int texture1 = textureLoads->request(cookedTexturePath(".\\resources\\texture\\container.jpg"), cubesMin, cubesMax, photoMips);
+	int texture2 = textureLoads->request(cookedTexturePath(".\\resources\\texture\\awesomeface.jpg"), cubesMin, cubesMax, photoMips);
+
+	//Transforms
+	//---------------------------------------------------------------------------
+	//every cube gets a slot in the transform store, only rotations change per frame
+	TransformStore transforms;
+	for (unsigned int i = 0; i < 10; i++)
+		transforms.add(cubePositions[i]);
+	const glm::vec3 rotationAxis = glm::normalize(glm::vec3(0.5f, 1.0f, 0.0f));
+
+	//per frame data is written into a persistently mapped ring, one region per frame in flight
+	FrameRingBuffer *frameRing = new FrameRingBuffer(64 * 1024);
+	//each model matrix gets its own slot so it can be bound as the Object block on its own
+	size_t objectSlot = (sizeof(glm::mat4) + frameRing->uniformAlignment() - 1) / frameRing->uniformAlignment() * frameRing->uniformAlignment();
+	unsigned int frameCount = 0;
+	float lastFrameTime = (float)glfwGetTime();
+
 	//Render Loop
 	//---------------------------------------------------------------------------
 	while (!glfwWindowShouldClose(window))
 	{
 		// input
 		processInput(window);
+		hotReload->swapReloaded();
+		frameRing->beginFrame();
+		frameCount++;
 		//start each frame by clearing
 		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		//bind textures to corresponding texture units
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, texture1);
+		glBindTexture(GL_TEXTURE_2D, textures->use(textureLoads->handle(texture1)));
 		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, texture2);
+		glBindTexture(GL_TEXTURE_2D, textures->use(textureLoads->handle(texture2)));
 		
-		//activate shader
+		//activate shader and upload the uniforms that changed since the last frame
 		ourShader.use();
-
-		// create transformations
-		glm::mat4 view;
-		glm::mat4 projection;
-		view = glm::translate(view, glm::vec3(0.0f, 0.0f, -3.0f));
-		projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		ourShader.setMat4("view", view);
-		ourShader.setMat4("projection", projection);
+		ourShader.flush();
+
+		//camera matrices are written once per frame into the Camera block every program reads
+		float currentTime = (float)glfwGetTime();
+		glm::mat4 view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
+		glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)viewportWidth / (float)viewportHeight, 0.1f, 100.0f);
+		//a full ring (reported by allocate) skips this frame's uploads and draws
+		RingAllocation camera = frameRing->allocate(sizeof(CameraBlock), frameRing->uniformAlignment());
+		if (camera.ptr)
+		{
+			*(CameraBlock*)camera.ptr = makeCameraBlock(view, projection, currentTime, currentTime - lastFrameTime, viewportWidth, viewportHeight);
+			glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, frameRing->ID, camera.offset, sizeof(CameraBlock));
+		}
+		//the scheduler sees the camera through the same matrices
+		textureLoads->update(makeTextureView(view, projection, viewportHeight), currentTime - lastFrameTime);
+		lastFrameTime = currentTime;
+
+		//spin even cubes one way and odd cubes the other, time is read once per frame
+		float angle = currentTime * glm::radians(50.0f);
+		glm::quat spin = glm::angleAxis(angle, rotationAxis);
+		glm::quat reverseSpin = glm::angleAxis(-angle, rotationAxis);
+		for (unsigned int i = 0; i < 10; i++)
+			transforms.setRotation(i, i % 2 == 0 ? spin : reverseSpin);
+		transforms.update();
+		RingAllocation objects = frameRing->allocate(transforms.size() * objectSlot, frameRing->uniformAlignment());
+		if (objects.ptr)
+			transforms.writeAll((float*)objects.ptr, objectSlot / sizeof(float));
+		frameRing->flush();
 
 		//render boxes
-		glBindVertexArray(VAO);
-		for (unsigned int i = 0; i < 10; i++) {
-			glm::mat4 model;
-			model = glm::translate(model, cubePositions[i]);
-			if(i % 2 == 0)
-			{
-				model = glm::rotate(model, (float)glfwGetTime() * glm::radians(50.0f), glm::vec3(0.5f, 1.0f, 0.0f));
-			}
-			else
-			{
-				model = glm::rotate(model, (-1)*(float)glfwGetTime() * glm::radians(50.0f), glm::vec3(0.5f, 1.0f, 0.0f));
-			}
-			ourShader.setMat4("model", model);
+		glBindVertexArray(meshArena->VAO);
+		if (camera.ptr && objects.ptr)
+		{
+			for (unsigned int i = 0; i < 10; i++) {
+				glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, frameRing->ID, objects.offset + i * objectSlot, sizeof(glm::mat4));
 
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+				meshArena->draw(cubeMesh);
+			}
 		}
+		frameRing->endFrame();
+		textures->endFrame();
 
 		//glfw: swap buffers and obtain all IO events
 		glfwSwapBuffers(window);
@@ -243,8 +327,16 @@ int main()
 	//Clean Up
 	//---------------------------------------------------------------------------
 	//glfw terminate to clear all allocated glfw resources.
-	glDeleteVertexArrays(1, &VAO);
-	glDeleteBuffers(1, &VBO);
+	std::cout << "FRAME_RING::STALLS: " << frameRing->stallCount() << " in " << frameCount << " frames, "
+		<< frameRing->bytesLastFrame() << " bytes per frame" << std::endl;
+	std::cout << "SHADER_HOT_RELOAD::RELOADS: " << hotReload->reloadCount() << ", failed " << hotReload->failureCount() << std::endl;
+	textures->printStats();
+	delete hotReload;
+	delete textureLoads;
+	delete decodedTextures;
+	delete textures;
+	delete frameRing;
+	delete meshArena;
 	glfwTerminate();
 	return 0;
 }
@@ -260,4 +352,10 @@ void processInput(GLFWwindow *window)
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
 	glViewport(0, 0, width, height);
+	//a minimized window reports 0 x 0, keep the last size so the aspect ratio stays valid
+	if (width > 0 && height > 0)
+	{
+		viewportWidth = width;
+		viewportHeight = height;
+	}
 }
\ No newline at end of file
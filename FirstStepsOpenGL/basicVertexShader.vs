@@ -3,13 +3,22 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
+#ifdef TEXTURE_ARRAY
+// per instance: where the material lives in the packed textures
+layout (location = 2) in vec4 aUvRect;  // atlas rectangle, (0, 0, 1, 1) for a whole layer
+layout (location = 3) in float aLayer;
+flat out vec4 UvRect;
+flat out float Layer;
+#endif
   
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniformBlocks.glsl"
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = viewProjection * model * vec4(aPos, 1.0);
     TexCoord = vec2(aTexCoord.x, 1.0 - aTexCoord.y);
+#ifdef TEXTURE_ARRAY
+    UvRect = aUvRect;
+    Layer = aLayer;
+#endif
 } 
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <string>
+#include <iostream>
+
+// wall clock timer used by the benchmark functions of each module
+class BenchmarkTimer
+{
+public:
+	BenchmarkTimer()
+	{
+		restart();
+	}
+	// ------------------------------------------------------------------------
+	void restart()
+	{
+		start = std::chrono::high_resolution_clock::now();
+	}
+	// ------------------------------------------------------------------------
+	double elapsedMs() const
+	{
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+		return elapsed.count();
+	}
+
+private:
+	std::chrono::high_resolution_clock::time_point start;
+};
+
+// print one benchmark result line in a fixed format so runs can be compared
+// ------------------------------------------------------------------------
+inline void printBenchmarkResult(const std::string &name, double value, const std::string &unit)
+{
+	std::cout << "BENCHMARK::" << name << ": " << value << " " << unit << std::endl;
+}
+#endif
@@ -0,0 +1,168 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <iostream>
+
+// A range handed out by FrameRingBuffer::allocate, valid until the end of the frame
+struct RingAllocation
+{
+	size_t offset;  // offset into FrameRingBuffer::ID for glBindBufferRange and friends
+	void *ptr;      // write only, nullptr when the frame ran out of space
+};
+
+// Per frame dynamic data (uniform blocks, SSBOs, instance attributes) sub-allocated from
+// one persistently and coherently mapped buffer. The buffer is split into one region per
+// frame in flight and each region is guarded by a fence, so writing never needs
+// map/unmap or orphaning with glBufferData. beginFrame() only blocks when the GPU is
+// more than framesInFlight frames behind, which is counted as a stall.
+class FrameRingBuffer
+{
+public:
+	unsigned int ID;
+
+	FrameRingBuffer(size_t bytesPerFrame, unsigned int framesInFlight = 3)
+		: regionSize(bytesPerFrame), regionCount(framesInFlight), fences(framesInFlight, (GLsync)0)
+	{
+		size_t capacity = regionSize * regionCount;
+		glGenBuffers(1, &ID);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+		persistent = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+		if (persistent)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, flags);
+		}
+		else
+		{
+			// no persistent mapping, write into a CPU copy and upload it once in flush()
+			glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+			shadow.resize(capacity);
+			mapped = &shadow[0];
+		}
+
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		uniformOffsetAlignment = (size_t)alignment;
+		storageOffsetAlignment = uniformOffsetAlignment;
+		if (GLAD_GL_VERSION_4_3)
+		{
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			storageOffsetAlignment = (size_t)alignment;
+		}
+	}
+	FrameRingBuffer(const FrameRingBuffer&) = delete;
+	FrameRingBuffer &operator=(const FrameRingBuffer&) = delete;
+	~FrameRingBuffer()
+	{
+		for (GLsync fence : fences)
+		{
+			if (fence)
+				glDeleteSync(fence);
+		}
+		if (persistent)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+		glDeleteBuffers(1, &ID);
+	}
+	// move to the next region, waiting for the GPU if it still reads from it
+	// ------------------------------------------------------------------------
+	void beginFrame()
+	{
+		lastFrameBytes = cursor;
+		region = (region + 1) % regionCount;
+		cursor = 0;
+		flushed = 0;
+		GLsync fence = fences[region];
+		if (!fence)
+			return;
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED)
+		{
+			stalls++;
+			do
+			{
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (result == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(fence);
+		fences[region] = (GLsync)0;
+	}
+	// ------------------------------------------------------------------------
+	RingAllocation allocate(size_t bytes, size_t alignment = 16)
+	{
+		RingAllocation allocation = { 0, nullptr };
+		size_t start = (cursor + alignment - 1) / alignment * alignment;
+		if (start + bytes > regionSize)
+		{
+			std::cout << "ERROR::FRAME_RING::OUT_OF_SPACE requested " << bytes << " bytes, " << regionSize - cursor << " left this frame" << std::endl;
+			return allocation;
+		}
+		cursor = start + bytes;
+		allocation.offset = region * regionSize + start;
+		allocation.ptr = mapped + allocation.offset;
+		return allocation;
+	}
+	// make the writes so far visible to draws, only does work without persistent mapping
+	// ------------------------------------------------------------------------
+	void flush()
+	{
+		if (!persistent && cursor > flushed)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, region * regionSize + flushed, cursor - flushed, mapped + region * regionSize + flushed);
+		}
+		flushed = cursor;
+	}
+	// fence the region after the last draw that reads from it
+	// ------------------------------------------------------------------------
+	void endFrame()
+	{
+		flush();
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	// ------------------------------------------------------------------------
+	size_t uniformAlignment() const
+	{
+		return uniformOffsetAlignment;
+	}
+	size_t storageAlignment() const
+	{
+		return storageOffsetAlignment;
+	}
+	// number of times beginFrame had to wait for the GPU
+	unsigned int stallCount() const
+	{
+		return stalls;
+	}
+	// bytes allocated in the current and in the previous frame
+	size_t bytesThisFrame() const
+	{
+		return cursor;
+	}
+	size_t bytesLastFrame() const
+	{
+		return lastFrameBytes;
+	}
+
+private:
+	size_t regionSize;
+	unsigned int regionCount;
+	unsigned int region = 0;
+	size_t cursor = 0;
+	size_t flushed = 0;
+	size_t lastFrameBytes = 0;
+	unsigned int stalls = 0;
+	bool persistent;
+	unsigned char *mapped;
+	std::vector<unsigned char> shadow;
+	std::vector<GLsync> fences;
+	size_t uniformOffsetAlignment;
+	size_t storageOffsetAlignment;
+};
+#endif
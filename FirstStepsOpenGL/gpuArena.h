@@ -0,0 +1,580 @@
+#ifndef GPU_ARENA_H
+#define GPU_ARENA_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <random>
+#include <iostream>
+#include <algorithm>
+
+#include "benchmark.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// index of the lowest set bit, bits must not be 0
+// ------------------------------------------------------------------------
+inline unsigned int lowestBit(unsigned int bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, bits);
+	return (unsigned int)index;
+#else
+	return (unsigned int)__builtin_ctz(bits);
+#endif
+}
+// index of the highest set bit, bits must not be 0
+// ------------------------------------------------------------------------
+inline unsigned int highestBit(unsigned int bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, bits);
+	return (unsigned int)index;
+#else
+	return 31u - (unsigned int)__builtin_clz(bits);
+#endif
+}
+
+// Fragmentation numbers of an OffsetAllocator
+struct ArenaStats
+{
+	size_t capacity;
+	size_t freeBytes;
+	size_t largestFreeBlock;
+	unsigned int allocations;
+	unsigned int freeBlocks;
+	// 0 when all free space is one block, close to 1 when it is scattered in small pieces
+	float fragmentation() const
+	{
+		return freeBytes == 0 ? 0.0f : 1.0f - (float)largestFreeBlock / (float)freeBytes;
+	}
+};
+
+// Two level segregated fit (TLSF) allocator over a range of offsets. It never touches
+// the memory it manages, so it can hand out ranges of a GPU buffer. Allocation and
+// free are O(1): free blocks are kept in size class lists found with two bitmaps.
+class OffsetAllocator
+{
+public:
+	static const unsigned int GRANULARITY = 16;
+	static const unsigned int INVALID = 0xFFFFFFFF;
+
+	struct Allocation
+	{
+		size_t offset;      // aligned offset handed to the user
+		unsigned int node;  // INVALID when the allocation failed
+	};
+
+	explicit OffsetAllocator(size_t capacity = 0)
+	{
+		reset(capacity);
+	}
+	// forget every allocation and make the whole range one free block
+	// ------------------------------------------------------------------------
+	void reset(size_t newCapacity)
+	{
+		capacity = newCapacity / GRANULARITY;
+		nodes.clear();
+		unusedNodes.clear();
+		firstLevelBitmap = 0;
+		for (unsigned int level = 0; level < FL_COUNT; level++)
+			secondLevelBitmaps[level] = 0;
+		for (unsigned int list = 0; list < FL_COUNT * SL_COUNT; list++)
+			freeLists[list] = INVALID;
+		allocationCount = 0;
+		if (capacity > 0)
+		{
+			unsigned int node = createNode(0, capacity);
+			insertFree(node);
+		}
+	}
+	// ------------------------------------------------------------------------
+	Allocation allocate(size_t bytes, size_t alignment = GRANULARITY)
+	{
+		Allocation result = { 0, INVALID };
+		// over allocate so the offset can be aligned to any (also non power of two) alignment,
+		// unless every granule start already is, e.g. 4 or 16 but not 12 or 20
+		alignment = std::max<size_t>(alignment, 1);
+		size_t padding = GRANULARITY % alignment != 0 ? alignment - 1 : 0;
+		size_t units = std::max<size_t>(1, (bytes + padding + GRANULARITY - 1) / GRANULARITY);
+
+		unsigned int firstLevel, secondLevel;
+		if (!findFreeList(units, firstLevel, secondLevel))
+			return result;
+		unsigned int node = freeLists[firstLevel * SL_COUNT + secondLevel];
+		removeFree(node);
+
+		// give the tail of the block back to the free lists, createNode may grow nodes so
+		// references are only taken afterwards
+		if (nodes[node].size > units)
+		{
+			unsigned int rest = createNode(nodes[node].offset + units, nodes[node].size - units);
+			Node &split = nodes[rest];
+			Node &owner = nodes[node];
+			split.prevPhysical = node;
+			split.nextPhysical = owner.nextPhysical;
+			if (owner.nextPhysical != INVALID)
+				nodes[owner.nextPhysical].prevPhysical = rest;
+			owner.nextPhysical = rest;
+			owner.size = units;
+			insertFree(rest);
+		}
+		nodes[node].used = true;
+		allocationCount++;
+
+		size_t offset = nodes[node].offset * GRANULARITY;
+		if (offset % alignment != 0)
+			offset = (offset + alignment - 1) / alignment * alignment;
+		result.offset = offset;
+		result.node = node;
+		return result;
+	}
+	// ------------------------------------------------------------------------
+	void free(const Allocation &allocation)
+	{
+		if (allocation.node == INVALID)
+			return;
+		unsigned int node = allocation.node;
+		nodes[node].used = false;
+		allocationCount--;
+
+		// merge with free physical neighbours
+		unsigned int next = nodes[node].nextPhysical;
+		if (next != INVALID && !nodes[next].used)
+		{
+			removeFree(next);
+			absorbNext(node);
+		}
+		unsigned int prev = nodes[node].prevPhysical;
+		if (prev != INVALID && !nodes[prev].used)
+		{
+			removeFree(prev);
+			absorbNext(prev);
+			node = prev;
+		}
+		insertFree(node);
+	}
+	// size of the block reserved for an allocation, including alignment padding
+	// ------------------------------------------------------------------------
+	size_t blockSize(const Allocation &allocation) const
+	{
+		return nodes[allocation.node].size * GRANULARITY;
+	}
+	// ------------------------------------------------------------------------
+	ArenaStats stats() const
+	{
+		ArenaStats result = { capacity * GRANULARITY, 0, 0, allocationCount, 0 };
+		for (unsigned int list = 0; list < FL_COUNT * SL_COUNT; list++)
+		{
+			for (unsigned int node = freeLists[list]; node != INVALID; node = nodes[node].nextFree)
+			{
+				size_t bytes = nodes[node].size * GRANULARITY;
+				result.freeBytes += bytes;
+				result.largestFreeBlock = std::max(result.largestFreeBlock, bytes);
+				result.freeBlocks++;
+			}
+		}
+		return result;
+	}
+
+private:
+	static const unsigned int SL_BITS = 3;
+	static const unsigned int SL_COUNT = 1 << SL_BITS;
+	static const unsigned int FL_COUNT = 32;
+
+	struct Node
+	{
+		size_t offset, size;  // in granules
+		unsigned int prevPhysical, nextPhysical;
+		unsigned int prevFree, nextFree;
+		bool used;
+	};
+	std::vector<Node> nodes;
+	std::vector<unsigned int> unusedNodes;
+	unsigned int firstLevelBitmap;
+	unsigned int secondLevelBitmaps[FL_COUNT];
+	unsigned int freeLists[FL_COUNT * SL_COUNT];
+	size_t capacity;
+	unsigned int allocationCount;
+
+	// size class of a block: first level is the power of two, second level splits it linearly
+	// ------------------------------------------------------------------------
+	static void mapping(size_t units, unsigned int &firstLevel, unsigned int &secondLevel)
+	{
+		if (units < SL_COUNT)
+		{
+			firstLevel = 0;
+			secondLevel = (unsigned int)units;
+			return;
+		}
+		unsigned int log2 = highestBit((unsigned int)units);
+		firstLevel = log2 - SL_BITS + 1;
+		secondLevel = (unsigned int)(units >> (log2 - SL_BITS)) ^ SL_COUNT;
+	}
+	// the first non empty list whose blocks are all large enough for units
+	// ------------------------------------------------------------------------
+	bool findFreeList(size_t units, unsigned int &firstLevel, unsigned int &secondLevel) const
+	{
+		if (units >= SL_COUNT)
+			units += ((size_t)1 << (highestBit((unsigned int)units) - SL_BITS)) - 1;
+		mapping(units, firstLevel, secondLevel);
+		if (firstLevel >= FL_COUNT)
+			return false;
+		unsigned int secondMap = secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+		if (secondMap == 0)
+		{
+			unsigned int firstMap = firstLevel + 1 < FL_COUNT ? firstLevelBitmap & (~0u << (firstLevel + 1)) : 0;
+			if (firstMap == 0)
+				return false;
+			firstLevel = lowestBit(firstMap);
+			secondMap = secondLevelBitmaps[firstLevel];
+		}
+		secondLevel = lowestBit(secondMap);
+		return true;
+	}
+	// ------------------------------------------------------------------------
+	unsigned int createNode(size_t offset, size_t size)
+	{
+		Node node = { offset, size, INVALID, INVALID, INVALID, INVALID, false };
+		if (!unusedNodes.empty())
+		{
+			unsigned int index = unusedNodes.back();
+			unusedNodes.pop_back();
+			nodes[index] = node;
+			return index;
+		}
+		nodes.push_back(node);
+		return (unsigned int)nodes.size() - 1;
+	}
+	// ------------------------------------------------------------------------
+	void insertFree(unsigned int node)
+	{
+		unsigned int firstLevel, secondLevel;
+		mapping(nodes[node].size, firstLevel, secondLevel);
+		unsigned int &head = freeLists[firstLevel * SL_COUNT + secondLevel];
+		nodes[node].prevFree = INVALID;
+		nodes[node].nextFree = head;
+		if (head != INVALID)
+			nodes[head].prevFree = node;
+		head = node;
+		firstLevelBitmap |= 1u << firstLevel;
+		secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+	}
+	// ------------------------------------------------------------------------
+	void removeFree(unsigned int node)
+	{
+		unsigned int firstLevel, secondLevel;
+		mapping(nodes[node].size, firstLevel, secondLevel);
+		unsigned int &head = freeLists[firstLevel * SL_COUNT + secondLevel];
+		Node &n = nodes[node];
+		if (n.prevFree != INVALID)
+			nodes[n.prevFree].nextFree = n.nextFree;
+		else
+			head = n.nextFree;
+		if (n.nextFree != INVALID)
+			nodes[n.nextFree].prevFree = n.prevFree;
+		if (head == INVALID)
+		{
+			secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+			if (secondLevelBitmaps[firstLevel] == 0)
+				firstLevelBitmap &= ~(1u << firstLevel);
+		}
+	}
+	// merge the physical successor of node into node and recycle the successor
+	// ------------------------------------------------------------------------
+	void absorbNext(unsigned int node)
+	{
+		unsigned int next = nodes[node].nextPhysical;
+		nodes[node].size += nodes[next].size;
+		nodes[node].nextPhysical = nodes[next].nextPhysical;
+		if (nodes[next].nextPhysical != INVALID)
+			nodes[nodes[next].nextPhysical].prevPhysical = node;
+		unusedNodes.push_back(next);
+	}
+};
+
+// One immutable GL buffer that holds the vertex and index data of many meshes. Ranges
+// are handed out by an OffsetAllocator and referred to by a stable handle, so
+// defragment() can move them while the GL buffer name (and every VAO using it) stays valid.
+class GpuArena
+{
+public:
+	unsigned int ID;
+
+	explicit GpuArena(size_t capacity) : allocator(capacity), capacity(capacity)
+	{
+		glGenBuffers(1, &ID);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+		if (GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage)
+			glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_DYNAMIC_STORAGE_BIT);
+		else
+			glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+	}
+	GpuArena(const GpuArena&) = delete;
+	GpuArena &operator=(const GpuArena&) = delete;
+	~GpuArena()
+	{
+		glDeleteBuffers(1, &ID);
+	}
+	// copy data into a new range and return its handle, INVALID when the arena is full
+	// ------------------------------------------------------------------------
+	unsigned int upload(const void *data, size_t bytes, size_t alignment = OffsetAllocator::GRANULARITY)
+	{
+		OffsetAllocator::Allocation allocation = allocator.allocate(bytes, alignment);
+		if (allocation.node == OffsetAllocator::INVALID)
+		{
+			std::cout << "ERROR::GPU_ARENA::OUT_OF_MEMORY allocating " << bytes << " bytes" << std::endl;
+			return OffsetAllocator::INVALID;
+		}
+		Range range = { allocation, bytes, alignment, true };
+		unsigned int handle;
+		if (!unusedHandles.empty())
+		{
+			handle = unusedHandles.back();
+			unusedHandles.pop_back();
+			ranges[handle] = range;
+		}
+		else
+		{
+			handle = (unsigned int)ranges.size();
+			ranges.push_back(range);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.offset, bytes, data);
+		return handle;
+	}
+	// ------------------------------------------------------------------------
+	void release(unsigned int handle)
+	{
+		if (handle >= ranges.size() || !ranges[handle].live)
+		{
+			std::cout << "ERROR::GPU_ARENA::INVALID_RELEASE of handle " << handle << std::endl;
+			return;
+		}
+		allocator.free(ranges[handle].allocation);
+		ranges[handle].live = false;
+		unusedHandles.push_back(handle);
+	}
+	// ------------------------------------------------------------------------
+	size_t offset(unsigned int handle) const
+	{
+		return ranges[handle].allocation.offset;
+	}
+	ArenaStats stats() const
+	{
+		return allocator.stats();
+	}
+	// Pack every live range to the front of the buffer. The data goes through a scratch
+	// buffer because glCopyBufferSubData may not copy between overlapping ranges.
+	// Offsets change, so draws must re-read offset() afterwards.
+	// ------------------------------------------------------------------------
+	void defragment()
+	{
+		std::vector<unsigned int> order;
+		size_t liveBytes = 0;
+		for (unsigned int handle = 0; handle < ranges.size(); handle++)
+		{
+			if (ranges[handle].live)
+			{
+				order.push_back(handle);
+				liveBytes += allocator.blockSize(ranges[handle].allocation);
+			}
+		}
+		std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return ranges[a].allocation.offset < ranges[b].allocation.offset; });
+
+		unsigned int scratch;
+		glGenBuffers(1, &scratch);
+		glBindBuffer(GL_COPY_READ_BUFFER, ID);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+		glBufferData(GL_COPY_WRITE_BUFFER, std::max<size_t>(liveBytes, 1), NULL, GL_STREAM_COPY);
+		std::vector<size_t> scratchOffsets;
+		size_t cursor = 0;
+		for (unsigned int handle : order)
+		{
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, ranges[handle].allocation.offset, cursor, ranges[handle].bytes);
+			scratchOffsets.push_back(cursor);
+			cursor += allocator.blockSize(ranges[handle].allocation);
+		}
+
+		// allocating in offset order from an empty allocator packs the ranges tightly
+		allocator.reset(capacity);
+		glBindBuffer(GL_COPY_READ_BUFFER, scratch);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+		for (size_t i = 0; i < order.size(); i++)
+		{
+			Range &range = ranges[order[i]];
+			range.allocation = allocator.allocate(range.bytes, range.alignment);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, scratchOffsets[i], range.allocation.offset, range.bytes);
+		}
+		glDeleteBuffers(1, &scratch);
+	}
+
+private:
+	struct Range
+	{
+		OffsetAllocator::Allocation allocation;
+		size_t bytes;
+		size_t alignment;
+		bool live;
+	};
+	OffsetAllocator allocator;
+	size_t capacity;
+	std::vector<Range> ranges;
+	std::vector<unsigned int> unusedHandles;
+};
+
+// A mesh living inside a MeshArena
+struct ArenaMesh
+{
+	unsigned int vertexRange;
+	unsigned int indexRange;
+	GLsizei indexCount;
+};
+
+// Every mesh with the same vertex format shares one arena buffer and one VAO. The
+// buffer is bound as both vertex and index buffer and meshes are drawn with
+// glDrawElementsBaseVertex, so switching meshes needs no binds at all.
+class MeshArena
+{
+public:
+	unsigned int VAO;
+	GpuArena buffer;
+
+	// setupAttributes issues the glVertexAttribPointer calls for offset 0 of the format
+	MeshArena(size_t capacity, unsigned int stride, void (*setupAttributes)()) : buffer(capacity), stride(stride)
+	{
+		glGenVertexArrays(1, &VAO);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer.ID);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer.ID);
+		setupAttributes();
+		glBindVertexArray(0);
+	}
+	~MeshArena()
+	{
+		glDeleteVertexArrays(1, &VAO);
+	}
+	// ------------------------------------------------------------------------
+	ArenaMesh add(const void *vertices, size_t vertexBytes, const unsigned int *indices, size_t indexCount)
+	{
+		ArenaMesh mesh;
+		// vertex ranges must start on a whole vertex so they can be addressed by base vertex
+		mesh.vertexRange = buffer.upload(vertices, vertexBytes, stride);
+		mesh.indexRange = buffer.upload(indices, indexCount * sizeof(unsigned int), sizeof(unsigned int));
+		mesh.indexCount = (GLsizei)indexCount;
+		return mesh;
+	}
+	// ------------------------------------------------------------------------
+	void remove(const ArenaMesh &mesh)
+	{
+		buffer.release(mesh.vertexRange);
+		buffer.release(mesh.indexRange);
+	}
+	// VAO must be bound
+	// ------------------------------------------------------------------------
+	void draw(const ArenaMesh &mesh) const
+	{
+		GLint baseVertex = (GLint)(buffer.offset(mesh.vertexRange) / stride);
+		glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, (void*)buffer.offset(mesh.indexRange), baseVertex);
+	}
+
+private:
+	unsigned int stride;
+};
+
+// Random allocate/free churn on the allocator alone, then on a GPU arena including
+// one compaction, reporting throughput and fragmentation.
+// ------------------------------------------------------------------------
+inline void benchmarkArenaChurn(size_t capacity, unsigned int operations)
+{
+	std::mt19937 random(42);
+	std::uniform_int_distribution<size_t> sizes(64, 64 * 1024);
+
+	OffsetAllocator allocator(capacity);
+	std::vector<OffsetAllocator::Allocation> live;
+	std::vector<size_t> liveSizes;
+	size_t liveBytes = 0;
+	unsigned int failed = 0, misaligned = 0;
+	// 12 is the PackedMesh vertex stride, 20 does not divide the granularity either
+	const size_t alignments[3] = { 4, 12, 20 };
+	BenchmarkTimer timer;
+	for (unsigned int op = 0; op < operations; op++)
+	{
+		// hover around 75% full, below that free one in three operations
+		bool doFree = !live.empty() && (liveBytes > capacity / 4 * 3 || random() % 3 == 0);
+		if (doFree)
+		{
+			size_t victim = random() % live.size();
+			allocator.free(live[victim]);
+			liveBytes -= liveSizes[victim];
+			live[victim] = live.back();
+			liveSizes[victim] = liveSizes.back();
+			live.pop_back();
+			liveSizes.pop_back();
+		}
+		else
+		{
+			size_t bytes = sizes(random);
+			size_t alignment = alignments[random() % 3];
+			OffsetAllocator::Allocation allocation = allocator.allocate(bytes, alignment);
+			if (allocation.node == OffsetAllocator::INVALID)
+			{
+				failed++;
+				continue;
+			}
+			misaligned += allocation.offset % alignment != 0 ? 1 : 0;
+			live.push_back(allocation);
+			liveSizes.push_back(bytes);
+			liveBytes += bytes;
+		}
+	}
+	double allocatorMs = timer.elapsedMs();
+	ArenaStats stats = allocator.stats();
+	printBenchmarkResult("ARENA::ALLOCATOR_CHURN", operations / (allocatorMs / 1000.0), "ops/s");
+	printBenchmarkResult("ARENA::FAILED_ALLOCATIONS", failed, "allocations");
+	printBenchmarkResult("ARENA::LIVE_ALLOCATIONS", stats.allocations, "allocations");
+	printBenchmarkResult("ARENA::FREE_BLOCKS", stats.freeBlocks, "blocks");
+	printBenchmarkResult("ARENA::FRAGMENTATION", stats.fragmentation(), "");
+	printBenchmarkResult("ARENA::MISALIGNED_ALLOCATIONS", misaligned, "allocations");
+
+	// the same pattern on a real buffer, with uploads, followed by a compaction
+	GpuArena arena(capacity);
+	std::vector<unsigned char> data(64 * 1024, 0xAB);
+	std::vector<unsigned int> handles;
+	timer.restart();
+	for (unsigned int op = 0; op < operations; op++)
+	{
+		if (!handles.empty() && random() % 2)
+		{
+			size_t victim = random() % handles.size();
+			arena.release(handles[victim]);
+			handles[victim] = handles.back();
+			handles.pop_back();
+		}
+		else
+		{
+			unsigned int handle = arena.upload(&data[0], sizes(random), 12);
+			if (handle != OffsetAllocator::INVALID)
+				handles.push_back(handle);
+		}
+	}
+	glFinish();
+	printBenchmarkResult("ARENA::GPU_CHURN", operations / (timer.elapsedMs() / 1000.0), "ops/s");
+	printBenchmarkResult("ARENA::FRAGMENTATION_BEFORE_DEFRAGMENT", arena.stats().fragmentation(), "");
+	timer.restart();
+	arena.defragment();
+	glFinish();
+	printBenchmarkResult("ARENA::DEFRAGMENT_TIME", timer.elapsedMs(), "ms");
+	printBenchmarkResult("ARENA::FRAGMENTATION_AFTER_DEFRAGMENT", arena.stats().fragmentation(), "");
+
+	// every range was uploaded with a 12 byte vertex stride, base vertex = offset / 12 must be exact
+	unsigned int misalignedVertices = 0;
+	for (unsigned int handle : handles)
+		misalignedVertices += arena.offset(handle) % 12 != 0 ? 1 : 0;
+	printBenchmarkResult("ARENA::MISALIGNED_VERTEX_RANGES", misalignedVertices, "ranges");
+}
+#endif
@@ -0,0 +1,152 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Byte oriented LZ77 in the style of an LZ4 block: no entropy coding, so decoding is a
+// few copies per sequence and runs near memory speed. Meant for pixel data kept in RAM
+// or on disk, where decode speed matters more than ratio.
+//
+// A block is a list of sequences, each
+//   token            high nibble literal count, low nibble match length - 4 (15: more bytes follow)
+//   [length bytes]   added to the literal count while they are 255
+//   literals
+//   offset           2 bytes little endian, distance back to the match
+//   [length bytes]   added to the match length while they are 255
+// The last sequence has literals only and ends the block.
+namespace lz
+{
+	const size_t MIN_MATCH = 4;
+	const size_t MAX_OFFSET = 65535;
+	const int HASH_BITS = 16;
+
+	// ------------------------------------------------------------------------
+	inline unsigned int read32(const unsigned char *p)
+	{
+		unsigned int v;
+		std::memcpy(&v, p, 4);
+		return v;
+	}
+	inline void writeLength(std::vector<unsigned char> &out, size_t length)
+	{
+		for (; length >= 255; length -= 255)
+			out.push_back(255);
+		out.push_back((unsigned char)length);
+	}
+	// ------------------------------------------------------------------------
+	inline void writeSequence(std::vector<unsigned char> &out, const unsigned char *literals, size_t literalCount, size_t offset, size_t matchLength)
+	{
+		size_t match = matchLength ? matchLength - MIN_MATCH : 0;
+		out.push_back((unsigned char)(((literalCount < 15 ? literalCount : 15) << 4) | (match < 15 ? match : 15)));
+		if (literalCount >= 15)
+			writeLength(out, literalCount - 15);
+		out.insert(out.end(), literals, literals + literalCount);
+		if (!matchLength)
+			return;
+		out.push_back((unsigned char)(offset & 0xFF));
+		out.push_back((unsigned char)(offset >> 8));
+		if (match >= 15)
+			writeLength(out, match - 15);
+	}
+}
+
+// ------------------------------------------------------------------------
+inline std::vector<unsigned char> lzCompress(const unsigned char *src, size_t size)
+{
+	std::vector<unsigned char> out;
+	out.reserve(size / 2 + 16);
+	std::vector<size_t> table((size_t)1 << lz::HASH_BITS, (size_t)-1);
+	size_t anchor = 0, i = 0, misses = 0;
+	while (i + lz::MIN_MATCH <= size)
+	{
+		unsigned int sequence = lz::read32(src + i);
+		size_t hash = (sequence * 2654435761u) >> (32 - lz::HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = i;
+		if (candidate != (size_t)-1 && i - candidate <= lz::MAX_OFFSET && lz::read32(src + candidate) == sequence)
+		{
+			size_t length = lz::MIN_MATCH;
+			while (i + length < size && src[candidate + length] == src[i + length])
+				length++;
+			lz::writeSequence(out, src + anchor, i - anchor, i - candidate, length);
+			i += length;
+			anchor = i;
+			misses = 0;
+		}
+		else
+		{
+			// skip ahead faster through data that does not compress
+			i += 1 + (misses++ >> 6);
+		}
+	}
+	lz::writeSequence(out, src + anchor, size - anchor, 0, 0);
+	return out;
+}
+
+// decodes exactly size bytes into dst, false on a malformed or truncated block
+// ------------------------------------------------------------------------
+inline bool lzDecompress(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t size)
+{
+	const unsigned char *in = src, *inEnd = src + srcSize;
+	unsigned char *out = dst, *outEnd = dst + size;
+	while (in < inEnd)
+	{
+		unsigned int token = *in++;
+		size_t literals = token >> 4;
+		if (literals == 15)
+		{
+			unsigned char more;
+			do
+			{
+				if (in >= inEnd)
+					return false;
+				more = *in++;
+				literals += more;
+			} while (more == 255);
+		}
+		if ((size_t)(inEnd - in) < literals || (size_t)(outEnd - out) < literals)
+			return false;
+		std::memcpy(out, in, literals);
+		in += literals;
+		out += literals;
+		if (in == inEnd)
+			break;
+
+		if (inEnd - in < 2)
+			return false;
+		size_t offset = in[0] | ((size_t)in[1] << 8);
+		in += 2;
+		size_t length = (token & 15) + lz::MIN_MATCH;
+		if ((token & 15) == 15)
+		{
+			unsigned char more;
+			do
+			{
+				if (in >= inEnd)
+					return false;
+				more = *in++;
+				length += more;
+			} while (more == 255);
+		}
+		if (offset == 0 || offset > (size_t)(out - dst) || (size_t)(outEnd - out) < length)
+			return false;
+		// matches may overlap their own output (runs), copy forward byte by byte then
+		const unsigned char *match = out - offset;
+		if (offset >= length)
+			std::memcpy(out, match, length);
+		else
+			for (size_t k = 0; k < length; k++)
+				out[k] = match[k];
+		out += length;
+	}
+	return out == outEnd;
+}
+
+// ------------------------------------------------------------------------
+inline std::vector<unsigned char> lzCompress(const std::vector<unsigned char> &src)
+{
+	return lzCompress(src.empty() ? NULL : &src[0], src.size());
+}
+#endif
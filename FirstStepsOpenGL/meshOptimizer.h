@@ -0,0 +1,381 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+
+// Indexed triangle mesh, every vertex is floatsPerVertex floats and starts with its position
+struct Mesh
+{
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+	unsigned int floatsPerVertex;
+
+	unsigned int vertexCount() const
+	{
+		return (unsigned int)(vertices.size() / floatsPerVertex);
+	}
+	unsigned int triangleCount() const
+	{
+		return (unsigned int)(indices.size() / 3);
+	}
+	glm::vec3 position(unsigned int vertex) const
+	{
+		const float *v = &vertices[vertex * floatsPerVertex];
+		return glm::vec3(v[0], v[1], v[2]);
+	}
+};
+
+// Post-transform cache and vertex fetch statistics of a mesh
+struct MeshStats
+{
+	float acmr;             // vertex shader invocations per triangle
+	float atvr;             // vertex shader invocations per unique vertex
+	float fetchEfficiency;  // vertex buffer bytes / bytes fetched from memory
+};
+
+// turn a non-indexed triangle list into an indexed mesh, vertices with identical attributes are merged
+// ------------------------------------------------------------------------
+inline Mesh weldVertices(const float *vertices, unsigned int vertexCount, unsigned int floatsPerVertex)
+{
+	Mesh mesh;
+	mesh.floatsPerVertex = floatsPerVertex;
+	mesh.indices.reserve(vertexCount);
+
+	// hash the raw bytes of each vertex, buckets hold the indices of welded vertices
+	std::unordered_map<size_t, std::vector<unsigned int> > buckets;
+	size_t vertexBytes = floatsPerVertex * sizeof(float);
+	for (unsigned int i = 0; i < vertexCount; i++)
+	{
+		const float *v = vertices + i * floatsPerVertex;
+		size_t hash = 14695981039346656037ULL;
+		const unsigned char *bytes = (const unsigned char*)v;
+		for (size_t b = 0; b < vertexBytes; b++)
+			hash = (hash ^ bytes[b]) * 1099511628211ULL;
+
+		std::vector<unsigned int> &bucket = buckets[hash];
+		unsigned int index = 0xFFFFFFFF;
+		for (unsigned int candidate : bucket)
+		{
+			if (std::memcmp(&mesh.vertices[candidate * floatsPerVertex], v, vertexBytes) == 0)
+			{
+				index = candidate;
+				break;
+			}
+		}
+		if (index == 0xFFFFFFFF)
+		{
+			index = mesh.vertexCount();
+			mesh.vertices.insert(mesh.vertices.end(), v, v + floatsPerVertex);
+			bucket.push_back(index);
+		}
+		mesh.indices.push_back(index);
+	}
+	return mesh;
+}
+
+// Reorder triangles for the post-transform vertex cache using Tom Forsyth's
+// linear-speed vertex cache optimisation.
+// ------------------------------------------------------------------------
+inline void optimizeVertexCache(Mesh &mesh)
+{
+	const int cacheSize = 32;
+	unsigned int vertexCount = mesh.vertexCount();
+	unsigned int triangleCount = mesh.triangleCount();
+	if (triangleCount == 0)
+		return;
+
+	// triangles that use each vertex
+	std::vector<unsigned int> valence(vertexCount, 0);
+	for (unsigned int index : mesh.indices)
+		valence[index]++;
+	std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+	for (unsigned int v = 0; v < vertexCount; v++)
+		adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+	std::vector<unsigned int> adjacency(mesh.indices.size());
+	std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (unsigned int t = 0; t < triangleCount; t++)
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[mesh.indices[t * 3 + k]]++] = t;
+
+	std::vector<unsigned int> remaining(valence);
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	auto scoreVertex = [&](unsigned int v) -> float
+	{
+		if (remaining[v] == 0)
+			return -1.0f;
+		float score = 0.0f;
+		int position = cachePosition[v];
+		if (position >= 0)
+		{
+			// the last triangle's vertices get a fixed score so it is not simply repeated
+			if (position < 3)
+				score = 0.75f;
+			else
+				score = std::pow(1.0f - (float)(position - 3) / (cacheSize - 3), 1.5f);
+		}
+		// favour vertices with few triangles left so no lone triangles are left behind
+		score += 2.0f / std::sqrt((float)remaining[v]);
+		return score;
+	};
+	for (unsigned int v = 0; v < vertexCount; v++)
+		vertexScore[v] = scoreVertex(v);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<unsigned char> emitted(triangleCount, 0);
+	for (unsigned int t = 0; t < triangleCount; t++)
+		triangleScore[t] = vertexScore[mesh.indices[t * 3]] + vertexScore[mesh.indices[t * 3 + 1]] + vertexScore[mesh.indices[t * 3 + 2]];
+
+	std::vector<unsigned int> cache, newCache;
+	std::vector<unsigned int> result;
+	result.reserve(mesh.indices.size());
+	unsigned int searchStart = 0;
+	int best = -1;
+	for (unsigned int emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		// nothing useful in the cache, fall back to a scan over the remaining triangles
+		if (best < 0)
+		{
+			float bestScore = -1.0f;
+			for (unsigned int t = searchStart; t < triangleCount; t++)
+			{
+				if (!emitted[t] && triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+			while (searchStart < triangleCount && emitted[searchStart])
+				searchStart++;
+		}
+		unsigned int triangle = (unsigned int)best;
+		emitted[triangle] = 1;
+
+		// emit the triangle and move its vertices to the front of the cache
+		newCache.clear();
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = mesh.indices[triangle * 3 + k];
+			result.push_back(v);
+			newCache.push_back(v);
+			unsigned int *begin = &adjacency[adjacencyStart[v]];
+			unsigned int *end = begin + remaining[v];
+			*std::find(begin, end, triangle) = *(end - 1);
+			remaining[v]--;
+		}
+		for (unsigned int v : cache)
+		{
+			if (std::find(newCache.begin(), newCache.end(), v) == newCache.end())
+				newCache.push_back(v);
+		}
+		for (size_t i = cacheSize; i < newCache.size(); i++)
+		{
+			// evicted vertices lose their cache bonus, keep their triangles' scores current for the scan
+			unsigned int v = newCache[i];
+			cachePosition[v] = -1;
+			vertexScore[v] = scoreVertex(v);
+			for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; a++)
+			{
+				unsigned int t = adjacency[a];
+				triangleScore[t] = vertexScore[mesh.indices[t * 3]] + vertexScore[mesh.indices[t * 3 + 1]] + vertexScore[mesh.indices[t * 3 + 2]];
+			}
+		}
+		if (newCache.size() > (size_t)cacheSize)
+			newCache.resize(cacheSize);
+		cache.swap(newCache);
+
+		// rescore the cached vertices and the triangles that touch them
+		for (size_t i = 0; i < cache.size(); i++)
+			cachePosition[cache[i]] = (int)i;
+		for (unsigned int v : cache)
+			vertexScore[v] = scoreVertex(v);
+		best = -1;
+		float bestScore = -1.0f;
+		for (unsigned int v : cache)
+		{
+			for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v] + remaining[v]; a++)
+			{
+				unsigned int t = adjacency[a];
+				triangleScore[t] = vertexScore[mesh.indices[t * 3]] + vertexScore[mesh.indices[t * 3 + 1]] + vertexScore[mesh.indices[t * 3 + 2]];
+				if (triangleScore[t] > bestScore)
+				{
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+	}
+	mesh.indices.swap(result);
+}
+
+// Tipsify-style overdraw reduction. The cache optimised triangle order is cut into
+// clusters wherever a triangle misses the cache completely, then the clusters are
+// sorted so the ones facing away from the mesh centre (likely occluders) draw first.
+// Call after optimizeVertexCache, the cluster boundaries keep most of its cache hits.
+// ------------------------------------------------------------------------
+inline void optimizeOverdraw(Mesh &mesh, unsigned int minClusterTriangles = 16)
+{
+	const unsigned int cacheSize = 16;
+	unsigned int triangleCount = mesh.triangleCount();
+	if (triangleCount == 0)
+		return;
+
+	std::vector<unsigned int> clusterStarts;
+	std::vector<unsigned int> fifo;
+	for (unsigned int t = 0; t < triangleCount; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = mesh.indices[t * 3 + k];
+			if (std::find(fifo.begin(), fifo.end(), v) == fifo.end())
+			{
+				misses++;
+				fifo.push_back(v);
+				if (fifo.size() > cacheSize)
+					fifo.erase(fifo.begin());
+			}
+		}
+		bool canSplit = clusterStarts.empty() || t - clusterStarts.back() >= minClusterTriangles;
+		if (t == 0 || (misses == 3 && canSplit))
+			clusterStarts.push_back(t);
+	}
+	clusterStarts.push_back(triangleCount);
+
+	glm::vec3 meshCentre(0.0f);
+	for (unsigned int v = 0; v < mesh.vertexCount(); v++)
+		meshCentre += mesh.position(v);
+	meshCentre = meshCentre / (float)mesh.vertexCount();
+
+	struct Cluster
+	{
+		unsigned int start, end;
+		float sortKey;
+	};
+	std::vector<Cluster> clusters;
+	for (size_t c = 0; c + 1 < clusterStarts.size(); c++)
+	{
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (unsigned int t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+		{
+			glm::vec3 a = mesh.position(mesh.indices[t * 3]);
+			glm::vec3 b = mesh.position(mesh.indices[t * 3 + 1]);
+			glm::vec3 d = mesh.position(mesh.indices[t * 3 + 2]);
+			glm::vec3 n = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(n);
+			centroid += (a + b + d) * (triangleArea / 3.0f);
+			normal += n;
+			area += triangleArea;
+		}
+		if (area > 0.0f)
+			centroid = centroid / area;
+		float normalLength = glm::length(normal);
+		if (normalLength > 0.0f)
+			normal = normal / normalLength;
+		Cluster cluster = { clusterStarts[c], clusterStarts[c + 1], glm::dot(centroid - meshCentre, normal) };
+		clusters.push_back(cluster);
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+	std::vector<unsigned int> result;
+	result.reserve(mesh.indices.size());
+	for (const Cluster &cluster : clusters)
+		result.insert(result.end(), mesh.indices.begin() + cluster.start * 3, mesh.indices.begin() + cluster.end * 3);
+	mesh.indices.swap(result);
+}
+
+// Renumber vertices in the order the index buffer first references them so the
+// vertex fetch walks memory linearly. Unreferenced vertices are dropped.
+// ------------------------------------------------------------------------
+inline void optimizeVertexFetch(Mesh &mesh)
+{
+	std::vector<unsigned int> remap(mesh.vertexCount(), 0xFFFFFFFF);
+	std::vector<float> vertices;
+	vertices.reserve(mesh.vertices.size());
+	unsigned int next = 0;
+	for (unsigned int &index : mesh.indices)
+	{
+		if (remap[index] == 0xFFFFFFFF)
+		{
+			remap[index] = next++;
+			const float *v = &mesh.vertices[index * mesh.floatsPerVertex];
+			vertices.insert(vertices.end(), v, v + mesh.floatsPerVertex);
+		}
+		index = remap[index];
+	}
+	mesh.vertices.swap(vertices);
+}
+
+// Simulate a FIFO post-transform cache and a small cache of memory lines for vertex fetch
+// ------------------------------------------------------------------------
+inline MeshStats analyzeMesh(const Mesh &mesh, unsigned int cacheSize = 16, unsigned int lineSize = 64, unsigned int lineCount = 32)
+{
+	MeshStats stats = { 0.0f, 0.0f, 0.0f };
+	if (mesh.indices.empty())
+		return stats;
+
+	unsigned int vertexBytes = mesh.floatsPerVertex * sizeof(float);
+	std::vector<unsigned int> vertexCache, lineCache;
+	std::vector<unsigned char> used(mesh.vertexCount(), 0);
+	unsigned int transformed = 0, uniqueVertices = 0, linesFetched = 0;
+	for (unsigned int v : mesh.indices)
+	{
+		if (!used[v])
+		{
+			used[v] = 1;
+			uniqueVertices++;
+		}
+		if (std::find(vertexCache.begin(), vertexCache.end(), v) != vertexCache.end())
+			continue;
+		transformed++;
+		vertexCache.push_back(v);
+		if (vertexCache.size() > cacheSize)
+			vertexCache.erase(vertexCache.begin());
+
+		// every transformed vertex pulls the memory lines it spans
+		unsigned int firstLine = v * vertexBytes / lineSize;
+		unsigned int lastLine = (v * vertexBytes + vertexBytes - 1) / lineSize;
+		for (unsigned int line = firstLine; line <= lastLine; line++)
+		{
+			if (std::find(lineCache.begin(), lineCache.end(), line) != lineCache.end())
+				continue;
+			linesFetched++;
+			lineCache.push_back(line);
+			if (lineCache.size() > lineCount)
+				lineCache.erase(lineCache.begin());
+		}
+	}
+	stats.acmr = (float)transformed / mesh.triangleCount();
+	stats.atvr = (float)transformed / uniqueVertices;
+	stats.fetchEfficiency = (float)(uniqueVertices * vertexBytes) / (float)(linesFetched * lineSize);
+	return stats;
+}
+// ------------------------------------------------------------------------
+inline void printMeshStats(const std::string &name, const MeshStats &stats)
+{
+	std::cout << "MESH::" << name << " ACMR: " << stats.acmr << " ATVR: " << stats.atvr << " fetch efficiency: " << stats.fetchEfficiency << std::endl;
+}
+
+// weld, optimise and report a non-indexed triangle list in one call
+// ------------------------------------------------------------------------
+inline Mesh processMesh(const std::string &name, const float *vertices, unsigned int vertexCount, unsigned int floatsPerVertex, bool reduceOverdraw = false)
+{
+	Mesh mesh = weldVertices(vertices, vertexCount, floatsPerVertex);
+	printMeshStats(name + "::WELDED", analyzeMesh(mesh));
+	optimizeVertexCache(mesh);
+	if (reduceOverdraw)
+		optimizeOverdraw(mesh);
+	optimizeVertexFetch(mesh);
+	printMeshStats(name + "::OPTIMIZED", analyzeMesh(mesh));
+	return mesh;
+}
+#endif
@@ -0,0 +1,34 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;      // unorm16 position inside the mesh bounding box
+layout (location = 1) in vec2 aTexCoord; // unorm16 or half float, both arrive as float
+layout (location = 2) in vec2 aNormal;   // octahedral snorm16
+
+out vec2 TexCoord;
+out vec3 Normal;
+
+#include "uniformBlocks.glsl"
+
+// bounding box the positions were quantized against
+#ifdef GL_SPIRV
+layout (location = 0) uniform vec3 boundsMin;
+layout (location = 1) uniform vec3 boundsExtent;
+#else
+uniform vec3 boundsMin;
+uniform vec3 boundsExtent;
+#endif
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void main()
+{
+    vec3 position = boundsMin + aPos * boundsExtent;
+    gl_Position = viewProjection * model * vec4(position, 1.0);
+    TexCoord = vec2(aTexCoord.x, 1.0 - aTexCoord.y);
+    Normal = mat3(model) * decodeOctahedral(aNormal);
+}
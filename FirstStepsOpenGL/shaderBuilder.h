@@ -0,0 +1,277 @@
+#ifndef SHADER_BUILDER_H
+#define SHADER_BUILDER_H
+
+#include <glad/glad.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <future>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "shaderProgram.h"
+#include "shaderStageCache.h"
+#include "benchmark.h"
+
+// One program of a shader manifest
+struct ShaderManifestEntry
+{
+	std::string name;
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::string geometryPath;  // empty when the program has no geometry stage
+};
+
+// Manifest lines are "name vertex fragment [geometry]", # starts a comment
+// ------------------------------------------------------------------------
+inline std::vector<ShaderManifestEntry> loadShaderManifest(const char *path)
+{
+	std::vector<ShaderManifestEntry> entries;
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cout << "ERROR::SHADER_BUILDER::MANIFEST_NOT_FOUND " << path << std::endl;
+		return entries;
+	}
+	std::string line;
+	while (std::getline(file, line))
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		ShaderManifestEntry entry;
+		if (!(fields >> entry.name >> entry.vertexPath >> entry.fragmentPath))
+			continue;
+		fields >> entry.geometryPath;
+		entries.push_back(entry);
+	}
+	return entries;
+}
+
+// Builds every program of a manifest in one go. submit() reads all source files on
+// worker threads, then issues every glCompileShader and glLinkProgram without asking
+// for a status, which would force the driver to finish each one before the next is
+// even started. With GL_KHR_parallel_shader_compile the driver compiles them on its
+// own threads; status is only checked when get() hands a program out for the first time.
+// Stages come from a ShaderStageCache, so programs sharing a file compile it once; pass a
+// cache to share stages between builders, otherwise the builder uses its own.
+class ShaderBuilder
+{
+public:
+	explicit ShaderBuilder(ShaderStageCache *sharedCache = nullptr) : stageCache(sharedCache ? sharedCache : &ownCache)
+	{
+		parallelCompile = GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+		if (GLAD_GL_KHR_parallel_shader_compile)
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		else if (GLAD_GL_ARB_parallel_shader_compile)
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	}
+	// ------------------------------------------------------------------------
+	void add(const ShaderManifestEntry &entry)
+	{
+		Program program;
+		program.entry = entry;
+		programs[entry.name] = program;
+	}
+	void addManifest(const char *path)
+	{
+		std::vector<ShaderManifestEntry> entries = loadShaderManifest(path);
+		for (const ShaderManifestEntry &entry : entries)
+			add(entry);
+	}
+	// start compiling and linking everything that was added
+	// ------------------------------------------------------------------------
+	void submit()
+	{
+		BenchmarkTimer timer;
+		// every file is read once, on its own thread
+		std::map<std::string, std::shared_future<std::string> > reads;
+		for (auto &item : programs)
+		{
+			const ShaderManifestEntry &entry = item.second.entry;
+			const std::string *paths[3] = { &entry.vertexPath, &entry.fragmentPath, &entry.geometryPath };
+			for (const std::string *path : paths)
+			{
+				if (!path->empty() && reads.find(*path) == reads.end())
+					reads[*path] = std::async(std::launch::async, readShaderFile, *path).share();
+			}
+		}
+
+		for (auto &item : programs)
+		{
+			Program &program = item.second;
+			if (program.shader.ID != 0)
+				continue;
+			const std::string *paths[3] = { &program.entry.vertexPath, &program.entry.fragmentPath, &program.entry.geometryPath };
+			const GLenum types[3] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+			program.shader.ID = glCreateProgram();
+			for (int stage = 0; stage < 3; stage++)
+			{
+				program.stages[stage] = 0;
+				if (paths[stage]->empty())
+					continue;
+				program.stages[stage] = stageCache->acquire(types[stage], reads[*paths[stage]].get());
+				glAttachShader(program.shader.ID, program.stages[stage]);
+			}
+			glLinkProgram(program.shader.ID);
+		}
+		submitMs = timer.elapsedMs();
+	}
+	// true when the program can be used without blocking, always true without the extension
+	// ------------------------------------------------------------------------
+	bool isReady(const std::string &name) const
+	{
+		std::map<std::string, Program>::const_iterator found = programs.find(name);
+		if (found == programs.end() || !parallelCompile || found->second.checked)
+			return true;
+		int done = 0;
+		glGetProgramiv(found->second.shader.ID, GL_COMPLETION_STATUS_KHR, &done);
+		return done != 0;
+	}
+	// the linked program, the first call checks compile and link status (and may block)
+	// ------------------------------------------------------------------------
+	Shader &get(const std::string &name)
+	{
+		std::map<std::string, Program>::iterator found = programs.find(name);
+		if (found == programs.end())
+		{
+			std::cout << "ERROR::SHADER_BUILDER::UNKNOWN_PROGRAM " << name << std::endl;
+			static Shader missing;
+			return missing;
+		}
+		Program &program = found->second;
+		if (!program.checked)
+		{
+			const char *stageNames[3] = { "VERTEX", "FRAGMENT", "GEOMETRY" };
+			if (!Shader::checkCompileErrors(program.shader.ID, "PROGRAM"))
+			{
+				// only a failed link is worth the stage logs
+				for (int stage = 0; stage < 3; stage++)
+				{
+					if (program.stages[stage])
+						Shader::checkCompileErrors(program.stages[stage], stageNames[stage]);
+				}
+				std::cout << "ERROR::SHADER_BUILDER::PROGRAM " << name << " failed to build" << std::endl;
+			}
+			program.shader.bindUniformBlocks();
+			for (int stage = 0; stage < 3; stage++)
+			{
+				if (program.stages[stage])
+					stageCache->release(program.stages[stage]);
+				program.stages[stage] = 0;
+			}
+			program.checked = true;
+		}
+		return program.shader;
+	}
+	// ------------------------------------------------------------------------
+	std::vector<std::string> names() const
+	{
+		std::vector<std::string> result;
+		for (auto &item : programs)
+			result.push_back(item.first);
+		return result;
+	}
+	bool usesParallelCompile() const
+	{
+		return parallelCompile;
+	}
+	const ShaderStageCache &stages() const
+	{
+		return *stageCache;
+	}
+	// time spent in submit() on the calling thread
+	double submitTime() const
+	{
+		return submitMs;
+	}
+
+private:
+	struct Program
+	{
+		ShaderManifestEntry entry;
+		Shader shader;
+		unsigned int stages[3] = { 0, 0, 0 };
+		bool checked = false;
+	};
+	std::map<std::string, Program> programs;
+	ShaderStageCache ownCache;
+	ShaderStageCache *stageCache;
+	bool parallelCompile;
+	double submitMs = 0.0;
+};
+
+// Startup cost of the manifest built one Shader at a time versus with ShaderBuilder.
+// Drivers may cache compiled programs, so run the modes in separate launches for exact numbers.
+// ------------------------------------------------------------------------
+inline void benchmarkShaderBuilder(const char *manifestPath)
+{
+	std::vector<ShaderManifestEntry> entries = loadShaderManifest(manifestPath);
+
+	BenchmarkTimer timer;
+	std::vector<unsigned int> serialPrograms;
+	for (const ShaderManifestEntry &entry : entries)
+	{
+		Shader shader(entry.vertexPath.c_str(), entry.fragmentPath.c_str(), entry.geometryPath.empty() ? nullptr : entry.geometryPath.c_str());
+		serialPrograms.push_back(shader.ID);
+	}
+	double serialMs = timer.elapsedMs();
+
+	timer.restart();
+	ShaderBuilder builder;
+	for (const ShaderManifestEntry &entry : entries)
+		builder.add(entry);
+	builder.submit();
+	std::vector<std::string> names = builder.names();
+	std::vector<unsigned int> batchedPrograms;
+	for (const std::string &name : names)
+		batchedPrograms.push_back(builder.get(name).ID);
+	double batchedMs = timer.elapsedMs();
+
+	printBenchmarkResult("SHADER_BUILDER::SERIAL", serialMs, "ms");
+	printBenchmarkResult("SHADER_BUILDER::BATCHED_SUBMIT", builder.submitTime(), "ms");
+	printBenchmarkResult(builder.usesParallelCompile() ? "SHADER_BUILDER::BATCHED_PARALLEL" : "SHADER_BUILDER::BATCHED_NO_PARALLEL_EXTENSION", batchedMs, "ms");
+	for (unsigned int program : serialPrograms)
+		glDeleteProgram(program);
+	for (unsigned int program : batchedPrograms)
+		glDeleteProgram(program);
+}
+
+// A scene of many materials that share two vertex and two fragment shaders, built with the stage cache disabled (every program compiles its own stages)
+// and enabled. Reports how many glCompileShader calls each needed and the wall time.
+// ------------------------------------------------------------------------
+inline void benchmarkShaderStageCache(unsigned int programCount)
+{
+	const char *vertexPaths[2] = { "basicVertexShader.vs", "packedVertexShader.vs" };
+	const char *fragmentPaths[2] = { "textureFragment.fs", "orangeFragmentShader.fs" };
+	for (int cached = 0; cached < 2; cached++)
+	{
+		BenchmarkTimer timer;
+		ShaderStageCache cache(cached != 0);
+		ShaderBuilder builder(&cache);
+		for (unsigned int i = 0; i < programCount; i++)
+		{
+			ShaderManifestEntry entry;
+			entry.name = "material" + std::to_string(i);
+			entry.vertexPath = vertexPaths[i % 2];
+			entry.fragmentPath = fragmentPaths[(i / 2) % 2];
+			builder.add(entry);
+		}
+		builder.submit();
+		std::vector<std::string> names = builder.names();
+		std::vector<unsigned int> built;
+		for (const std::string &name : names)
+			built.push_back(builder.get(name).ID);
+		double ms = timer.elapsedMs();
+
+		printBenchmarkResult(cached ? "SHADER_STAGE_CACHE::CACHED_COMPILES" : "SHADER_STAGE_CACHE::UNCACHED_COMPILES", (double)cache.compileCount(), "stages");
+		printBenchmarkResult(cached ? "SHADER_STAGE_CACHE::CACHED_BUILD" : "SHADER_STAGE_CACHE::UNCACHED_BUILD", ms, "ms");
+		if (cached)
+			printBenchmarkResult("SHADER_STAGE_CACHE::HITS", (double)cache.hitCount(), "stages");
+		printBenchmarkResult("SHADER_STAGE_CACHE::LEAKED_STAGES", (double)cache.liveStages(), "stages");
+		for (unsigned int program : built)
+			glDeleteProgram(program);
+	}
+}
+#endif
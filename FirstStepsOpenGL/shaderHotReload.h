@@ -0,0 +1,351 @@
+#ifndef SHADER_HOT_RELOAD_H
+#define SHADER_HOT_RELOAD_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <set>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <iostream>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include "shaderProgram.h"
+#include "shaderPreprocessor.h"
+#include "benchmark.h"
+
+// Reports which watched files changed. On Linux it is an inotify watch on each file's
+// directory (editors often save by writing a new file and renaming it over the old one,
+// which a watch on the file itself would miss); elsewhere modification times are polled.
+class ShaderFileWatcher
+{
+public:
+	ShaderFileWatcher()
+	{
+#ifdef __linux__
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd < 0)
+			std::cout << "ERROR::SHADER_HOT_RELOAD::INOTIFY_INIT_FAILED" << std::endl;
+#endif
+	}
+	~ShaderFileWatcher()
+	{
+#ifdef __linux__
+		if (fd >= 0)
+			close(fd);
+#endif
+	}
+	ShaderFileWatcher(const ShaderFileWatcher&) = delete;
+	ShaderFileWatcher &operator=(const ShaderFileWatcher&) = delete;
+
+	// ------------------------------------------------------------------------
+	void add(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!files.insert(std::make_pair(path, modificationTime(path))).second)
+			return;
+#ifdef __linux__
+		size_t slash = path.find_last_of('/');
+		std::string directory = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+		for (auto &watch : directories)
+		{
+			if (watch.second == directory)
+				return;
+		}
+		int wd = inotify_add_watch(fd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (wd >= 0)
+			directories[wd] = directory;
+#endif
+	}
+	// wait up to timeoutMs for changes, appends the paths that changed
+	// ------------------------------------------------------------------------
+	bool wait(std::vector<std::string> &changed, int timeoutMs)
+	{
+		size_t before = changed.size();
+#ifdef __linux__
+		pollfd request = { fd, POLLIN, 0 };
+		if (fd < 0 || poll(&request, 1, timeoutMs) <= 0)
+			return false;
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (char *at = buffer; at < buffer + length; at += sizeof(inotify_event) + ((inotify_event*)at)->len)
+			{
+				inotify_event *event = (inotify_event*)at;
+				if (event->len == 0 || directories.find(event->wd) == directories.end())
+					continue;
+				std::string path = directories[event->wd] + event->name;
+				if (files.find(path) != files.end())
+					changed.push_back(path);
+			}
+		}
+#else
+		std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto &file : files)
+		{
+			long long time = modificationTime(file.first);
+			if (time != file.second)
+			{
+				file.second = time;
+				changed.push_back(file.first);
+			}
+		}
+#endif
+		return changed.size() > before;
+	}
+
+private:
+	std::mutex mutex;
+	std::map<std::string, long long> files;  // path -> last modification time
+#ifdef __linux__
+	int fd = -1;
+	std::map<int, std::string> directories;  // watch descriptor -> directory prefix
+#endif
+
+	// ------------------------------------------------------------------------
+	static long long modificationTime(const std::string &path)
+	{
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return 0;
+		return (long long)info.st_mtime;
+	}
+};
+
+// Rebuilds programs whose source files (including their #includes) change on disk.
+// A worker thread owns a hidden window whose context shares objects with the main one;
+// it compiles and links there, waits on a fence so the program is complete, and queues
+// it. swapReloaded() replaces the Shader's ID at the start of a frame, so the render
+// loop never waits for a compile. A program that fails to build is reported and the old
+// one stays in use.
+class ShaderHotReload
+{
+public:
+	// call after the main context is created, from the main thread (GLFW windows must be)
+	explicit ShaderHotReload(GLFWwindow *mainWindow)
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		compileWindow = glfwCreateWindow(1, 1, "shader compiler", NULL, mainWindow);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		if (compileWindow == NULL)
+		{
+			std::cout << "ERROR::SHADER_HOT_RELOAD::SHARED_CONTEXT_FAILED" << std::endl;
+			return;
+		}
+		running = true;
+		worker = std::thread(&ShaderHotReload::run, this);
+	}
+	// call before glfwTerminate, with the main context current
+	~ShaderHotReload()
+	{
+		running = false;
+		if (worker.joinable())
+			worker.join();
+		for (Reloaded &reloaded : ready)
+			glDeleteProgram(reloaded.program);
+		if (compileWindow)
+			glfwDestroyWindow(compileWindow);
+	}
+	ShaderHotReload(const ShaderHotReload&) = delete;
+	ShaderHotReload &operator=(const ShaderHotReload&) = delete;
+
+	// onReload runs on the main thread after a swap, to set plain uniforms (samplers etc.)
+	// again; the shared uniform blocks are rebound automatically
+	// ------------------------------------------------------------------------
+	void watch(Shader &shader, const std::string &vertexPath, const std::string &fragmentPath,
+	           const std::string &geometryPath = "", std::function<void(Shader&)> onReload = nullptr)
+	{
+		std::unique_ptr<Watched> watched(new Watched);
+		watched->shader = &shader;
+		watched->paths[0] = vertexPath;
+		watched->paths[1] = fragmentPath;
+		watched->paths[2] = geometryPath;
+		watched->onReload = onReload;
+		// find the included files too
+		for (const std::string &path : watched->paths)
+		{
+			if (path.empty())
+				continue;
+			ShaderPreprocessor preprocessor;
+			preprocessor.processFile(path);
+			watched->files.insert(preprocessor.files.begin(), preprocessor.files.end());
+		}
+		for (const std::string &file : watched->files)
+			watcher.add(file);
+		std::lock_guard<std::mutex> lock(mutex);
+		programs.push_back(std::move(watched));
+	}
+	// swap in every program that finished since the last call, once per frame
+	// ------------------------------------------------------------------------
+	void swapReloaded()
+	{
+		std::vector<Reloaded> swaps;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (ready.empty())
+				return;
+			swaps.swap(ready);
+		}
+		for (Reloaded &reloaded : swaps)
+		{
+			Shader &shader = *reloaded.watched->shader;
+			unsigned int old = shader.ID;
+			// a uniform shadow belongs to the old program, onReload sets the new one directly
+			// and the shadow is rebuilt from what it left there
+			bool shadowed = shader.uniformShadow() != nullptr;
+			shader.shadowUniforms(false);
+			shader.ID = reloaded.program;
+			shader.bindUniformBlocks();
+			if (reloaded.watched->onReload)
+				reloaded.watched->onReload(shader);
+			if (shadowed)
+				shader.shadowUniforms();
+			// still bound programs are deleted by GL once they are no longer in use
+			glDeleteProgram(old);
+			std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - reloaded.changed;
+			lastLatencyMs = latency.count();
+			reloads++;
+			printBenchmarkResult("SHADER_HOT_RELOAD::LATENCY " + reloaded.watched->paths[1], lastLatencyMs, "ms");
+		}
+	}
+	// ------------------------------------------------------------------------
+	unsigned int reloadCount() const
+	{
+		return reloads;
+	}
+	unsigned int failureCount() const
+	{
+		return failures;
+	}
+	// file change seen to program swapped, of the last reload
+	double lastLatency() const
+	{
+		return lastLatencyMs;
+	}
+
+private:
+	struct Watched
+	{
+		Shader *shader;
+		std::string paths[3];
+		std::set<std::string> files;
+		std::function<void(Shader&)> onReload;
+	};
+	struct Reloaded
+	{
+		Watched *watched;
+		unsigned int program;
+		std::chrono::steady_clock::time_point changed;
+	};
+	GLFWwindow *compileWindow = NULL;
+	std::thread worker;
+	std::atomic<bool> running{ false };
+	std::mutex mutex;
+	std::vector<std::unique_ptr<Watched> > programs;
+	std::vector<Reloaded> ready;
+	ShaderFileWatcher watcher;
+	std::atomic<unsigned int> failures{ 0 };
+	unsigned int reloads = 0;
+	double lastLatencyMs = 0.0;
+
+	// ------------------------------------------------------------------------
+	void run()
+	{
+		glfwMakeContextCurrent(compileWindow);
+		while (running)
+		{
+			std::vector<std::string> changed;
+			if (!watcher.wait(changed, 100))
+				continue;
+			std::chrono::steady_clock::time_point seen = std::chrono::steady_clock::now();
+			// a save can arrive as several events, collect them before compiling
+			while (watcher.wait(changed, 50))
+				;
+			std::set<std::string> changedFiles(changed.begin(), changed.end());
+
+			std::vector<Watched*> affected;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (std::unique_ptr<Watched> &watched : programs)
+				{
+					for (const std::string &file : watched->files)
+					{
+						if (changedFiles.count(file))
+						{
+							affected.push_back(watched.get());
+							break;
+						}
+					}
+				}
+			}
+			for (Watched *watched : affected)
+				rebuild(watched, seen);
+		}
+		glfwMakeContextCurrent(NULL);
+	}
+	// compile and link on the worker context, blocking here is fine
+	// ------------------------------------------------------------------------
+	void rebuild(Watched *watched, std::chrono::steady_clock::time_point seen)
+	{
+		const GLenum types[3] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+		const char *stageNames[3] = { "VERTEX", "FRAGMENT", "GEOMETRY" };
+		std::set<std::string> files;
+		unsigned int program = glCreateProgram();
+		bool success = true;
+		for (int stage = 0; stage < 3; stage++)
+		{
+			if (watched->paths[stage].empty())
+				continue;
+			ShaderPreprocessor preprocessor;
+			std::string source = preprocessor.processFile(watched->paths[stage]);
+			files.insert(preprocessor.files.begin(), preprocessor.files.end());
+			const char *code = source.c_str();
+			unsigned int shader = glCreateShader(types[stage]);
+			glShaderSource(shader, 1, &code, NULL);
+			glCompileShader(shader);
+			success = Shader::checkCompileErrors(shader, stageNames[stage]) && success;
+			glAttachShader(program, shader);
+			glDeleteShader(shader);
+		}
+		if (success)
+		{
+			glLinkProgram(program);
+			success = Shader::checkCompileErrors(program, "PROGRAM");
+		}
+		if (!success)
+		{
+			std::cout << "ERROR::SHADER_HOT_RELOAD::KEEPING_OLD_PROGRAM " << watched->paths[0] << " / " << watched->paths[1] << std::endl;
+			glDeleteProgram(program);
+			failures++;
+			return;
+		}
+		// the main context may only use the program once its commands have completed here
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		glDeleteSync(fence);
+
+		for (const std::string &file : files)
+			watcher.add(file);
+		std::lock_guard<std::mutex> lock(mutex);
+		// an edit may have added or removed #includes
+		watched->files = files;
+		Reloaded reloaded = { watched, program, seen };
+		ready.push_back(reloaded);
+	}
+};
+#endif
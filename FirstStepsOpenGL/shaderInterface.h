@@ -0,0 +1,389 @@
+#ifndef SHADER_INTERFACE_H
+#define SHADER_INTERFACE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+#include "shaderProgram.h"
+#include "benchmark.h"
+
+// Describe the interface of a shader once in C++ and let the compiler generate the
+// attribute setup and uniform uploads:
+//
+//   typedef VertexLayout<VertexAttribute<0, float, 3>, VertexAttribute<1, float, 2> > CubeVertex;
+//   SHADER_UNIFORM(Texture1, "texture1", Sampler);
+//   SHADER_UNIFORM_BLOCK(CameraUniforms, "Camera", CameraBlock, CAMERA_BLOCK_BINDING);
+//   ShaderInterface<Texture1, CameraUniforms> ourInterface;
+//
+// Uniform handles are types, their names are hashed at compile time and set<Texture1>()
+// indexes a location table filled once by load(), so no strings are touched per draw.
+
+// FNV-1a, usable in constant expressions
+// ------------------------------------------------------------------------
+constexpr unsigned int hashName(const char *name, unsigned int hash = 2166136261u)
+{
+	return *name ? hashName(name + 1, (hash ^ (unsigned char)*name) * 16777619u) : hash;
+}
+
+// Vertex attributes
+// ------------------------------------------------------------------------
+template<typename T> struct GLComponentType;
+template<> struct GLComponentType<float> { static const GLenum value = GL_FLOAT; };
+template<> struct GLComponentType<int> { static const GLenum value = GL_INT; };
+template<> struct GLComponentType<unsigned short> { static const GLenum value = GL_UNSIGNED_SHORT; };
+template<> struct GLComponentType<short> { static const GLenum value = GL_SHORT; };
+template<> struct GLComponentType<unsigned char> { static const GLenum value = GL_UNSIGNED_BYTE; };
+
+// GLSL type a float attribute with Count components shows up as in program reflection
+template<unsigned int Count> struct GLFloatVector;
+template<> struct GLFloatVector<1> { static const GLenum value = GL_FLOAT; };
+template<> struct GLFloatVector<2> { static const GLenum value = GL_FLOAT_VEC2; };
+template<> struct GLFloatVector<3> { static const GLenum value = GL_FLOAT_VEC3; };
+template<> struct GLFloatVector<4> { static const GLenum value = GL_FLOAT_VEC4; };
+
+// Count components of Component at a fixed location, integer components are converted
+// to float in the shader (normalized when Normalized is GL_TRUE)
+template<unsigned int Location, typename Component, unsigned int Count, GLboolean Normalized = GL_FALSE>
+struct VertexAttribute
+{
+	static const unsigned int location = Location;
+	static const unsigned int size = sizeof(Component) * Count;
+
+	static void enable(size_t offset, GLsizei stride)
+	{
+		glVertexAttribPointer(Location, Count, GLComponentType<Component>::value, Normalized, stride, (void*)offset);
+		glEnableVertexAttribArray(Location);
+	}
+	static bool validate(GLuint program)
+	{
+		GLint count = 0;
+		glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &count);
+		char name[256];
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint arraySize;
+			GLenum type;
+			glGetActiveAttrib(program, i, sizeof(name), NULL, &arraySize, &type, name);
+			if (glGetAttribLocation(program, name) != (GLint)Location)
+				continue;
+			if (type != GLFloatVector<Count>::value)
+			{
+				std::cout << "ERROR::SHADER_INTERFACE::ATTRIBUTE_TYPE_MISMATCH at location " << Location << " (" << name << ")" << std::endl;
+				return false;
+			}
+			return true;
+		}
+		// an attribute the shader does not read is fetched for nothing but not an error
+		std::cout << "WARNING::SHADER_INTERFACE::ATTRIBUTE_NOT_ACTIVE at location " << Location << std::endl;
+		return true;
+	}
+};
+
+// unused bytes inside a vertex, e.g. to keep packed attributes 4 byte aligned
+template<unsigned int Bytes>
+struct VertexPadding
+{
+	static const unsigned int size = Bytes;
+	static void enable(size_t, GLsizei) {}
+	static bool validate(GLuint) { return true; }
+};
+
+template<typename... Attributes> struct AttributeSizeSum;
+template<> struct AttributeSizeSum<>
+{
+	static const unsigned int value = 0;
+};
+template<typename First, typename... Rest> struct AttributeSizeSum<First, Rest...>
+{
+	static const unsigned int value = First::size + AttributeSizeSum<Rest...>::value;
+};
+
+// Interleaved vertex made of the attributes in order, without implicit padding
+template<typename... Attributes>
+struct VertexLayout
+{
+	static const GLsizei stride = AttributeSizeSum<Attributes...>::value;
+
+	// attribute pointers for the bound VAO and GL_ARRAY_BUFFER
+	static void setup(size_t baseOffset = 0)
+	{
+		size_t offset = baseOffset;
+		int expand[] = { 0, (Attributes::enable(offset, stride), offset += Attributes::size, 0)... };
+		(void)expand;
+	}
+	// check every attribute against the program's reflection, prints each mismatch
+	static bool validate(GLuint program)
+	{
+		bool valid = true;
+		int expand[] = { 0, (valid = Attributes::validate(program) && valid, 0)... };
+		(void)expand;
+		return valid;
+	}
+};
+
+// Uniforms
+// ------------------------------------------------------------------------
+// tag type for sampler uniforms, the value is the texture unit
+struct Sampler
+{
+	int unit;
+};
+
+template<typename T> struct GLUniform;
+template<> struct GLUniform<int>
+{
+	static bool matches(GLenum type) { return type == GL_INT || type == GL_BOOL; }
+	static void upload(GLint location, const int &value) { glUniform1i(location, value); }
+};
+template<> struct GLUniform<float>
+{
+	static bool matches(GLenum type) { return type == GL_FLOAT; }
+	static void upload(GLint location, const float &value) { glUniform1f(location, value); }
+};
+template<> struct GLUniform<glm::vec2>
+{
+	static bool matches(GLenum type) { return type == GL_FLOAT_VEC2; }
+	static void upload(GLint location, const glm::vec2 &value) { glUniform2fv(location, 1, &value[0]); }
+};
+template<> struct GLUniform<glm::vec3>
+{
+	static bool matches(GLenum type) { return type == GL_FLOAT_VEC3; }
+	static void upload(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, &value[0]); }
+};
+template<> struct GLUniform<glm::vec4>
+{
+	static bool matches(GLenum type) { return type == GL_FLOAT_VEC4; }
+	static void upload(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, &value[0]); }
+};
+template<> struct GLUniform<glm::mat3>
+{
+	static bool matches(GLenum type) { return type == GL_FLOAT_MAT3; }
+	static void upload(GLint location, const glm::mat3 &value) { glUniformMatrix3fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+template<> struct GLUniform<glm::mat4>
+{
+	static bool matches(GLenum type) { return type == GL_FLOAT_MAT4; }
+	static void upload(GLint location, const glm::mat4 &value) { glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]); }
+};
+template<> struct GLUniform<Sampler>
+{
+	static bool matches(GLenum type) { return type == GL_SAMPLER_2D || type == GL_SAMPLER_2D_ARRAY || type == GL_SAMPLER_3D || type == GL_SAMPLER_CUBE; }
+	static void upload(GLint location, const Sampler &value) { glUniform1i(location, value.unit); }
+};
+
+// One active uniform or uniform block found by reflection, keyed by the hash of its name
+struct ReflectedUniform
+{
+	unsigned int hash;
+	GLenum type;
+	GLint location;
+	bool isBlock;
+	GLint blockSize;
+	GLuint blockIndex;
+};
+
+// Loose uniform called Name in GLSL
+#define SHADER_UNIFORM(Handle, Name, Type) \
+	struct Handle \
+	{ \
+		typedef Type type; \
+		static const char *name() { return Name; } \
+		static const unsigned int hash = hashName(Name); \
+		static bool resolve(const std::vector<ReflectedUniform> &reflection, GLuint /*program*/, GLint &location) \
+		{ \
+			return resolveUniform<Type>(reflection, hash, name(), location); \
+		} \
+	}
+
+// std140 block called Name in GLSL whose C++ mirror is Struct, bound to Binding on load
+#define SHADER_UNIFORM_BLOCK(Handle, Name, Struct, Binding) \
+	struct Handle \
+	{ \
+		typedef Struct type; \
+		static const char *name() { return Name; } \
+		static const unsigned int hash = hashName(Name); \
+		static bool resolve(const std::vector<ReflectedUniform> &reflection, GLuint program, GLint &location) \
+		{ \
+			location = -1; \
+			return resolveBlock(reflection, program, hash, name(), sizeof(Struct), Binding); \
+		} \
+	}
+
+// ------------------------------------------------------------------------
+inline const ReflectedUniform *findReflected(const std::vector<ReflectedUniform> &reflection, unsigned int hash, bool isBlock)
+{
+	for (const ReflectedUniform &uniform : reflection)
+	{
+		if (uniform.hash == hash && uniform.isBlock == isBlock)
+			return &uniform;
+	}
+	return nullptr;
+}
+// ------------------------------------------------------------------------
+template<typename T>
+bool resolveUniform(const std::vector<ReflectedUniform> &reflection, unsigned int hash, const char *name, GLint &location)
+{
+	const ReflectedUniform *uniform = findReflected(reflection, hash, false);
+	location = -1;
+	if (uniform == nullptr)
+	{
+		// optimised out uniforms are not an error, uploads to location -1 are ignored by GL
+		std::cout << "WARNING::SHADER_INTERFACE::UNIFORM_NOT_ACTIVE " << name << std::endl;
+		return true;
+	}
+	if (!GLUniform<T>::matches(uniform->type))
+	{
+		std::cout << "ERROR::SHADER_INTERFACE::UNIFORM_TYPE_MISMATCH " << name << std::endl;
+		return false;
+	}
+	location = uniform->location;
+	return true;
+}
+// ------------------------------------------------------------------------
+inline bool resolveBlock(const std::vector<ReflectedUniform> &reflection, GLuint program, unsigned int hash, const char *name, size_t size, unsigned int binding)
+{
+	const ReflectedUniform *block = findReflected(reflection, hash, true);
+	if (block == nullptr)
+	{
+		std::cout << "WARNING::SHADER_INTERFACE::BLOCK_NOT_ACTIVE " << name << std::endl;
+		return true;
+	}
+	if ((size_t)block->blockSize != size)
+	{
+		std::cout << "ERROR::SHADER_INTERFACE::BLOCK_SIZE_MISMATCH " << name << " is " << block->blockSize << " bytes in GLSL and " << size << " bytes in C++" << std::endl;
+		return false;
+	}
+	glUniformBlockBinding(program, block->blockIndex, binding);
+	return true;
+}
+// every active uniform and uniform block of a program, uniforms inside blocks are skipped
+// ------------------------------------------------------------------------
+inline std::vector<ReflectedUniform> reflectProgram(GLuint program)
+{
+	std::vector<ReflectedUniform> reflection;
+	char name[256];
+	GLint count = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		GLint arraySize;
+		GLenum type;
+		glGetActiveUniform(program, i, sizeof(name), NULL, &arraySize, &type, name);
+		GLuint index = (GLuint)i;
+		GLint blockIndex;
+		glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+		if (blockIndex != -1)
+			continue;
+		ReflectedUniform uniform = { 0, type, glGetUniformLocation(program, name), false, 0, 0 };
+		// arrays are reported as name[0], the handle refers to the array itself
+		std::string plain(name);
+		size_t bracket = plain.find('[');
+		if (bracket != std::string::npos)
+			plain.resize(bracket);
+		uniform.hash = hashName(plain.c_str());
+		reflection.push_back(uniform);
+	}
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		glGetActiveUniformBlockName(program, i, sizeof(name), NULL, name);
+		ReflectedUniform block = { hashName(name), GL_NONE, -1, true, 0, (GLuint)i };
+		glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.blockSize);
+		reflection.push_back(block);
+	}
+	return reflection;
+}
+
+template<typename T, typename... List> struct IndexOf;
+template<typename T, typename... Rest> struct IndexOf<T, T, Rest...>
+{
+	static const unsigned int value = 0;
+};
+template<typename T, typename First, typename... Rest> struct IndexOf<T, First, Rest...>
+{
+	static const unsigned int value = 1 + IndexOf<T, Rest...>::value;
+};
+
+// The uniforms and blocks of one program
+template<typename... Members>
+class ShaderInterface
+{
+public:
+	// reflect the program once, check every member and resolve uniform locations
+	// ------------------------------------------------------------------------
+	bool load(GLuint program)
+	{
+		std::vector<ReflectedUniform> reflection = reflectProgram(program);
+		bool valid = true;
+		unsigned int i = 0;
+		int expand[] = { 0, (valid = Members::resolve(reflection, program, locations[i++]) && valid, 0)... };
+		(void)expand;
+		return valid;
+	}
+	// upload a uniform of the currently used program
+	// ------------------------------------------------------------------------
+	template<typename Handle>
+	void set(const typename Handle::type &value) const
+	{
+		GLUniform<typename Handle::type>::upload(locations[IndexOf<Handle, Members...>::value], value);
+	}
+	// ------------------------------------------------------------------------
+	template<typename Handle>
+	GLint location() const
+	{
+		return locations[IndexOf<Handle, Members...>::value];
+	}
+
+private:
+	GLint locations[sizeof...(Members) + 1];
+};
+
+SHADER_UNIFORM(BenchmarkBoundsMin, "boundsMin", glm::vec3);
+SHADER_UNIFORM(BenchmarkBoundsExtent, "boundsExtent", glm::vec3);
+SHADER_UNIFORM(BenchmarkTexture1, "texture1", Sampler);
+SHADER_UNIFORM(BenchmarkTexture2, "texture2", Sampler);
+
+// Per draw CPU cost of uploading the same uniforms through the string based Shader
+// setters and through a ShaderInterface.
+// ------------------------------------------------------------------------
+inline void benchmarkShaderInterface(unsigned int draws)
+{
+	Shader shader("packedVertexShader.vs", "textureFragment.fs");
+	ShaderInterface<BenchmarkBoundsMin, BenchmarkBoundsExtent, BenchmarkTexture1, BenchmarkTexture2> typed;
+	typed.load(shader.ID);
+	shader.use();
+
+	glm::vec3 boundsMin(-1.0f), boundsExtent(2.0f);
+	BenchmarkTimer timer;
+	for (unsigned int d = 0; d < draws; d++)
+	{
+		shader.setVec3("boundsMin", boundsMin);
+		shader.setVec3("boundsExtent", boundsExtent);
+		shader.setInt("texture1", 0);
+		shader.setInt("texture2", 1);
+	}
+	glFinish();
+	double stringMs = timer.elapsedMs();
+
+	Sampler unit0 = { 0 }, unit1 = { 1 };
+	timer.restart();
+	for (unsigned int d = 0; d < draws; d++)
+	{
+		typed.set<BenchmarkBoundsMin>(boundsMin);
+		typed.set<BenchmarkBoundsExtent>(boundsExtent);
+		typed.set<BenchmarkTexture1>(unit0);
+		typed.set<BenchmarkTexture2>(unit1);
+	}
+	glFinish();
+	double typedMs = timer.elapsedMs();
+
+	printBenchmarkResult("SHADER_INTERFACE::STRING_SETTERS", stringMs * 1e6 / draws, "ns/draw");
+	printBenchmarkResult("SHADER_INTERFACE::TYPED_HANDLES", typedMs * 1e6 / draws, "ns/draw");
+	glDeleteProgram(shader.ID);
+}
+#endif
@@ -0,0 +1,267 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <glad/glad.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <iostream>
+
+#include "shaderProgram.h"
+#include "shaderPreprocessor.h"
+#include "shaderStageCache.h"
+#include "benchmark.h"
+
+// Variants of a shader family selected by #define sets, e.g. textureFragment.fs with
+// and without SINGLE_TEXTURE. A variant is only built the first time get() asks for it
+// and is kept under its permutation key afterwards. precompile() preprocesses a declared
+// list of variants on worker threads; update() then hands the finished ones to the driver
+// without waiting for them, so by the time they are requested they are usually linked.
+class ShaderPermutations
+{
+public:
+	explicit ShaderPermutations(ShaderStageCache *sharedCache = nullptr) : stageCache(sharedCache ? sharedCache : &ownCache)
+	{
+	}
+	~ShaderPermutations()
+	{
+		for (auto &item : variants)
+		{
+			if (item.second.pending.valid())
+				item.second.pending.wait();
+			for (unsigned int stage : item.second.stages)
+			{
+				if (stage)
+					stageCache->release(stage);
+			}
+			if (item.second.shader.ID)
+				glDeleteProgram(item.second.shader.ID);
+		}
+	}
+	ShaderPermutations(const ShaderPermutations&) = delete;
+	ShaderPermutations &operator=(const ShaderPermutations&) = delete;
+
+	// ------------------------------------------------------------------------
+	void declare(const std::string &name, const std::string &vertexPath, const std::string &fragmentPath, const std::string &geometryPath = "")
+	{
+		Family family;
+		family.paths[0] = vertexPath;
+		family.paths[1] = fragmentPath;
+		family.paths[2] = geometryPath;
+		families[name] = family;
+	}
+	// the program for one variant, built (blocking) if it was never requested or precompiled
+	// ------------------------------------------------------------------------
+	Shader &get(const std::string &name, const ShaderDefines &defines = ShaderDefines())
+	{
+		requested++;
+		std::string key = permutationKey(name, defines);
+		std::map<std::string, Variant>::iterator found = variants.find(key);
+		if (found == variants.end())
+		{
+			std::map<std::string, Family>::iterator family = families.find(name);
+			if (family == families.end())
+			{
+				std::cout << "ERROR::SHADER_PERMUTATIONS::UNKNOWN_FAMILY " << name << std::endl;
+				static Shader missing;
+				return missing;
+			}
+			Variant &variant = variants[key];
+			variant.used = true;
+			submit(variant, preprocess(family->second, defines));
+			return finish(key, variant);
+		}
+		Variant &variant = found->second;
+		// the first request of a precompiled variant is not a hit, it was built for it
+		if (variant.used)
+			cached++;
+		variant.used = true;
+		if (variant.pending.valid())
+			submit(variant, variant.pending.get());
+		return finish(key, variant);
+	}
+	// ------------------------------------------------------------------------
+	bool isCached(const std::string &name, const ShaderDefines &defines) const
+	{
+		return variants.find(permutationKey(name, defines)) != variants.end();
+	}
+	// preprocess the listed variants in the background, call update() to submit them
+	// ------------------------------------------------------------------------
+	void precompile(const std::string &name, const std::vector<ShaderDefines> &list)
+	{
+		std::map<std::string, Family>::iterator family = families.find(name);
+		if (family == families.end())
+		{
+			std::cout << "ERROR::SHADER_PERMUTATIONS::UNKNOWN_FAMILY " << name << std::endl;
+			return;
+		}
+		for (const ShaderDefines &defines : list)
+		{
+			std::string key = permutationKey(name, defines);
+			if (variants.find(key) != variants.end())
+				continue;
+			variants[key].pending = std::async(std::launch::async, &ShaderPermutations::preprocess, family->second, defines);
+		}
+	}
+	// submit variants whose sources are ready, once per frame; never blocks on a worker
+	// ------------------------------------------------------------------------
+	void update()
+	{
+		for (auto &item : variants)
+		{
+			Variant &variant = item.second;
+			if (variant.pending.valid() && variant.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				submit(variant, variant.pending.get());
+		}
+	}
+	// ------------------------------------------------------------------------
+	unsigned int requestedCount() const
+	{
+		return requested;
+	}
+	// variants that were compiled, on request or ahead of time
+	unsigned int compiledCount() const
+	{
+		return compiled;
+	}
+	// repeat requests of a variant, served without building it again
+	unsigned int cachedCount() const
+	{
+		return cached;
+	}
+	// ------------------------------------------------------------------------
+	void printStats() const
+	{
+		std::cout << "SHADER_PERMUTATIONS::requested " << requested << " compiled " << compiled
+		          << " cached " << cached << " variants " << variants.size() << std::endl;
+	}
+
+private:
+	struct Family
+	{
+		std::string paths[3];  // vertex, fragment, geometry (may be empty)
+	};
+	struct Sources
+	{
+		std::string code[3];
+	};
+	struct Variant
+	{
+		Shader shader;
+		unsigned int stages[3] = { 0, 0, 0 };
+		std::future<Sources> pending;
+		bool checked = false;
+		bool used = false;  // get() returned it before
+	};
+	std::map<std::string, Family> families;
+	std::map<std::string, Variant> variants;
+	ShaderStageCache ownCache;
+	ShaderStageCache *stageCache;
+	unsigned int requested = 0;
+	unsigned int compiled = 0;
+	unsigned int cached = 0;
+
+	// file reads and #include / #define handling only, safe on any thread
+	// ------------------------------------------------------------------------
+	static Sources preprocess(Family family, ShaderDefines defines)
+	{
+		Sources sources;
+		ShaderPreprocessor preprocessor;
+		for (int stage = 0; stage < 3; stage++)
+		{
+			if (!family.paths[stage].empty())
+				sources.code[stage] = preprocessor.processFile(family.paths[stage], defines);
+		}
+		return sources;
+	}
+	// compile and link without asking for status, so the driver can work in parallel
+	// ------------------------------------------------------------------------
+	void submit(Variant &variant, const Sources &sources)
+	{
+		const GLenum types[3] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+		variant.shader.ID = glCreateProgram();
+		for (int stage = 0; stage < 3; stage++)
+		{
+			if (sources.code[stage].empty())
+				continue;
+			variant.stages[stage] = stageCache->acquire(types[stage], sources.code[stage]);
+			glAttachShader(variant.shader.ID, variant.stages[stage]);
+		}
+		glLinkProgram(variant.shader.ID);
+		compiled++;
+	}
+	// first use of a variant: check the link, bind the shared blocks, drop the stages
+	// ------------------------------------------------------------------------
+	Shader &finish(const std::string &key, Variant &variant)
+	{
+		if (variant.checked)
+			return variant.shader;
+		const char *stageNames[3] = { "VERTEX", "FRAGMENT", "GEOMETRY" };
+		if (!Shader::checkCompileErrors(variant.shader.ID, "PROGRAM"))
+		{
+			for (int stage = 0; stage < 3; stage++)
+			{
+				if (variant.stages[stage])
+					Shader::checkCompileErrors(variant.stages[stage], stageNames[stage]);
+			}
+			std::cout << "ERROR::SHADER_PERMUTATIONS::VARIANT " << key << " failed to build" << std::endl;
+		}
+		variant.shader.bindUniformBlocks();
+		for (int stage = 0; stage < 3; stage++)
+		{
+			if (variant.stages[stage])
+				stageCache->release(variant.stages[stage]);
+			variant.stages[stage] = 0;
+		}
+		variant.checked = true;
+		return variant.shader;
+	}
+};
+
+// Material requests cycling over both texture families with and without SINGLE_TEXTURE:
+// built lazily on first request, then served from the cache, compared against the same
+// variants precompiled a few frames before they are needed.
+// ------------------------------------------------------------------------
+inline void benchmarkShaderPermutations(unsigned int requests)
+{
+	const char *names[2] = { "texture", "packedTexture" };
+	std::vector<ShaderDefines> used(2);
+	used[1]["SINGLE_TEXTURE"] = "1";
+
+	BenchmarkTimer timer;
+	ShaderPermutations lazy;
+	lazy.declare("texture", "basicVertexShader.vs", "textureFragment.fs");
+	lazy.declare("packedTexture", "packedVertexShader.vs", "textureFragment.fs");
+	for (unsigned int i = 0; i < requests; i++)
+		lazy.get(names[i % 2], used[(i / 2) % 2]);
+	double lazyMs = timer.elapsedMs();
+
+	timer.restart();
+	ShaderPermutations ahead;
+	ahead.declare("texture", "basicVertexShader.vs", "textureFragment.fs");
+	ahead.declare("packedTexture", "packedVertexShader.vs", "textureFragment.fs");
+	ahead.precompile("texture", used);
+	ahead.precompile("packedTexture", used);
+	double precompileMs = timer.elapsedMs();
+	// stand-in for the frames that pass before the variants are first drawn
+	for (int frame = 0; frame < 10; frame++)
+	{
+		ahead.update();
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+	timer.restart();
+	for (unsigned int i = 0; i < requests; i++)
+		ahead.get(names[i % 2], used[(i / 2) % 2]);
+	double aheadMs = timer.elapsedMs();
+
+	printBenchmarkResult("SHADER_PERMUTATIONS::LAZY", lazyMs, "ms");
+	printBenchmarkResult("SHADER_PERMUTATIONS::PRECOMPILE_CALL", precompileMs, "ms");
+	printBenchmarkResult("SHADER_PERMUTATIONS::PRECOMPILED_REQUESTS", aheadMs, "ms");
+	lazy.printStats();
+	ahead.printStats();
+}
+#endif
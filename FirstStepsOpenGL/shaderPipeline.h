@@ -0,0 +1,217 @@
+#ifndef SHADER_PIPELINE_H
+#define SHADER_PIPELINE_H
+
+#include <glad/glad.h>
+
+#include <map>
+#include <string>
+#include <iostream>
+
+#include "shaderProgram.h"
+#include "shaderStageCache.h"
+#include "benchmark.h"
+
+// A vertex and fragment shader ready to draw with. With separate shader objects it is a
+// program pipeline over two stage programs, otherwise a regular linked program.
+struct ShaderPipeline
+{
+	unsigned int pipeline = 0;
+	Shader program;   // monolithic fallback only
+	Shader vertex;
+	Shader fragment;
+
+	// ------------------------------------------------------------------------
+	void bind() const
+	{
+		if (pipeline)
+		{
+			glUseProgram(0);
+			glBindProgramPipeline(pipeline);
+		}
+		else
+			glUseProgram(program.ID);
+	}
+	// bind and direct the Shader setters (glUniform*) at one stage, e.g.
+	// pipeline.use(GL_FRAGMENT_SHADER).setInt("texture1", 0);
+	// ------------------------------------------------------------------------
+	Shader &use(GLenum stage)
+	{
+		bind();
+		if (!pipeline)
+			return program;
+		Shader &target = stage == GL_VERTEX_SHADER ? vertex : fragment;
+		glActiveShaderProgram(pipeline, target.ID);
+		return target;
+	}
+};
+
+// Every vertex/fragment combination used to need its own linked program, so N vertex
+// and M fragment shaders meant N*M links. With GL_ARB_separate_shader_objects (core in
+// 4.1) each file is linked once as a separable stage program and combinations are made
+// at bind time with glUseProgramStages, N+M links in total. Without the extension
+// combinations are linked as before, sharing compiled stages through a ShaderStageCache.
+class ShaderPipelines
+{
+public:
+	// allowSeparable = false forces the monolithic path, used to compare the two
+	explicit ShaderPipelines(bool allowSeparable = true)
+	{
+		separable = allowSeparable && (GLAD_GL_ARB_separate_shader_objects || GLAD_GL_VERSION_4_1);
+	}
+	~ShaderPipelines()
+	{
+		for (auto &item : pipelines)
+		{
+			if (item.second.pipeline)
+				glDeleteProgramPipelines(1, &item.second.pipeline);
+			if (item.second.program.ID)
+				glDeleteProgram(item.second.program.ID);
+		}
+		for (auto &item : stagePrograms)
+			glDeleteProgram(item.second.ID);
+	}
+	ShaderPipelines(const ShaderPipelines&) = delete;
+	ShaderPipelines &operator=(const ShaderPipelines&) = delete;
+
+	// ------------------------------------------------------------------------
+	ShaderPipeline &get(const std::string &vertexPath, const std::string &fragmentPath)
+	{
+		return combine(vertexPath, source(vertexPath), fragmentPath, source(fragmentPath));
+	}
+	// same as get() for sources that do not come straight from a file, the keys name them
+	// ------------------------------------------------------------------------
+	ShaderPipeline &combine(const std::string &vertexKey, const std::string &vertexSource,
+	                        const std::string &fragmentKey, const std::string &fragmentSource)
+	{
+		std::string key = vertexKey + "|" + fragmentKey;
+		std::map<std::string, ShaderPipeline>::iterator found = pipelines.find(key);
+		if (found != pipelines.end())
+			return found->second;
+
+		ShaderPipeline &result = pipelines[key];
+		if (separable)
+		{
+			result.vertex = stageProgram(GL_VERTEX_SHADER, vertexKey, vertexSource);
+			result.fragment = stageProgram(GL_FRAGMENT_SHADER, fragmentKey, fragmentSource);
+			glGenProgramPipelines(1, &result.pipeline);
+			glUseProgramStages(result.pipeline, GL_VERTEX_SHADER_BIT, result.vertex.ID);
+			glUseProgramStages(result.pipeline, GL_FRAGMENT_SHADER_BIT, result.fragment.ID);
+		}
+		else
+		{
+			unsigned int vertex = stageCache.acquire(GL_VERTEX_SHADER, vertexSource);
+			unsigned int fragment = stageCache.acquire(GL_FRAGMENT_SHADER, fragmentSource);
+			result.program.ID = glCreateProgram();
+			glAttachShader(result.program.ID, vertex);
+			glAttachShader(result.program.ID, fragment);
+			glLinkProgram(result.program.ID);
+			links++;
+			if (!Shader::checkCompileErrors(result.program.ID, "PROGRAM"))
+			{
+				Shader::checkCompileErrors(vertex, "VERTEX");
+				Shader::checkCompileErrors(fragment, "FRAGMENT");
+			}
+			result.program.bindUniformBlocks();
+			stageCache.release(vertex);
+			stageCache.release(fragment);
+			result.vertex = result.program;
+			result.fragment = result.program;
+		}
+		return result;
+	}
+	// ------------------------------------------------------------------------
+	bool usesSeparablePrograms() const
+	{
+		return separable;
+	}
+	unsigned int linkCount() const
+	{
+		return links;
+	}
+	unsigned int pipelineCount() const
+	{
+		return (unsigned int)pipelines.size();
+	}
+
+private:
+	std::map<std::string, ShaderPipeline> pipelines;
+	std::map<std::string, Shader> stagePrograms;
+	std::map<std::string, std::string> sources;
+	ShaderStageCache stageCache;
+	bool separable;
+	unsigned int links = 0;
+
+	// ------------------------------------------------------------------------
+	const std::string &source(const std::string &path)
+	{
+		std::map<std::string, std::string>::iterator found = sources.find(path);
+		if (found == sources.end())
+			found = sources.insert(std::make_pair(path, readShaderFile(path))).first;
+		return found->second;
+	}
+	// one separable program per stage file, linked the first time any pipeline needs it
+	// ------------------------------------------------------------------------
+	Shader stageProgram(GLenum type, const std::string &key, const std::string &code)
+	{
+		std::string stageKey = (type == GL_VERTEX_SHADER ? "vs:" : "fs:") + key;
+		std::map<std::string, Shader>::iterator found = stagePrograms.find(stageKey);
+		if (found != stagePrograms.end())
+			return found->second;
+
+		// a separable vertex stage has to redeclare the built-in outputs it writes, which
+		// #version 330 only allows with the extension; enable is just a warning where the
+		// compiler lacks it (a 4.1 context), so the redeclaration is kept to compilers that have it
+		std::string header = "#extension GL_ARB_separate_shader_objects : enable\n";
+		if (type == GL_VERTEX_SHADER)
+			header += "#ifdef GL_ARB_separate_shader_objects\nout gl_PerVertex { vec4 gl_Position; };\n#endif\n";
+		std::string separableCode = insertAfterVersion(code, header);
+		const char *text = separableCode.c_str();
+		Shader program(glCreateShaderProgramv(type, 1, &text));
+		links++;
+		// the program info log of glCreateShaderProgramv includes the compile log
+		if (!Shader::checkCompileErrors(program.ID, "PROGRAM"))
+			std::cout << "ERROR::SHADER_PIPELINE::STAGE " << key << std::endl;
+		program.bindUniformBlocks();
+		stagePrograms[stageKey] = program;
+		return program;
+	}
+};
+
+// Links an N x M matrix of vertex and fragment variants monolithically and through
+// separable pipelines. The variants are the project's vertex and fragment shaders with
+// a distinct #define injected, so the driver cannot hand back a cached program.
+// ------------------------------------------------------------------------
+inline void benchmarkShaderPipelines(unsigned int vertexVariants, unsigned int fragmentVariants)
+{
+	std::string vertexSources[2] = { readShaderFile("basicVertexShader.vs"), readShaderFile("packedVertexShader.vs") };
+	std::string fragmentSources[2] = { readShaderFile("textureFragment.fs"), readShaderFile("orangeFragmentShader.fs") };
+	for (int separable = 0; separable < 2; separable++)
+	{
+		BenchmarkTimer timer;
+		ShaderPipelines pipelines(separable != 0);
+		if (separable && !pipelines.usesSeparablePrograms())
+		{
+			std::cout << "ERROR::SHADER_PIPELINE::SEPARATE_SHADER_OBJECTS_NOT_SUPPORTED" << std::endl;
+			break;
+		}
+		for (unsigned int v = 0; v < vertexVariants; v++)
+		{
+			std::string vertexKey = "vs" + std::to_string(v);
+			std::string vertexSource = insertAfterVersion(vertexSources[v % 2], "#define VARIANT " + std::to_string(v) + "\n");
+			for (unsigned int f = 0; f < fragmentVariants; f++)
+			{
+				std::string fragmentKey = "fs" + std::to_string(f);
+				std::string fragmentSource = insertAfterVersion(fragmentSources[f % 2], "#define VARIANT " + std::to_string(f) + "\n");
+				pipelines.combine(vertexKey, vertexSource, fragmentKey, fragmentSource).bind();
+			}
+		}
+		glFinish();
+		double ms = timer.elapsedMs();
+		printBenchmarkResult(separable ? "SHADER_PIPELINE::SEPARABLE_LINKS" : "SHADER_PIPELINE::MONOLITHIC_LINKS", (double)pipelines.linkCount(), "programs");
+		printBenchmarkResult(separable ? "SHADER_PIPELINE::SEPARABLE_STARTUP" : "SHADER_PIPELINE::MONOLITHIC_STARTUP", ms, "ms");
+	}
+	glUseProgram(0);
+	if (GLAD_GL_ARB_separate_shader_objects || GLAD_GL_VERSION_4_1)
+		glBindProgramPipeline(0);
+}
+#endif
@@ -0,0 +1,157 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+// #define NAME VALUE pairs injected into a shader, ordered so equal sets give equal keys
+typedef std::map<std::string, std::string> ShaderDefines;
+
+// ------------------------------------------------------------------------
+inline bool readTextFile(const std::string &path, std::string &text)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+		return false;
+	std::stringstream stream;
+	stream << file.rdbuf();
+	text = stream.str();
+	return true;
+}
+
+// "path|NAME=VALUE|..." identifies one permutation of a shader file
+// ------------------------------------------------------------------------
+inline std::string permutationKey(const std::string &path, const ShaderDefines &defines)
+{
+	std::string key = path;
+	for (auto &define : defines)
+		key += "|" + define.first + "=" + define.second;
+	return key;
+}
+
+// insert lines right after the #version directive, a #line keeps compiler messages
+// pointing at the line numbers of the original file
+// ------------------------------------------------------------------------
+inline std::string insertAfterVersion(const std::string &source, const std::string &lines)
+{
+	size_t version = source.find("#version");
+	if (version == std::string::npos)
+		return lines + source;
+	size_t end = source.find('\n', version);
+	if (end == std::string::npos)
+		return source + "\n" + lines;
+	int lineNumber = 2;
+	for (size_t i = 0; i < end; i++)
+	{
+		if (source[i] == '\n')
+			lineNumber++;
+	}
+	return source.substr(0, end + 1) + lines + "#line " + std::to_string(lineNumber) + "\n" + source.substr(end + 1);
+}
+
+// GLSL has no #include, this resolves it before the source reaches the driver.
+// #include "file" is relative to the including file and every file is included at most
+// once per stage, so shared uniform blocks can be pulled in from several headers.
+// Included text is wrapped in "#line <line> <file>" directives; the file number is the
+// index into `files`, which is how driver messages like "1(12)" map back to a path.
+class ShaderPreprocessor
+{
+public:
+	std::vector<std::string> files;
+
+	// ------------------------------------------------------------------------
+	std::string processFile(const std::string &path, const ShaderDefines &defines = ShaderDefines())
+	{
+		std::string source;
+		if (!readTextFile(path, source))
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+			return std::string();
+		}
+		return process(source, path, defines);
+	}
+	// source that was already read, path is used to resolve its includes
+	// ------------------------------------------------------------------------
+	std::string process(const std::string &source, const std::string &path, const ShaderDefines &defines = ShaderDefines())
+	{
+		files.clear();
+		files.push_back(path);
+		std::string output;
+		expand(source, 0, output);
+		if (defines.empty())
+			return output;
+		std::string lines;
+		for (auto &define : defines)
+			lines += "#define " + define.first + " " + define.second + "\n";
+		return insertAfterVersion(output, lines);
+	}
+
+private:
+	// ------------------------------------------------------------------------
+	void expand(const std::string &source, int file, std::string &output)
+	{
+		std::istringstream stream(source);
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(stream, line))
+		{
+			lineNumber++;
+			std::string include;
+			if (!parseInclude(line, include))
+			{
+				output += line + "\n";
+				continue;
+			}
+			std::string path = directoryOf(files[file]) + include;
+			bool seen = false;
+			for (const std::string &done : files)
+				seen = seen || done == path;
+			if (!seen)
+			{
+				std::string text;
+				if (readTextFile(path, text))
+				{
+					int included = (int)files.size();
+					files.push_back(path);
+					output += "#line 1 " + std::to_string(included) + "\n";
+					expand(text, included, output);
+				}
+				else
+					std::cout << "ERROR::SHADER_PREPROCESSOR::INCLUDE_NOT_FOUND " << path << " (" << files[file] << ":" << lineNumber << ")" << std::endl;
+			}
+			// the include line itself is replaced, the next line keeps its number
+			output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(file) + "\n";
+		}
+	}
+	// ------------------------------------------------------------------------
+	static bool parseInclude(const std::string &line, std::string &include)
+	{
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+			return false;
+		size_t open = line.find('"', start + 8);
+		size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+		if (close == std::string::npos)
+			return false;
+		include = line.substr(open + 1, close - open - 1);
+		return true;
+	}
+	// ------------------------------------------------------------------------
+	static std::string directoryOf(const std::string &path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+	}
+};
+
+// ------------------------------------------------------------------------
+inline std::string preprocessShaderFile(const std::string &path, const ShaderDefines &defines = ShaderDefines())
+{
+	ShaderPreprocessor preprocessor;
+	return preprocessor.processFile(path, defines);
+}
+#endif
@@ -4,16 +4,37 @@
 #define SHADER_H
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "uniformBlocks.h"
+#include "shaderPreprocessor.h"
+#include "uniformShadow.h"
+#include "benchmark.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <memory>
 #include <iostream>
+#include <sys/stat.h>
+
+// read a shader source file with its #includes resolved, returns an empty string
+// (and reports it) on failure
+// ------------------------------------------------------------------------
+inline std::string readShaderFile(const std::string &path)
+{
+	return preprocessShaderFile(path);
+}
 
 class Shader
 {
 public:
 	unsigned int ID;
+	// wrap a program that was compiled and linked elsewhere (e.g. by ShaderBuilder)
+	// ------------------------------------------------------------------------
+	explicit Shader(unsigned int programID = 0) : ID(programID)
+	{
+	}
 	// constructor generates the shader on the fly
 	// ------------------------------------------------------------------------
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
@@ -29,6 +50,7 @@ public:
 		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 		gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		ShaderPreprocessor preprocessor;
 		try
 		{
 			// open files
@@ -41,9 +63,9 @@ public:
 			// close file handlers
 			vShaderFile.close();
 			fShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
+			// convert stream into string, resolving #includes
+			vertexCode = preprocessor.process(vShaderStream.str(), vertexPath);
+			fragmentCode = preprocessor.process(fShaderStream.str(), fragmentPath);
 
 			if (geometryPath != nullptr)
 			{
@@ -51,7 +73,7 @@ public:
 				std::stringstream gShaderStream;
 				gShaderStream << gShaderFile.rdbuf();
 				gShaderFile.close();
-				geometryCode = gShaderStream.str();
+				geometryCode = preprocessor.process(gShaderStream.str(), geometryPath);
 			}
 		}
 		catch (std::ifstream::failure e)
@@ -91,81 +113,226 @@ public:
 			glAttachShader(ID, geometry);
 		glLinkProgram(ID);
 		checkCompileErrors(ID, "PROGRAM");
+		bindUniformBlocks();
 		// delete the shaders as they're linked into our program now and no longer necessary
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
 	}
+	// Build a program preferring the SPIR-V modules tools/compileSpirv.py writes next to
+	// each source as <file>.spv. Stages without an up to date module, or every stage when
+	// GL_ARB_gl_spirv is missing, are compiled from source as before. SPIR-V programs have
+	// no uniform names to look up, their blocks and samplers use layout (binding) instead.
+	// ------------------------------------------------------------------------
+	static Shader load(const char *vertexPath, const char *fragmentPath, const char *geometryPath = nullptr, bool preferSpirv = true)
+	{
+		const char *paths[3] = { vertexPath, fragmentPath, geometryPath };
+		const GLenum types[3] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+		unsigned int stages[3] = { 0, 0, 0 };
+		int spirvStages = 0, stageCount = 0;
+		for (int stage = 0; stage < 3; stage++)
+		{
+			if (paths[stage] == nullptr)
+				continue;
+			bool fromSpirv;
+			stages[stage] = loadStage(types[stage], paths[stage], preferSpirv, &fromSpirv);
+			spirvStages += fromSpirv ? 1 : 0;
+			stageCount++;
+		}
+		// SPIR-V and GLSL stages cannot be linked together
+		if (spirvStages != 0 && spirvStages != stageCount)
+		{
+			for (unsigned int &stage : stages)
+			{
+				if (stage)
+					glDeleteShader(stage);
+				stage = 0;
+			}
+			return load(vertexPath, fragmentPath, geometryPath, false);
+		}
+		Shader shader(glCreateProgram());
+		for (unsigned int stage : stages)
+		{
+			if (stage)
+				glAttachShader(shader.ID, stage);
+		}
+		glLinkProgram(shader.ID);
+		checkCompileErrors(shader.ID, "PROGRAM");
+		shader.bindUniformBlocks();
+		for (unsigned int stage : stages)
+		{
+			if (stage)
+				glDeleteShader(stage);
+		}
+		return shader;
+	}
+	// one compiled stage, from <path>.spv when allowed and possible, else from source
+	// ------------------------------------------------------------------------
+	static unsigned int loadStage(GLenum type, const std::string &path, bool preferSpirv, bool *fromSpirv = nullptr)
+	{
+		const char *stageName = type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_FRAGMENT_SHADER ? "FRAGMENT" : "GEOMETRY";
+		if (fromSpirv)
+			*fromSpirv = false;
+		std::string binary;
+		if (preferSpirv && (GLAD_GL_ARB_gl_spirv || GLAD_GL_VERSION_4_6) && readSpirv(path, binary))
+		{
+			unsigned int shader = glCreateShader(type);
+			glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V_ARB, binary.data(), (GLsizei)binary.size());
+			if (GLAD_GL_VERSION_4_6)
+				glSpecializeShader(shader, "main", 0, nullptr, nullptr);
+			else
+				glSpecializeShaderARB(shader, "main", 0, nullptr, nullptr);
+			if (checkCompileErrors(shader, stageName))
+			{
+				if (fromSpirv)
+					*fromSpirv = true;
+				return shader;
+			}
+			std::cout << "ERROR::SHADER::SPIRV_REJECTED " << path << ".spv, compiling the source instead" << std::endl;
+			glDeleteShader(shader);
+		}
+		std::string source = readShaderFile(path);
+		const char *code = source.c_str();
+		unsigned int shader = glCreateShader(type);
+		glShaderSource(shader, 1, &code, NULL);
+		glCompileShader(shader);
+		checkCompileErrors(shader, stageName);
+		return shader;
+	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
 	{
 		glUseProgram(ID);
 	}
+	// connect a uniform block of the program to a buffer binding point
+	// ------------------------------------------------------------------------
+	void bindUniformBlock(const std::string &name, unsigned int binding) const
+	{
+		unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, index, binding);
+	}
+	// connect the shared blocks from uniformBlocks.h, blocks a program does not use are skipped
+	// ------------------------------------------------------------------------
+	void bindUniformBlocks() const
+	{
+		bindUniformBlock("Camera", CAMERA_BLOCK_BINDING);
+		bindUniformBlock("Object", OBJECT_BLOCK_BINDING);
+	}
+	// keep a CPU copy of the program's loose uniforms (uniformShadow.h): the setters below
+	// only record changed values and flush() uploads them, so call it before each draw.
+	// Copies of this Shader share the copy; false goes back to immediate uploads
+	// ------------------------------------------------------------------------
+	void shadowUniforms(bool enable = true)
+	{
+		if (enable)
+			uniforms = std::make_shared<UniformShadow>(ID);
+		else
+			uniforms.reset();
+	}
+	// nullptr while the setters upload immediately
+	const UniformShadow *uniformShadow() const
+	{
+		return uniforms.get();
+	}
+	// upload the shadowed values that changed, the shader must be in use
+	// ------------------------------------------------------------------------
+	void flush() const
+	{
+		if (uniforms)
+			uniforms->flush();
+	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
 	void setBool(const std::string &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		if (uniforms)
+			uniforms->setBool(name, value);
+		else
+			glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
 	}
 	// ------------------------------------------------------------------------
 	void setInt(const std::string &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		if (uniforms)
+			uniforms->setInt(name, value);
+		else
+			glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
 	}
 	// ------------------------------------------------------------------------
 	void setFloat(const std::string &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		if (uniforms)
+			uniforms->setFloat(name, value);
+		else
+			glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
 	}
 	// ------------------------------------------------------------------------
 	void setVec2(const std::string &name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (uniforms)
+			uniforms->setVec2(name, value);
+		else
+			glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 	}
 	void setVec2(const std::string &name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		setVec2(name, glm::vec2(x, y));
 	}
 	// ------------------------------------------------------------------------
 	void setVec3(const std::string &name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (uniforms)
+			uniforms->setVec3(name, value);
+		else
+			glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 	}
 	void setVec3(const std::string &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		setVec3(name, glm::vec3(x, y, z));
 	}
 	// ------------------------------------------------------------------------
 	void setVec4(const std::string &name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		if (uniforms)
+			uniforms->setVec4(name, value);
+		else
+			glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 	}
 	void setVec4(const std::string &name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		setVec4(name, glm::vec4(x, y, z, w));
 	}
 	// ------------------------------------------------------------------------
 	void setMat2(const std::string &name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (uniforms)
+			uniforms->setMat2(name, mat);
+		else
+			glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat3(const std::string &name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (uniforms)
+			uniforms->setMat3(name, mat);
+		else
+			glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat4(const std::string &name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		if (uniforms)
+			uniforms->setMat4(name, mat);
+		else
+			glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
 	}
 
-private:
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
-	void checkCompileErrors(unsigned int shader, std::string type)
+	static bool checkCompileErrors(unsigned int shader, std::string type)
 	{
 		int success;
 		char infoLog[1024];
@@ -187,7 +354,150 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success != 0;
+	}
+
+private:
+	std::shared_ptr<UniformShadow> uniforms;
+
+	// the module is skipped when it is older than its source or any file the source
+	// #includes, i.e. the build step was not rerun
+	// ------------------------------------------------------------------------
+	static bool readSpirv(const std::string &path, std::string &binary)
+	{
+		std::string spirvPath = path + ".spv";
+		struct stat source, module;
+		if (stat(spirvPath.c_str(), &module) != 0)
+			return false;
+		ShaderPreprocessor preprocessor;
+		std::string text;
+		if (readTextFile(path, text))
+			preprocessor.process(text, path);
+		for (const std::string &file : preprocessor.files)
+		{
+			if (stat(file.c_str(), &source) == 0 && source.st_mtime > module.st_mtime)
+			{
+				std::cout << "ERROR::SHADER::SPIRV_OUT_OF_DATE " << spirvPath << " (" << file << ")" << std::endl;
+				return false;
+			}
+		}
+		std::ifstream file(spirvPath.c_str(), std::ios::binary);
+		std::stringstream stream;
+		stream << file.rdbuf();
+		binary = stream.str();
+		// a SPIR-V module is a stream of 32 bit words starting with the magic number
+		return binary.size() >= 20 && binary.size() % 4 == 0 && *(const unsigned int*)binary.data() == 0x07230203;
 	}
 };
-#endif
 
+// Compile and link time of the project's programs from GLSL source and from the offline
+// SPIR-V modules. Each stage status is queried so the time lands in the phase that did it.
+// ------------------------------------------------------------------------
+inline void benchmarkSpirvLoading()
+{
+	const char *programs[4][2] = {
+		{ "basicVertexShader.vs", "textureFragment.fs" },
+		{ "packedVertexShader.vs", "textureFragment.fs" },
+		{ "vertexShader.vs", "fragmentShader.fs" },
+		{ "vertexShader.vs", "orangeFragmentShader.fs" }
+	};
+	std::cout << "SHADER::SPIRV on " << (const char*)glGetString(GL_RENDERER) << " " << (const char*)glGetString(GL_VERSION) << std::endl;
+	if (!GLAD_GL_ARB_gl_spirv && !GLAD_GL_VERSION_4_6)
+		std::cout << "ERROR::SHADER::GL_ARB_gl_spirv not supported, both runs compile source" << std::endl;
+	for (int spirv = 0; spirv < 2; spirv++)
+	{
+		double compileMs = 0.0, linkMs = 0.0;
+		int spirvStages = 0;
+		for (auto &paths : programs)
+		{
+			BenchmarkTimer timer;
+			unsigned int stages[2];
+			for (int stage = 0; stage < 2; stage++)
+			{
+				bool fromSpirv;
+				stages[stage] = Shader::loadStage(stage == 0 ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER, paths[stage], spirv != 0, &fromSpirv);
+				spirvStages += fromSpirv ? 1 : 0;
+			}
+			compileMs += timer.elapsedMs();
+
+			timer.restart();
+			unsigned int program = glCreateProgram();
+			glAttachShader(program, stages[0]);
+			glAttachShader(program, stages[1]);
+			glLinkProgram(program);
+			Shader::checkCompileErrors(program, "PROGRAM");
+			linkMs += timer.elapsedMs();
+
+			glDeleteShader(stages[0]);
+			glDeleteShader(stages[1]);
+			glDeleteProgram(program);
+		}
+		printBenchmarkResult(spirv ? "SHADER::SPIRV_COMPILE" : "SHADER::GLSL_COMPILE", compileMs, "ms");
+		printBenchmarkResult(spirv ? "SHADER::SPIRV_LINK" : "SHADER::GLSL_LINK", linkMs, "ms");
+		if (spirv)
+			printBenchmarkResult("SHADER::SPIRV_STAGES_LOADED", (double)spirvStages, "of 8");
+	}
+}
+
+// 10k draws a frame with the packed shader, where meshes share a handful of bounding
+// boxes and the samplers never change: immediate Shader setters against the same setters
+// on a shadowed Shader flushed before each draw. Rasterization is off, only the CPU side
+// is measured.
+// ------------------------------------------------------------------------
+inline void benchmarkUniformShadow(unsigned int drawsPerFrame, unsigned int frames)
+{
+	Shader shader("packedVertexShader.vs", "textureFragment.fs");
+	unsigned int vao;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glEnable(GL_RASTERIZER_DISCARD);
+	shader.use();
+
+	// draws are sorted by mesh, so consecutive draws usually share bounds
+	glm::vec3 meshBounds[4] = { glm::vec3(-1.0f), glm::vec3(-0.5f), glm::vec3(0.0f), glm::vec3(-2.0f) };
+	BenchmarkTimer timer;
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		for (unsigned int d = 0; d < drawsPerFrame; d++)
+		{
+			const glm::vec3 &bounds = meshBounds[d * 4 / drawsPerFrame];
+			shader.setVec3("boundsMin", bounds);
+			shader.setVec3("boundsExtent", -2.0f * bounds);
+			shader.setInt("texture1", 0);
+			shader.setInt("texture2", 1);
+			glDrawArrays(GL_POINTS, 0, 1);
+		}
+	}
+	glFinish();
+	double immediateMs = timer.elapsedMs();
+
+	// the shadow starts from the values the immediate run left in the program
+	Shader shadowed(shader.ID);
+	shadowed.shadowUniforms();
+	timer.restart();
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		for (unsigned int d = 0; d < drawsPerFrame; d++)
+		{
+			const glm::vec3 &bounds = meshBounds[d * 4 / drawsPerFrame];
+			shadowed.setVec3("boundsMin", bounds);
+			shadowed.setVec3("boundsExtent", -2.0f * bounds);
+			shadowed.setInt("texture1", 0);
+			shadowed.setInt("texture2", 1);
+			shadowed.flush();
+			glDrawArrays(GL_POINTS, 0, 1);
+		}
+	}
+	glFinish();
+	double shadowMs = timer.elapsedMs();
+
+	printBenchmarkResult("UNIFORM_SHADOW::IMMEDIATE", immediateMs / frames, "ms/frame");
+	printBenchmarkResult("UNIFORM_SHADOW::SHADOWED", shadowMs / frames, "ms/frame");
+	const UniformShadow &uniforms = *shadowed.uniformShadow();
+	printBenchmarkResult("UNIFORM_SHADOW::UPLOADS_AVOIDED", (double)uniforms.avoidedCount(), "of " + std::to_string(uniforms.setCount()));
+	printBenchmarkResult("UNIFORM_SHADOW::UPLOADS", (double)uniforms.uploadCount(), "glUniform calls");
+	glDisable(GL_RASTERIZER_DISCARD);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteProgram(shader.ID);
+}
+#endif
@@ -0,0 +1,120 @@
+#ifndef SHADER_STAGE_CACHE_H
+#define SHADER_STAGE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <iostream>
+
+// Compiled shader objects shared between programs. A stage is keyed by its type and a
+// hash of its (preprocessed) source, so a vertex shader used by ten programs is compiled
+// once and attached ten times. Every acquire() adds a dependent; the shader object is
+// deleted when the last dependent program has linked and called release().
+class ShaderStageCache
+{
+public:
+	// a disabled cache compiles every request, used to measure what the cache saves
+	explicit ShaderStageCache(bool enabled = true) : enabled(enabled)
+	{
+	}
+	// ------------------------------------------------------------------------
+	unsigned int acquire(GLenum type, const std::string &source)
+	{
+		requests++;
+		Key key(type, hashSource(source));
+		if (enabled)
+		{
+			std::map<Key, Stage>::iterator found = stages.find(key);
+			// the source is compared too, a hash collision must never attach the wrong code
+			if (found != stages.end() && found->second.source == source)
+			{
+				found->second.dependents++;
+				hits++;
+				return found->second.shader;
+			}
+		}
+		const char *code = source.c_str();
+		unsigned int shader = glCreateShader(type);
+		glShaderSource(shader, 1, &code, NULL);
+		glCompileShader(shader);
+		compiles++;
+
+		Stage stage = { shader, 1, source };
+		if (enabled && stages.find(key) == stages.end())
+		{
+			stages[key] = stage;
+			owners[shader] = key;
+		}
+		else
+			uncached.insert(shader);
+		return shader;
+	}
+	// a dependent program has linked and no longer needs the stage object
+	// ------------------------------------------------------------------------
+	void release(unsigned int shader)
+	{
+		if (uncached.erase(shader))
+		{
+			glDeleteShader(shader);
+			return;
+		}
+		std::map<unsigned int, Key>::iterator owner = owners.find(shader);
+		if (owner == owners.end())
+			return;
+		std::map<Key, Stage>::iterator stage = stages.find(owner->second);
+		if (--stage->second.dependents == 0)
+		{
+			glDeleteShader(shader);
+			stages.erase(stage);
+			owners.erase(owner);
+		}
+	}
+	// ------------------------------------------------------------------------
+	unsigned int compileCount() const
+	{
+		return compiles;
+	}
+	unsigned int requestCount() const
+	{
+		return requests;
+	}
+	unsigned int hitCount() const
+	{
+		return hits;
+	}
+	// stage objects still waiting for dependents to link
+	unsigned int liveStages() const
+	{
+		return (unsigned int)(stages.size() + uncached.size());
+	}
+
+private:
+	typedef std::pair<GLenum, unsigned long long> Key;
+	struct Stage
+	{
+		unsigned int shader;
+		int dependents;
+		std::string source;
+	};
+	std::map<Key, Stage> stages;
+	std::map<unsigned int, Key> owners;
+	std::set<unsigned int> uncached;
+	bool enabled;
+	unsigned int compiles = 0;
+	unsigned int requests = 0;
+	unsigned int hits = 0;
+
+	// 64 bit FNV-1a
+	// ------------------------------------------------------------------------
+	static unsigned long long hashSource(const std::string &source)
+	{
+		unsigned long long hash = 14695981039346656037ULL;
+		for (unsigned char c : source)
+			hash = (hash ^ c) * 1099511628211ULL;
+		return hash;
+	}
+};
+#endif
@@ -354,6 +354,14 @@ extern "C" {
 	STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc           const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels);
 	STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *channels_in_file, int desired_channels);
 
+	// progressive JPEGs: progress is called after every scan with a preview of the image so
+	// far, in desired_channels (or the file's channels) and flipped like the final image. Until
+	// the first AC scan the preview is 1/8 scale, built from the DC coefficients alone, after
+	// that it is full size. The pixels are only valid during the call; return 0 from progress
+	// to stop further previews. Other files load exactly as with stbi_load_from_memory.
+	typedef int stbi_progress_callback(void *user, stbi_uc *pixels, int x, int y, int channels, int scan);
+	STBIDEF stbi_uc *stbi_load_from_memory_progressive(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, stbi_progress_callback *progress, void *user);
+
 #ifndef STBI_NO_STDIO
 	STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
 	STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
@@ -1699,6 +1707,13 @@ typedef struct
 	int scan_n, order[4];
 	int restart_interval, todo;
 
+	// progressive previews, see stbi_load_from_memory_progressive
+	stbi_progress_callback *progress;
+	void          *progress_user;
+	int            progress_req_comp;
+	int            progress_scan;
+	int            progress_ac;    // an AC scan has been decoded
+
 	// kernels
 	void(*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
 	void(*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -3084,6 +3099,8 @@ static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
 	return 1;
 }
 
+static void stbi__jpeg_preview(stbi__jpeg *z);
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
@@ -3099,6 +3116,10 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
 		if (stbi__SOS(m)) {
 			if (!stbi__process_scan_header(j)) return 0;
 			if (!stbi__parse_entropy_coded_data(j)) return 0;
+			if (j->progressive && j->progress) {
+				if (j->spec_start > 0) j->progress_ac = 1;
+				stbi__jpeg_preview(j);
+			}
 			if (j->marker == STBI__MARKER_none) {
 				// handle 0s at the end of image data from IP Kamera 9060
 				while (!stbi__at_eof(j->s)) {
@@ -3501,6 +3522,7 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+	j->progress = NULL;
 	j->idct_block_kernel = stbi__idct_block;
 	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
 	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3543,172 +3565,266 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
 	return (stbi_uc)((t + (t >> 8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// output channels n for req_comp, and which components are needed to produce them
+static void stbi__jpeg_layout(stbi__jpeg *z, int req_comp, int *n, int *decode_n, int *is_rgb)
 {
-	int n, decode_n, is_rgb;
-	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-					 // validate req_comp
-	if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+	*n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-	// load a jpeg image from whichever source, but leave in YCbCr format
-	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+	*is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
 
-	// determine actual number of components to generate
-	n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+	if (z->s->img_n == 3 && *n < 3 && !*is_rgb)
+		*decode_n = 1;
+	else
+		*decode_n = z->s->img_n;
+}
 
-	is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+// resample and color-convert the decoded components into a new image of n channels;
+// the line buffers are released again, the components are kept
+static stbi_uc *stbi__jpeg_convert(stbi__jpeg *z, int n, int decode_n, int is_rgb)
+{
+	int k;
+	unsigned int i, j;
+	stbi_uc *output;
+	stbi_uc *coutput[4];
 
-	if (z->s->img_n == 3 && n < 3 && !is_rgb)
-		decode_n = 1;
-	else
-		decode_n = z->s->img_n;
+	stbi__resample res_comp[4];
 
-	// resample and color-convert
-	{
-		int k;
-		unsigned int i, j;
-		stbi_uc *output;
-		stbi_uc *coutput[4];
+	for (k = 0; k < decode_n; ++k) {
+		stbi__resample *r = &res_comp[k];
 
-		stbi__resample res_comp[4];
+		// allocate line buffer big enough for upsampling off the edges
+		// with upsample factor of 4
+		z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
+		if (!z->img_comp[k].linebuf) return stbi__errpuc("outofmem", "Out of memory");
 
-		for (k = 0; k < decode_n; ++k) {
-			stbi__resample *r = &res_comp[k];
+		r->hs = z->img_h_max / z->img_comp[k].h;
+		r->vs = z->img_v_max / z->img_comp[k].v;
+		r->ystep = r->vs >> 1;
+		r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
+		r->ypos = 0;
+		r->line0 = r->line1 = z->img_comp[k].data;
 
-			// allocate line buffer big enough for upsampling off the edges
-			// with upsample factor of 4
-			z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
-			if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-			r->hs = z->img_h_max / z->img_comp[k].h;
-			r->vs = z->img_v_max / z->img_comp[k].v;
-			r->ystep = r->vs >> 1;
-			r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
-			r->ypos = 0;
-			r->line0 = r->line1 = z->img_comp[k].data;
-
-			if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-			else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-			else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-			else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-			else                               r->resample = stbi__resample_row_generic;
-		}
+		if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+		else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+		else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+		else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+		else                               r->resample = stbi__resample_row_generic;
+	}
 
-		// can't error after this so, this is safe
-		output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-		if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+	output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+	if (!output) return stbi__errpuc("outofmem", "Out of memory");
 
-		// now go ahead and resample
-		for (j = 0; j < z->s->img_y; ++j) {
-			stbi_uc *out = output + n * z->s->img_x * j;
-			for (k = 0; k < decode_n; ++k) {
-				stbi__resample *r = &res_comp[k];
-				int y_bot = r->ystep >= (r->vs >> 1);
-				coutput[k] = r->resample(z->img_comp[k].linebuf,
-					y_bot ? r->line1 : r->line0,
-					y_bot ? r->line0 : r->line1,
-					r->w_lores, r->hs);
-				if (++r->ystep >= r->vs) {
-					r->ystep = 0;
-					r->line0 = r->line1;
-					if (++r->ypos < z->img_comp[k].y)
-						r->line1 += z->img_comp[k].w2;
-				}
+	// now go ahead and resample
+	for (j = 0; j < z->s->img_y; ++j) {
+		stbi_uc *out = output + n * z->s->img_x * j;
+		for (k = 0; k < decode_n; ++k) {
+			stbi__resample *r = &res_comp[k];
+			int y_bot = r->ystep >= (r->vs >> 1);
+			coutput[k] = r->resample(z->img_comp[k].linebuf,
+				y_bot ? r->line1 : r->line0,
+				y_bot ? r->line0 : r->line1,
+				r->w_lores, r->hs);
+			if (++r->ystep >= r->vs) {
+				r->ystep = 0;
+				r->line0 = r->line1;
+				if (++r->ypos < z->img_comp[k].y)
+					r->line1 += z->img_comp[k].w2;
 			}
-			if (n >= 3) {
-				stbi_uc *y = coutput[0];
-				if (z->s->img_n == 3) {
-					if (is_rgb) {
-						for (i = 0; i < z->s->img_x; ++i) {
-							out[0] = y[i];
-							out[1] = coutput[1][i];
-							out[2] = coutput[2][i];
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else {
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+		}
+		if (n >= 3) {
+			stbi_uc *y = coutput[0];
+			if (z->s->img_n == 3) {
+				if (is_rgb) {
+					for (i = 0; i < z->s->img_x; ++i) {
+						out[0] = y[i];
+						out[1] = coutput[1][i];
+						out[2] = coutput[2][i];
+						out[3] = 255;
+						out += n;
 					}
 				}
-				else if (z->s->img_n == 4) {
-					if (z->app14_color_transform == 0) { // CMYK
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(coutput[0][i], m);
-							out[1] = stbi__blinn_8x8(coutput[1][i], m);
-							out[2] = stbi__blinn_8x8(coutput[2][i], m);
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else if (z->app14_color_transform == 2) { // YCCK
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-						for (i = 0; i < z->s->img_x; ++i) {
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(255 - out[0], m);
-							out[1] = stbi__blinn_8x8(255 - out[1], m);
-							out[2] = stbi__blinn_8x8(255 - out[2], m);
-							out += n;
-						}
-					}
-					else { // YCbCr + alpha?  Ignore the fourth channel for now
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
+				else {
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
 				}
-				else
+			}
+			else if (z->s->img_n == 4) {
+				if (z->app14_color_transform == 0) { // CMYK
 					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = out[1] = out[2] = y[i];
-						out[3] = 255; // not used if n==3
+						stbi_uc m = coutput[3][i];
+						out[0] = stbi__blinn_8x8(coutput[0][i], m);
+						out[1] = stbi__blinn_8x8(coutput[1][i], m);
+						out[2] = stbi__blinn_8x8(coutput[2][i], m);
+						out[3] = 255;
 						out += n;
 					}
-			}
-			else {
-				if (is_rgb) {
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i)
-							*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-					else {
-						for (i = 0; i < z->s->img_x; ++i, out += 2) {
-							out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-							out[1] = 255;
-						}
-					}
 				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+				else if (z->app14_color_transform == 2) { // YCCK
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
 					for (i = 0; i < z->s->img_x; ++i) {
 						stbi_uc m = coutput[3][i];
-						stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-						stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-						stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-						out[0] = stbi__compute_y(r, g, b);
-						out[1] = 255;
+						out[0] = stbi__blinn_8x8(255 - out[0], m);
+						out[1] = stbi__blinn_8x8(255 - out[1], m);
+						out[2] = stbi__blinn_8x8(255 - out[2], m);
 						out += n;
 					}
 				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-					for (i = 0; i < z->s->img_x; ++i) {
-						out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+				else { // YCbCr + alpha?  Ignore the fourth channel for now
+					z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+				}
+			}
+			else
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = out[1] = out[2] = y[i];
+					out[3] = 255; // not used if n==3
+					out += n;
+				}
+		}
+		else {
+			if (is_rgb) {
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i)
+						*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+				else {
+					for (i = 0; i < z->s->img_x; ++i, out += 2) {
+						out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
 						out[1] = 255;
-						out += n;
 					}
 				}
-				else {
-					stbi_uc *y = coutput[0];
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-					else
-						for (i = 0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					stbi_uc m = coutput[3][i];
+					stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+					stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+					stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+					out[0] = stbi__compute_y(r, g, b);
+					out[1] = 255;
+					out += n;
+				}
+			}
+			else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+				for (i = 0; i < z->s->img_x; ++i) {
+					out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+					out[1] = 255;
+					out += n;
 				}
 			}
+			else {
+				stbi_uc *y = coutput[0];
+				if (n == 1)
+					for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+				else
+					for (i = 0; i < z->s->img_x; ++i) *out++ = y[i], *out++ = 255;
+			}
 		}
-		stbi__cleanup_jpeg(z);
-		*out_x = z->s->img_x;
-		*out_y = z->s->img_y;
-		if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-		return output;
 	}
+	for (k = 0; k < decode_n; ++k) {
+		STBI_FREE(z->img_comp[k].linebuf);
+		z->img_comp[k].linebuf = NULL;
+	}
+	return output;
+}
+
+// preview after a progressive scan: the DC coefficients alone at 1/8 scale, then the
+// coefficients so far dequantized and transformed at full size
+static void stbi__jpeg_preview(stbi__jpeg *z)
+{
+	int n, decode_n, is_rgb, k;
+	int w, h, i, j;
+	stbi_uc *output = NULL;
+
+	// CMYK and YCCK are left to the final image
+	if (z->s->img_n == 4) return;
+	stbi__jpeg_layout(z, z->progress_req_comp, &n, &decode_n, &is_rgb);
+
+	if (!z->progress_ac) {
+		stbi_uc *rows;
+		w = (z->s->img_x + 7) >> 3;
+		h = (z->s->img_y + 7) >> 3;
+		output = (stbi_uc *)stbi__malloc_mad3(n, w, h, 1); // the color kernels write a 4th byte past the last pixel
+		rows = (stbi_uc *)stbi__malloc_mad2(w, 3, 0);
+		if (!output || !rows) { STBI_FREE(output); STBI_FREE(rows); z->progress = NULL; return; }
+		for (j = 0; j < h; ++j) {
+			stbi_uc *out = output + n * w * j;
+			// an 8x8 block with only DC set decodes to DC * q / 8 + 128 everywhere
+			for (k = 0; k < decode_n; ++k) {
+				int cy = j * z->img_comp[k].v / z->img_v_max;
+				for (i = 0; i < w; ++i) {
+					int cx = i * z->img_comp[k].h / z->img_h_max;
+					int dc = z->img_comp[k].coeff[64 * (cx + cy * z->img_comp[k].coeff_w)] * z->dequant[z->img_comp[k].tq][0];
+					rows[k * w + i] = stbi__clamp(((dc + 4) >> 3) + 128);
+				}
+			}
+			if (n >= 3) {
+				if (z->s->img_n == 3 && !is_rgb)
+					z->YCbCr_to_RGB_kernel(out, rows, rows + w, rows + 2 * w, w, n);
+				else
+					for (i = 0; i < w; ++i, out += n) {
+						out[0] = rows[i];
+						out[1] = rows[(decode_n == 3 ? w : 0) + i];
+						out[2] = rows[(decode_n == 3 ? 2 * w : 0) + i];
+						if (n == 4) out[3] = 255;
+					}
+			}
+			else {
+				for (i = 0; i < w; ++i, out += n) {
+					out[0] = is_rgb ? stbi__compute_y(rows[i], rows[w + i], rows[2 * w + i]) : rows[i];
+					if (n == 2) out[1] = 255;
+				}
+			}
+		}
+		STBI_FREE(rows);
+	}
+	else {
+		// dequantizing works in place, transform copies so later scans still refine the originals
+		short data[64];
+		for (k = 0; k < decode_n; ++k) {
+			int bw = (z->img_comp[k].x + 7) >> 3;
+			int bh = (z->img_comp[k].y + 7) >> 3;
+			for (j = 0; j < bh; ++j) {
+				for (i = 0; i < bw; ++i) {
+					memcpy(data, z->img_comp[k].coeff + 64 * (i + j * z->img_comp[k].coeff_w), sizeof(data));
+					stbi__jpeg_dequantize(data, z->dequant[z->img_comp[k].tq]);
+					z->idct_block_kernel(z->img_comp[k].data + z->img_comp[k].w2*j * 8 + i * 8, z->img_comp[k].w2, data);
+				}
+			}
+		}
+		w = z->s->img_x;
+		h = z->s->img_y;
+		output = stbi__jpeg_convert(z, n, decode_n, is_rgb);
+		if (!output) { z->progress = NULL; return; }
+	}
+
+	if (stbi__vertically_flip_on_load)
+		stbi__vertical_flip(output, w, h, n);
+	if (!z->progress(z->progress_user, output, w, h, n, z->progress_scan++))
+		z->progress = NULL;
+	STBI_FREE(output);
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+	int n, decode_n, is_rgb;
+	stbi_uc *output;
+	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+					 // validate req_comp
+	if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+	// load a jpeg image from whichever source, but leave in YCbCr format
+	if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+	// determine actual number of components to generate
+	stbi__jpeg_layout(z, req_comp, &n, &decode_n, &is_rgb);
+
+	// resample and color-convert
+	output = stbi__jpeg_convert(z, n, decode_n, is_rgb);
+	stbi__cleanup_jpeg(z);
+	if (!output) return NULL;
+	*out_x = z->s->img_x;
+	*out_y = z->s->img_y;
+	if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+	return output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
@@ -3758,6 +3874,32 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 }
 #endif
 
+STBIDEF stbi_uc *stbi_load_from_memory_progressive(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_progress_callback *progress, void *user)
+{
+#ifndef STBI_NO_JPEG
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	if (stbi__jpeg_test(&s)) {
+		stbi_uc *result;
+		stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+		if (!j) return stbi__errpuc("outofmem", "Out of memory");
+		j->s = &s;
+		stbi__setup_jpeg(j);
+		j->progress = progress;
+		j->progress_user = user;
+		j->progress_req_comp = req_comp;
+		j->progress_scan = 0;
+		j->progress_ac = 0;
+		result = load_jpeg_image(j, x, y, comp, req_comp);
+		STBI_FREE(j);
+		if (result && stbi__vertically_flip_on_load)
+			stbi__vertical_flip(result, *x, *y, req_comp ? req_comp : *comp);
+		return result;
+	}
+#endif
+	return stbi_load_from_memory(buffer, len, x, y, comp, req_comp);
+}
+
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
 //    simple implementation
 //      - all input must be provided in an upfront buffer
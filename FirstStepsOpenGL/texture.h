@@ -0,0 +1,812 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <glad/glad.h>
+
+#include <cmath>
+#include <array>
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+#include <functional>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <iostream>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define TEXTURE_SSE
+#endif
+
+#include "stb_image.h"
+#include "benchmark.h"
+
+// block compressed formats, for loaders that were generated without the extensions
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#endif
+
+// Mip chains are built on the CPU, on worker threads, instead of glGenerateMipmap on
+// the GL thread (which software drivers run on the render thread). Levels are filtered
+// in float RGBA, in linear light when the image is sRGB encoded, and each level is made
+// from the one above it.
+enum MipFilter
+{
+	MIP_FILTER_BOX,      // 2x2 average, fastest
+	MIP_FILTER_KAISER,   // windowed sinc, sharp with little ringing
+	MIP_FILTER_LANCZOS   // Lanczos 3, sharpest, rings a little on hard edges
+};
+
+struct MipSettings
+{
+	MipFilter filter = MIP_FILTER_BOX;
+	bool srgb = false;             // pixels are sRGB encoded, filter them in linear light
+	float alphaCutoff = -1.0f;     // >= 0: keep the alpha tested coverage of level 0 in every level
+	unsigned int threads = 0;      // 0: one per hardware thread
+	bool bgra = false;             // keep colour images as BGRA in RAM, the native order of most desktop drivers
+};
+
+// How pixels sit in RAM and in the texture. Layouts are chosen so the driver can copy
+// texels straight into storage: 4 byte texels for colour (a 3 byte GL_RGB upload is
+// converted texel by texel on the CPU by most drivers), and one or two channel storage
+// for grey images, expanded back to grey colour by the texture swizzle.
+struct TextureFormat
+{
+	GLenum internalFormat;
+	GLenum format;       // pixels in RAM
+	GLenum type;
+	int channels;        // bytes per texel in RAM
+	GLint swizzle[4];    // what the shader reads for r, g, b, a
+};
+
+// ------------------------------------------------------------------------
+inline TextureFormat textureFormat(int fileChannels, bool bgra = false)
+{
+	switch (fileChannels)
+	{
+	case 1: return { GL_R8, GL_RED, GL_UNSIGNED_BYTE, 1, { GL_RED, GL_RED, GL_RED, GL_ONE } };
+	case 2: return { GL_RG8, GL_RG, GL_UNSIGNED_BYTE, 2, { GL_RED, GL_RED, GL_RED, GL_GREEN } };
+	default:
+		// 3 channel files are decoded to 4 channels with an opaque alpha
+		if (bgra)
+			return { GL_RGBA8, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 4, { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA } };
+		return { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA } };
+	}
+}
+// largest GL_UNPACK_ALIGNMENT a tightly packed row satisfies, odd widths of R8 / RG8
+// levels would otherwise be read with padding that is not there
+// ------------------------------------------------------------------------
+inline int unpackAlignment(size_t rowBytes)
+{
+	return rowBytes % 8 == 0 ? 8 : rowBytes % 4 == 0 ? 4 : rowBytes % 2 == 0 ? 2 : 1;
+}
+
+// pixels of every level in format's layout, level 0 first
+struct MipChain
+{
+	int width = 0;
+	int height = 0;
+	TextureFormat format = textureFormat(4);
+	std::vector<std::vector<unsigned char> > levels;
+
+	int levelWidth(int level) const
+	{
+		return std::max(1, width >> level);
+	}
+	int levelHeight(int level) const
+	{
+		return std::max(1, height >> level);
+	}
+};
+
+// ------------------------------------------------------------------------
+inline int mipLevelCount(int width, int height)
+{
+	int levels = 1;
+	while ((std::max(width, height) >> levels) > 0)
+		levels++;
+	return levels;
+}
+
+// run function(firstRow, endRow) over bands of rows on up to `threads` threads
+// ------------------------------------------------------------------------
+template<typename Function>
+void parallelRows(int rows, unsigned int threads, Function function)
+{
+	// small levels are not worth a thread
+	if (threads <= 1 || rows < 64)
+	{
+		function(0, rows);
+		return;
+	}
+	int band = (rows + (int)threads - 1) / (int)threads;
+	std::vector<std::thread> workers;
+	for (int first = band; first < rows; first += band)
+		workers.push_back(std::thread(function, first, std::min(rows, first + band)));
+	function(0, std::min(rows, band));
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+namespace mip
+{
+	// sRGB <-> linear, decode by table, encode by a 4096 entry table of the linear value.
+	// The tables are function local statics, built once even when loader threads race here.
+	// ------------------------------------------------------------------------
+	inline const float *srgbDecodeTable()
+	{
+		static const std::array<float, 256> table = []()
+		{
+			std::array<float, 256> decode;
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.0f;
+				decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+			return decode;
+		}();
+		return table.data();
+	}
+	inline const unsigned char *srgbEncodeTable()
+	{
+		static const std::array<unsigned char, 4096> table = []()
+		{
+			std::array<unsigned char, 4096> encode;
+			for (int i = 0; i < 4096; i++)
+			{
+				float l = i / 4095.0f;
+				float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+				encode[i] = (unsigned char)(c * 255.0f + 0.5f);
+			}
+			return encode;
+		}();
+		return table.data();
+	}
+	// ------------------------------------------------------------------------
+	inline float sinc(float x)
+	{
+		if (std::fabs(x) < 1e-6f)
+			return 1.0f;
+		x *= 3.14159265f;
+		return std::sin(x) / x;
+	}
+	// zeroth order modified Bessel function of the first kind, for the Kaiser window
+	inline float besselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 20; k++)
+		{
+			term *= (x / (2.0f * k)) * (x / (2.0f * k));
+			sum += term;
+		}
+		return sum;
+	}
+	// Taps of a 2:1 decimation: destination pixel x reads source pixels 2x - 5 .. 2x + 6.
+	// t is the distance from the destination pixel center in destination pixels.
+	// ------------------------------------------------------------------------
+	const int TAPS = 12;
+	const int FIRST_TAP = -5;
+	inline void filterWeights(MipFilter filter, float weights[TAPS])
+	{
+		float sum = 0.0f;
+		for (int k = 0; k < TAPS; k++)
+		{
+			float t = ((FIRST_TAP + k) - 0.5f) * 0.5f;
+			float w = 0.0f;
+			if (std::fabs(t) < 3.0f)
+			{
+				if (filter == MIP_FILTER_LANCZOS)
+					w = sinc(t) * sinc(t / 3.0f);
+				else
+				{
+					const float alpha = 4.0f;
+					float r = t / 3.0f;
+					w = sinc(t) * besselI0(alpha * std::sqrt(1.0f - r * r)) / besselI0(alpha);
+				}
+			}
+			weights[k] = w;
+			sum += w;
+		}
+		for (int k = 0; k < TAPS; k++)
+			weights[k] /= sum;
+	}
+	// ------------------------------------------------------------------------
+	inline void boxRows(const float *src, int srcWidth, int srcHeight, float *dst, int dstWidth, int first, int end)
+	{
+		for (int y = first; y < end; y++)
+		{
+			const float *row0 = src + (size_t)std::min(2 * y, srcHeight - 1) * srcWidth * 4;
+			const float *row1 = src + (size_t)std::min(2 * y + 1, srcHeight - 1) * srcWidth * 4;
+			float *out = dst + (size_t)y * dstWidth * 4;
+			for (int x = 0; x < dstWidth; x++)
+			{
+				int x0 = std::min(2 * x, srcWidth - 1) * 4, x1 = std::min(2 * x + 1, srcWidth - 1) * 4;
+#ifdef TEXTURE_SSE
+				__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+				                        _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+				_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+				for (int c = 0; c < 4; c++)
+					out[x * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+#endif
+			}
+		}
+	}
+	// one separable pass, step is 1 (horizontal, along a row) or the row pitch (vertical)
+	// ------------------------------------------------------------------------
+	inline void filterPixel(const float *line, int length, size_t step, int x, const float weights[TAPS], float *out)
+	{
+#ifdef TEXTURE_SSE
+		__m128 sum = _mm_setzero_ps();
+		for (int k = 0; k < TAPS; k++)
+		{
+			int i = std::min(std::max(2 * x + FIRST_TAP + k, 0), length - 1);
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(line + i * step), _mm_set1_ps(weights[k])));
+		}
+		_mm_storeu_ps(out, sum);
+#else
+		float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int k = 0; k < TAPS; k++)
+		{
+			int i = std::min(std::max(2 * x + FIRST_TAP + k, 0), length - 1);
+			for (int c = 0; c < 4; c++)
+				sum[c] += line[i * step + c] * weights[k];
+		}
+		for (int c = 0; c < 4; c++)
+			out[c] = sum[c];
+#endif
+	}
+	// fraction of texels whose alpha, scaled, passes the alpha test
+	// ------------------------------------------------------------------------
+	inline float coverage(const std::vector<float> &pixels, float cutoff, float scale)
+	{
+		size_t passed = 0, count = pixels.size() / 4;
+		for (size_t i = 0; i < count; i++)
+			passed += pixels[i * 4 + 3] * scale > cutoff ? 1 : 0;
+		return count ? (float)passed / count : 0.0f;
+	}
+}
+
+// one level down from a float RGBA level
+// ------------------------------------------------------------------------
+inline std::vector<float> downsampleLevel(const std::vector<float> &src, int srcWidth, int srcHeight, const MipSettings &settings, unsigned int threads)
+{
+	int dstWidth = std::max(1, srcWidth / 2), dstHeight = std::max(1, srcHeight / 2);
+	std::vector<float> dst((size_t)dstWidth * dstHeight * 4);
+	if (settings.filter == MIP_FILTER_BOX)
+	{
+		parallelRows(dstHeight, threads, [&](int first, int end) { mip::boxRows(&src[0], srcWidth, srcHeight, &dst[0], dstWidth, first, end); });
+		return dst;
+	}
+	float weights[mip::TAPS];
+	mip::filterWeights(settings.filter, weights);
+	// an axis of length 1 is copied, clamping makes every tap read the same texel
+	std::vector<float> horizontal((size_t)dstWidth * srcHeight * 4);
+	parallelRows(srcHeight, threads, [&](int first, int end)
+	{
+		for (int y = first; y < end; y++)
+			for (int x = 0; x < dstWidth; x++)
+				mip::filterPixel(&src[(size_t)y * srcWidth * 4], srcWidth, 4, x, weights, &horizontal[((size_t)y * dstWidth + x) * 4]);
+	});
+	parallelRows(dstHeight, threads, [&](int first, int end)
+	{
+		for (int y = first; y < end; y++)
+			for (int x = 0; x < dstWidth; x++)
+				mip::filterPixel(&horizontal[(size_t)x * 4], srcHeight, (size_t)dstWidth * 4, y, weights, &dst[((size_t)y * dstWidth + x) * 4]);
+	});
+	return dst;
+}
+
+// every level of a tightly packed image of 1 (grey), 2 (grey, alpha) or 4 (RGBA) channels,
+// the filtering runs on settings.threads threads
+// ------------------------------------------------------------------------
+inline MipChain buildMipChain(const unsigned char *pixels, int width, int height, int channels, const MipSettings &settings = MipSettings())
+{
+	unsigned int threads = settings.threads ? settings.threads : std::max(1u, std::thread::hardware_concurrency());
+	const float *decode = mip::srgbDecodeTable();
+	const unsigned char *encode = mip::srgbEncodeTable();
+
+	MipChain chain;
+	chain.width = width;
+	chain.height = height;
+	chain.format = textureFormat(channels, settings.bgra);
+	int levels = mipLevelCount(width, height);
+	chain.levels.resize(levels);
+
+	// filtering always works on float RGBA, grey images are spread over r, g and b; the
+	// lanes each stored channel comes from, in RAM order
+	int lanes[4] = { 0, 1, 2, 3 };
+	if (channels == 2)
+		lanes[1] = 3;
+	else if (chain.format.format == GL_BGRA)
+	{
+		lanes[0] = 2;
+		lanes[2] = 0;
+	}
+	std::vector<float> level((size_t)width * height * 4);
+	parallelRows(height, threads, [&](int first, int end)
+	{
+		for (size_t t = (size_t)first * width; t < (size_t)end * width; t++)
+		{
+			const unsigned char *in = pixels + t * channels;
+			float *texel = &level[t * 4];
+			float grey = settings.srgb ? decode[in[0]] : in[0] / 255.0f;
+			texel[0] = texel[1] = texel[2] = grey;
+			texel[3] = channels == 2 ? in[1] / 255.0f : 1.0f;
+			if (channels == 4)
+			{
+				texel[1] = settings.srgb ? decode[in[1]] : in[1] / 255.0f;
+				texel[2] = settings.srgb ? decode[in[2]] : in[2] / 255.0f;
+				texel[3] = in[3] / 255.0f;
+			}
+		}
+	});
+	// level 0 in the chosen layout, without a round trip through float
+	chain.levels[0].resize((size_t)width * height * chain.format.channels);
+	for (size_t t = 0; t < (size_t)width * height; t++)
+		for (int c = 0; c < chain.format.channels; c++)
+			chain.levels[0][t * chain.format.channels + c] = pixels[t * channels + (channels == 4 ? lanes[c] : c)];
+	float targetCoverage = settings.alphaCutoff >= 0.0f ? mip::coverage(level, settings.alphaCutoff, 1.0f) : 0.0f;
+
+	for (int l = 1; l < levels; l++)
+	{
+		level = downsampleLevel(level, chain.levelWidth(l - 1), chain.levelHeight(l - 1), settings, threads);
+		// averaging shrinks alpha tested cutouts (foliage, fences), scale alpha until the
+		// level covers as much as level 0 did
+		float alphaScale = 1.0f;
+		if (settings.alphaCutoff >= 0.0f)
+		{
+			float low = 0.0f, high = 4.0f;
+			for (int step = 0; step < 12; step++)
+			{
+				alphaScale = 0.5f * (low + high);
+				if (mip::coverage(level, settings.alphaCutoff, alphaScale) < targetCoverage)
+					low = alphaScale;
+				else
+					high = alphaScale;
+			}
+		}
+		std::vector<unsigned char> &out = chain.levels[l];
+		int stored = chain.format.channels;
+		out.resize(level.size() / 4 * stored);
+		parallelRows((int)(level.size() / 4), threads, [&](int first, int end)
+		{
+			for (size_t t = first; t < (size_t)end; t++)
+			{
+				for (int c = 0; c < stored; c++)
+				{
+					int lane = lanes[c];
+					float v = std::min(std::max(lane == 3 ? level[t * 4 + lane] * alphaScale : level[t * 4 + lane], 0.0f), 1.0f);
+					out[t * stored + c] = (settings.srgb && lane != 3) ? encode[(int)(v * 4095.0f + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+				}
+			}
+		});
+	}
+	return chain;
+}
+
+// decode with stb_image and build the chain, an empty chain when the file cannot be read.
+// The header is read first so grey images are decoded to 1 or 2 channels and colour to 4.
+// ------------------------------------------------------------------------
+inline MipChain loadMipChain(const std::string &path, const MipSettings &settings = MipSettings())
+{
+	int width, height, channels;
+	if (!stbi_info(path.c_str(), &width, &height, &channels))
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << std::endl;
+		return MipChain();
+	}
+	int decoded = textureFormat(channels).channels;
+	unsigned char *data = stbi_load(path.c_str(), &width, &height, &channels, decoded);
+	if (!data)
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << std::endl;
+		return MipChain();
+	}
+	MipChain chain = buildMipChain(data, width, height, decoded, settings);
+	stbi_image_free(data);
+	return chain;
+}
+// the same for a whole image file already in memory, name is only used in errors
+// ------------------------------------------------------------------------
+inline MipChain decodeMipChain(const unsigned char *file, size_t size, const std::string &name, const MipSettings &settings = MipSettings())
+{
+	int width, height, channels;
+	if (!stbi_info_from_memory(file, (int)size, &width, &height, &channels))
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << name << std::endl;
+		return MipChain();
+	}
+	int decoded = textureFormat(channels).channels;
+	unsigned char *data = stbi_load_from_memory(file, (int)size, &width, &height, &channels, decoded);
+	if (!data)
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << name << std::endl;
+		return MipChain();
+	}
+	MipChain chain = buildMipChain(data, width, height, decoded, settings);
+	stbi_image_free(data);
+	return chain;
+}
+// the same on a worker thread, the GL thread only uploads the result
+// ------------------------------------------------------------------------
+inline std::future<MipChain> loadMipChainAsync(const std::string &path, const MipSettings &settings = MipSettings())
+{
+	return std::async(std::launch::async, [path, settings]() { return loadMipChain(path, settings); });
+}
+
+// called on the decoding thread with the chain of each preview, which it may move from;
+// returning false ends the previews, the decode itself goes on
+typedef std::function<bool(MipChain &preview)> MipPreviewCallback;
+
+// decodeMipChain for progressive JPEGs that become usable before they are decoded. After
+// every scan preview gets the image so far: 1/8 size while only DC coefficients are in
+// (those chains stand in for level 3 on of the final one), full size once the AC scans
+// start. Previews are filtered with the box filter whatever settings asks for, they only
+// live until the next one. A full size chain costs about as much as the decode of its
+// scan, so after fullSizePreviews of them the previews end. Other files decode as with
+// decodeMipChain, without previews.
+// ------------------------------------------------------------------------
+inline MipChain decodeMipChainProgressive(const unsigned char *file, size_t size, const std::string &name, const MipSettings &settings, const MipPreviewCallback &preview, unsigned int fullSizePreviews = 1)
+{
+	int width, height, channels;
+	if (!stbi_info_from_memory(file, (int)size, &width, &height, &channels))
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << name << std::endl;
+		return MipChain();
+	}
+	struct Previews
+	{
+		const MipPreviewCallback *callback;
+		MipSettings settings;
+		int width;
+		unsigned int fullSizeLeft;
+		static int scan(void *user, stbi_uc *pixels, int x, int y, int channels, int)
+		{
+			Previews *previews = (Previews*)user;
+			if (x == previews->width && previews->fullSizeLeft-- == 0)
+				return 0;
+			MipChain chain = buildMipChain(pixels, x, y, channels, previews->settings);
+			return (*previews->callback)(chain) && (x < previews->width || previews->fullSizeLeft > 0) ? 1 : 0;
+		}
+	} previews = { &preview, settings, width, fullSizePreviews };
+	previews.settings.filter = MIP_FILTER_BOX;
+
+	int decoded = textureFormat(channels).channels;
+	unsigned char *data = stbi_load_from_memory_progressive(file, (int)size, &width, &height, &channels, decoded, &Previews::scan, &previews);
+	if (!data)
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << name << std::endl;
+		return MipChain();
+	}
+	MipChain chain = buildMipChain(data, width, height, decoded, settings);
+	stbi_image_free(data);
+	return chain;
+}
+
+// ------------------------------------------------------------------------
+inline int bytesPerTexel(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_R8: return 1;
+	case GL_RG8: return 2;
+	case GL_RGB8: case GL_SRGB8: return 3;
+	default: return 4;
+	}
+}
+// bytes of a 4x4 block of a block compressed internal format, 0 for the others
+inline int compressedBlockBytes(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGB8_ETC2: return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_RGBA8_ETC2_EAC: case GL_COMPRESSED_RGBA_BPTC_UNORM: return 16;
+	default: return 0;
+	}
+}
+// bytes of a level in video memory, at least; also the size of a chain level in RAM
+// ------------------------------------------------------------------------
+inline size_t textureLevelBytes(GLenum internalFormat, int width, int height)
+{
+	int block = compressedBlockBytes(internalFormat);
+	if (block)
+		return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block;
+	return (size_t)width * height * bytesPerTexel(internalFormat);
+}
+
+// wrap and filter state, reapplied whenever a texture's storage is reallocated
+struct TextureSampling
+{
+	GLint wrap = GL_REPEAT;
+	GLint minFilter = GL_LINEAR_MIPMAP_LINEAR;
+	GLint magFilter = GL_LINEAR;
+
+	// on the bound GL_TEXTURE_2D
+	void apply() const
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+	}
+};
+
+// A 2D texture with immutable storage (glTexStorage2D) for its whole mip chain, or the
+// same levels defined one by one with glTexImage2D where ARB_texture_storage is missing
+class Texture
+{
+public:
+	unsigned int ID = 0;
+	int width = 0;
+	int height = 0;
+	int levels = 0;
+	TextureFormat format = textureFormat(4);
+
+	// ------------------------------------------------------------------------
+	void allocate(int w, int h, int levelCount, const TextureFormat &textureFormat)
+	{
+		width = w;
+		height = h;
+		levels = levelCount;
+		format = textureFormat;
+		glGenTextures(1, &ID);
+		glBindTexture(GL_TEXTURE_2D, ID);
+		if (GLAD_GL_ARB_texture_storage || GLAD_GL_VERSION_4_2)
+			glTexStorage2D(GL_TEXTURE_2D, levels, format.internalFormat, width, height);
+		else
+		{
+			for (int level = 0; level < levels; level++)
+				glTexImage2D(GL_TEXTURE_2D, level, format.internalFormat, std::max(1, width >> level), std::max(1, height >> level), 0, format.format, format.type, NULL);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+	}
+	// one tightly packed level in format's layout, or its blocks for compressed formats
+	// ------------------------------------------------------------------------
+	void uploadLevel(int level, const unsigned char *pixels)
+	{
+		int w = std::max(1, width >> level), h = std::max(1, height >> level);
+		glBindTexture(GL_TEXTURE_2D, ID);
+		if (compressedBlockBytes(format.internalFormat))
+		{
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, format.internalFormat, (GLsizei)levelBytes(level), pixels);
+			return;
+		}
+		// other uploads in the app expect the default alignment, so it is put back
+		GLint savedAlignment;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &savedAlignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment((size_t)w * format.channels));
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, format.format, format.type, pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, savedAlignment);
+	}
+	// ------------------------------------------------------------------------
+	void release()
+	{
+		if (ID)
+			glDeleteTextures(1, &ID);
+		ID = 0;
+	}
+	// video memory of one level and of every level, as the driver would need at least
+	// ------------------------------------------------------------------------
+	size_t levelBytes(int level) const
+	{
+		return textureLevelBytes(format.internalFormat, std::max(1, width >> level), std::max(1, height >> level));
+	}
+	size_t bytes() const
+	{
+		size_t total = 0;
+		for (int level = 0; level < levels; level++)
+			total += levelBytes(level);
+		return total;
+	}
+};
+
+// storage for the chain, uploaded level by level; an empty chain gives an empty Texture
+// ------------------------------------------------------------------------
+inline Texture createTexture(const MipChain &chain)
+{
+	Texture texture;
+	if (chain.levels.empty())
+		return texture;
+	texture.allocate(chain.width, chain.height, (int)chain.levels.size(), chain.format);
+	for (int level = 0; level < texture.levels; level++)
+		texture.uploadLevel(level, &chain.levels[level][0]);
+	return texture;
+}
+
+// Mip generation for one image: glGenerateMipmap against the CPU filters on one thread
+// and on every hardware thread. Each GL path ends with glFinish so the driver's work is
+// counted; run it on llvmpipe (LIBGL_ALWAYS_SOFTWARE=1) to see the render thread cost.
+// ------------------------------------------------------------------------
+inline void benchmarkMipGeneration(const char *path, unsigned int repeats)
+{
+	int width, height, channels;
+	unsigned char *data = stbi_load(path, &width, &height, &channels, 4);
+	if (!data)
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << std::endl;
+		return;
+	}
+	std::cout << "TEXTURE::MIPS on " << (const char*)glGetString(GL_RENDERER) << ", " << width << "x" << height << std::endl;
+
+	BenchmarkTimer timer;
+	for (unsigned int r = 0; r < repeats; r++)
+	{
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glFinish();
+		glDeleteTextures(1, &texture);
+	}
+	printBenchmarkResult("TEXTURE::GL_GENERATE_MIPMAP", timer.elapsedMs() / repeats, "ms");
+
+	const char *filterNames[3] = { "BOX", "KAISER", "LANCZOS" };
+	for (int filter = 0; filter < 3; filter++)
+	{
+		for (int parallel = 0; parallel < 2; parallel++)
+		{
+			MipSettings settings;
+			settings.filter = (MipFilter)filter;
+			settings.srgb = true;
+			settings.threads = parallel ? 0 : 1;
+			timer.restart();
+			double buildMs = 0.0;
+			for (unsigned int r = 0; r < repeats; r++)
+			{
+				BenchmarkTimer build;
+				MipChain chain = buildMipChain(data, width, height, 4, settings);
+				buildMs += build.elapsedMs();
+				Texture texture = createTexture(chain);
+				glFinish();
+				texture.release();
+			}
+			std::string name = std::string("TEXTURE::CPU_") + filterNames[filter] + (parallel ? "_PARALLEL" : "_SINGLE_THREAD");
+			printBenchmarkResult(name, timer.elapsedMs() / repeats, "ms");
+			printBenchmarkResult(name + "_BUILD_ONLY", buildMs / repeats, "ms");
+		}
+	}
+	stbi_image_free(data);
+}
+
+// Level 0 uploads of one image through each source layout: 3 byte GL_RGB texels (what
+// the demo used to upload), RGBA, BGRA and the image as grey R8 with a swizzle. Storage
+// is allocated once, each repeat is a glTexSubImage2D + glFinish so the driver's
+// conversion is counted. Bits per texel are what the driver reports it stores.
+// ------------------------------------------------------------------------
+inline void benchmarkTextureUpload(const char *path, unsigned int repeats)
+{
+	int width, height, channels;
+	unsigned char *rgb = stbi_load(path, &width, &height, &channels, 3);
+	unsigned char *rgba = stbi_load(path, &width, &height, &channels, 4);
+	unsigned char *grey = stbi_load(path, &width, &height, &channels, 1);
+	if (!rgb || !rgba || !grey)
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << std::endl;
+		stbi_image_free(rgb);
+		stbi_image_free(rgba);
+		stbi_image_free(grey);
+		return;
+	}
+	std::vector<unsigned char> bgra((size_t)width * height * 4);
+	for (size_t t = 0; t < (size_t)width * height; t++)
+	{
+		bgra[t * 4 + 0] = rgba[t * 4 + 2];
+		bgra[t * 4 + 1] = rgba[t * 4 + 1];
+		bgra[t * 4 + 2] = rgba[t * 4 + 0];
+		bgra[t * 4 + 3] = rgba[t * 4 + 3];
+	}
+	struct Path
+	{
+		const char *name;
+		TextureFormat format;
+		const unsigned char *pixels;
+	};
+	TextureFormat rgbFormat = { GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3, { GL_RED, GL_GREEN, GL_BLUE, GL_ONE } };
+	Path paths[4] = {
+		{ "RGB8_FROM_RGB", rgbFormat, rgb },
+		{ "RGBA8_FROM_RGBA", textureFormat(4), rgba },
+		{ "RGBA8_FROM_BGRA", textureFormat(4, true), &bgra[0] },
+		{ "R8_SWIZZLED_FROM_GREY", textureFormat(1), grey },
+	};
+	std::cout << "TEXTURE::UPLOAD on " << (const char*)glGetString(GL_RENDERER) << ", " << width << "x" << height << std::endl;
+	for (const Path &uploadPath : paths)
+	{
+		Texture texture;
+		texture.allocate(width, height, 1, uploadPath.format);
+		texture.uploadLevel(0, uploadPath.pixels);
+		glFinish();
+		BenchmarkTimer timer;
+		for (unsigned int r = 0; r < repeats; r++)
+		{
+			texture.uploadLevel(0, uploadPath.pixels);
+			glFinish();
+		}
+		double uploadMs = timer.elapsedMs() / repeats;
+
+		GLint bits = 0;
+		GLenum sizes[4] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE, GL_TEXTURE_ALPHA_SIZE };
+		for (GLenum size : sizes)
+		{
+			GLint channelBits = 0;
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, size, &channelBits);
+			bits += channelBits;
+		}
+		std::string name = std::string("TEXTURE::UPLOAD_") + uploadPath.name;
+		printBenchmarkResult(name, uploadMs, "ms");
+		printBenchmarkResult(name + "_VRAM", texture.bytes() / 1024.0, "KiB, driver stores " + std::to_string(bits) + " bits/texel");
+		texture.release();
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	stbi_image_free(rgb);
+	stbi_image_free(rgba);
+	stbi_image_free(grey);
+}
+
+// Time from request to the first texture that can be drawn, for a file in memory:
+// decodeMipChain then upload, against decodeMipChainProgressive uploading every preview
+// as it arrives and the final chain at the end. Only progressive JPEGs have previews, for
+// anything else both paths show the texture when it is complete.
+// ------------------------------------------------------------------------
+inline void benchmarkProgressiveJpeg(const char *path, unsigned int repeats)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (file.empty())
+	{
+		std::cout << "ERROR::TEXTURE::LOAD_FAILED " << path << std::endl;
+		return;
+	}
+	MipSettings settings;
+	double fullMs = 0.0, firstMs = 0.0, progressiveMs = 0.0;
+	unsigned int previewCount = 0;
+	int firstWidth = 0;
+	for (unsigned int r = 0; r < repeats; r++)
+	{
+		BenchmarkTimer timer;
+		Texture texture = createTexture(decodeMipChain(&file[0], file.size(), path, settings));
+		glFinish();
+		fullMs += timer.elapsedMs();
+		texture.release();
+
+		timer.restart();
+		double first = -1.0;
+		MipPreviewCallback preview = [&](MipChain &chain)
+		{
+			texture.release();
+			texture = createTexture(chain);
+			glFinish();
+			if (first < 0.0)
+			{
+				first = timer.elapsedMs();
+				firstWidth = chain.width;
+			}
+			previewCount++;
+			return true;
+		};
+		MipChain chain = decodeMipChainProgressive(&file[0], file.size(), path, settings, preview);
+		texture.release();
+		texture = createTexture(chain);
+		glFinish();
+		progressiveMs += timer.elapsedMs();
+		firstMs += first < 0.0 ? timer.elapsedMs() : first;
+		texture.release();
+	}
+	std::string previews = std::to_string(previewCount / repeats) + " previews, the first " + std::to_string(firstWidth) + " wide";
+	printBenchmarkResult("TEXTURE::PROGRESSIVE_FULL_DECODE", fullMs / repeats, "ms to the first texture");
+	printBenchmarkResult("TEXTURE::PROGRESSIVE_FIRST_PREVIEW", firstMs / repeats, "ms to the first texture, " + previews);
+	printBenchmarkResult("TEXTURE::PROGRESSIVE_ALL_SCANS", progressiveMs / repeats, "ms to the final texture");
+}
+#endif
@@ -0,0 +1,395 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <iostream>
+
+#include "texture.h"
+#include "universalTexture.h"
+#include "benchmark.h"
+
+namespace texcache
+{
+	const unsigned long long PRIME1 = 11400714785074694791ULL;
+	const unsigned long long PRIME2 = 14029467366897019727ULL;
+	const unsigned long long PRIME3 = 1609587929392839161ULL;
+	const unsigned long long PRIME4 = 9650029242287828579ULL;
+	const unsigned long long PRIME5 = 2870177450012600261ULL;
+
+	// ------------------------------------------------------------------------
+	inline unsigned long long rotl(unsigned long long x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+	inline unsigned long long round(unsigned long long acc, unsigned long long input)
+	{
+		return rotl(acc + input * PRIME2, 31) * PRIME1;
+	}
+	inline unsigned long long merge(unsigned long long acc, unsigned long long value)
+	{
+		return (acc ^ round(0, value)) * PRIME1 + PRIME4;
+	}
+	inline unsigned long long read64(const unsigned char *p)
+	{
+		unsigned long long v;
+		std::memcpy(&v, p, 8);
+		return v;
+	}
+}
+
+// xxHash64 of size bytes, a few GB/s: hashing a file costs far less than decoding it
+// ------------------------------------------------------------------------
+inline unsigned long long contentHash(const void *data, size_t size, unsigned long long seed = 0)
+{
+	using namespace texcache;
+	const unsigned char *p = (const unsigned char*)data, *end = p + size;
+	unsigned long long hash;
+	if (size >= 32)
+	{
+		unsigned long long v1 = seed + PRIME1 + PRIME2, v2 = seed + PRIME2, v3 = seed, v4 = seed - PRIME1;
+		for (; p + 32 <= end; p += 32)
+		{
+			v1 = round(v1, read64(p));
+			v2 = round(v2, read64(p + 8));
+			v3 = round(v3, read64(p + 16));
+			v4 = round(v4, read64(p + 24));
+		}
+		hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		hash = merge(merge(merge(merge(hash, v1), v2), v3), v4);
+	}
+	else
+		hash = seed + PRIME5;
+	hash += size;
+	for (; p + 8 <= end; p += 8)
+		hash = rotl(hash ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+	if (p + 4 <= end)
+	{
+		unsigned int v;
+		std::memcpy(&v, p, 4);
+		hash = rotl(hash ^ (v * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++)
+		hash = rotl(hash ^ (*p * PRIME5), 11) * PRIME1;
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	return hash ^ (hash >> 32);
+}
+
+// Identity of a texture's contents: a 64 bit hash and the byte count hashed. Files are not
+// kept to compare, two different images with the same key would share a texture; at 64
+// bits that is left to chance.
+struct TextureKey
+{
+	unsigned long long hash = 0;
+	size_t size = 0;
+
+	bool operator<(const TextureKey &other) const
+	{
+		return hash != other.hash ? hash < other.hash : size < other.size;
+	}
+	bool operator==(const TextureKey &other) const
+	{
+		return hash == other.hash && size == other.size;
+	}
+};
+
+// the options that change what a file decodes to, threads does not
+// ------------------------------------------------------------------------
+inline unsigned long long mipSettingsHash(const MipSettings &settings, unsigned long long seed = 0)
+{
+	int fields[4] = { (int)settings.filter, settings.srgb ? 1 : 0, settings.bgra ? 1 : 0, 0 };
+	std::memcpy(&fields[3], &settings.alphaCutoff, 4);
+	return contentHash(fields, sizeof(fields), seed);
+}
+// an encoded image file decoded with settings
+// ------------------------------------------------------------------------
+inline TextureKey fileTextureKey(const unsigned char *file, size_t size, const MipSettings &settings)
+{
+	TextureKey key;
+	key.hash = contentHash(file, size, mipSettingsHash(settings));
+	key.size = size;
+	return key;
+}
+// a decoded chain: its size, layout and level 0, the other levels follow from those and
+// the settings
+// ------------------------------------------------------------------------
+inline TextureKey pixelTextureKey(const MipChain &chain, const MipSettings &settings)
+{
+	TextureKey key;
+	if (chain.levels.empty())
+		return key;
+	unsigned int shape[4] = { (unsigned int)chain.width, (unsigned int)chain.height, chain.format.internalFormat, chain.format.format };
+	key.hash = contentHash(&chain.levels[0][0], chain.levels[0].size(), contentHash(shape, sizeof(shape), mipSettingsHash(settings)));
+	key.size = chain.levels[0].size();
+	return key;
+}
+
+// what a TextureCache found, since it was created
+struct TextureCacheStats
+{
+	unsigned int requests = 0;
+	unsigned int decodes = 0;
+	unsigned int fileDuplicates = 0;    // the same file bytes and settings again, under any path
+	unsigned int pixelDuplicates = 0;   // another file that decoded to pixels already loaded
+	size_t savedBytes = 0;              // video memory of the textures not created
+	double savedDecodeMs = 0.0;         // decodes skipped for file duplicates
+	double hashMs = 0.0;                // spent hashing files and pixels
+};
+
+// Textures shared by content. A request is keyed by a hash of the encoded file plus the
+// decode options, so the same image under ten paths is decoded and uploaded once; a file
+// not seen before is decoded and keyed again by its pixels, which catches copies that were
+// re-saved or had their metadata edited. Every acquire() adds a reference, the texture is
+// deleted when the last one is released.
+//
+//   unsigned int texture = cache.acquire(path, settings);
+//   ...
+//   cache.release(texture);
+class TextureCache
+{
+public:
+	// a disabled cache creates a texture for every request, used to measure what it saves
+	explicit TextureCache(bool enabled = true) : enabled(enabled), target(universalTarget())
+	{
+	}
+	~TextureCache()
+	{
+		for (std::map<unsigned int, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+			it->second.texture.release();
+	}
+
+	// the GL name of the image at path decoded with settings, 0 when it cannot be loaded
+	// ------------------------------------------------------------------------
+	unsigned int acquire(const std::string &path, const MipSettings &settings = MipSettings(), const TextureSampling &sampling = TextureSampling())
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (file.empty())
+		{
+			std::cout << "ERROR::TEXTURE_CACHE::LOAD_FAILED " << path << std::endl;
+			return 0;
+		}
+		return acquire(&file[0], file.size(), path, settings, sampling);
+	}
+	// the same for a file already in memory, name is only used in errors
+	// ------------------------------------------------------------------------
+	unsigned int acquire(const unsigned char *file, size_t size, const std::string &name, const MipSettings &settings = MipSettings(), const TextureSampling &sampling = TextureSampling())
+	{
+		stats.requests++;
+		BenchmarkTimer timer;
+		// the sampling state lives in the texture object, requests differing in it get their own
+		int samplingFields[3] = { sampling.wrap, sampling.minFilter, sampling.magFilter };
+		TextureKey fileKey = fileTextureKey(file, size, settings);
+		fileKey.hash = contentHash(samplingFields, sizeof(samplingFields), fileKey.hash);
+		stats.hashMs += timer.elapsedMs();
+		if (enabled)
+		{
+			std::map<TextureKey, unsigned int>::iterator found = files.find(fileKey);
+			if (found != files.end())
+			{
+				Entry &entry = entries[found->second];
+				entry.references++;
+				stats.fileDuplicates++;
+				stats.savedBytes += entry.texture.bytes();
+				stats.savedDecodeMs += entry.decodeMs;
+				return found->second;
+			}
+		}
+
+		timer.restart();
+		MipChain chain = isUniversalTexture(file, size) ? decodeUniversalTexture(file, size, name, target) : decodeMipChain(file, size, name, settings);
+		double decodeMs = timer.elapsedMs();
+		stats.decodes++;
+		if (chain.levels.empty())
+			return 0;
+		timer.restart();
+		TextureKey pixelKey = pixelTextureKey(chain, settings);
+		pixelKey.hash = contentHash(samplingFields, sizeof(samplingFields), pixelKey.hash);
+		stats.hashMs += timer.elapsedMs();
+		if (enabled)
+		{
+			std::map<TextureKey, unsigned int>::iterator found = pixels.find(pixelKey);
+			if (found != pixels.end())
+			{
+				// later requests for this file are file duplicates
+				Entry &entry = entries[found->second];
+				entry.references++;
+				entry.fileKeys.push_back(fileKey);
+				files[fileKey] = found->second;
+				stats.pixelDuplicates++;
+				stats.savedBytes += entry.texture.bytes();
+				return found->second;
+			}
+		}
+
+		Entry entry;
+		entry.texture = createTexture(chain);
+		sampling.apply();
+		entry.references = 1;
+		entry.decodeMs = decodeMs;
+		unsigned int id = entry.texture.ID;
+		if (enabled)
+		{
+			entry.fileKeys.push_back(fileKey);
+			entry.pixelKey = pixelKey;
+			files[fileKey] = id;
+			pixels[pixelKey] = id;
+		}
+		entries[id] = entry;
+		return id;
+	}
+	// a holder of texture no longer needs it
+	// ------------------------------------------------------------------------
+	void release(unsigned int texture)
+	{
+		std::map<unsigned int, Entry>::iterator found = entries.find(texture);
+		if (found == entries.end())
+		{
+			std::cout << "ERROR::TEXTURE_CACHE::UNKNOWN_TEXTURE " << texture << std::endl;
+			return;
+		}
+		if (--found->second.references > 0)
+			return;
+		for (const TextureKey &key : found->second.fileKeys)
+			files.erase(key);
+		if (enabled)
+			pixels.erase(found->second.pixelKey);
+		found->second.texture.release();
+		entries.erase(found);
+	}
+	// the texture behind a GL name handed out, NULL for others
+	// ------------------------------------------------------------------------
+	const Texture *find(unsigned int texture) const
+	{
+		std::map<unsigned int, Entry>::const_iterator found = entries.find(texture);
+		return found == entries.end() ? NULL : &found->second.texture;
+	}
+	unsigned int references(unsigned int texture) const
+	{
+		std::map<unsigned int, Entry>::const_iterator found = entries.find(texture);
+		return found == entries.end() ? 0 : found->second.references;
+	}
+	// video memory of every texture held
+	// ------------------------------------------------------------------------
+	size_t bytes() const
+	{
+		size_t total = 0;
+		for (std::map<unsigned int, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			total += it->second.texture.bytes();
+		return total;
+	}
+	size_t textureCount() const
+	{
+		return entries.size();
+	}
+	const TextureCacheStats &statistics() const
+	{
+		return stats;
+	}
+
+private:
+	struct Entry
+	{
+		Texture texture;
+		unsigned int references = 0;
+		double decodeMs = 0.0;
+		std::vector<TextureKey> fileKeys;   // every file that resolved to the texture
+		TextureKey pixelKey;
+	};
+	bool enabled;
+	UniversalTarget target;
+	std::map<unsigned int, Entry> entries;
+	std::map<TextureKey, unsigned int> files;
+	std::map<TextureKey, unsigned int> pixels;
+	TextureCacheStats stats;
+};
+
+// a copy of an image file with different bytes but the same pixels, as an editor that
+// rewrote its metadata would leave it: a JPEG comment or a PNG text chunk is inserted
+// ------------------------------------------------------------------------
+inline std::vector<unsigned char> withMetadata(const std::vector<unsigned char> &file, const std::string &text)
+{
+	std::vector<unsigned char> copy(file);
+	if (file.size() > 2 && file[0] == 0xFF && file[1] == 0xD8)
+	{
+		size_t length = text.size() + 2;
+		unsigned char marker[4] = { 0xFF, 0xFE, (unsigned char)(length >> 8), (unsigned char)length };
+		copy.insert(copy.begin() + 2, text.begin(), text.end());
+		copy.insert(copy.begin() + 2, marker, marker + 4);
+	}
+	else if (file.size() > 33 && std::memcmp(&file[1], "PNG", 3) == 0)
+	{
+		// after IHDR; stb_image does not check chunk CRCs, the one written here is a placeholder
+		std::vector<unsigned char> chunk = { 0, 0, 0, (unsigned char)text.size(), 't', 'E', 'X', 't' };
+		chunk.insert(chunk.end(), text.begin(), text.end());
+		chunk.insert(chunk.end(), 4, 0);
+		copy.insert(copy.begin() + 33, chunk.begin(), chunk.end());
+	}
+	return copy;
+}
+
+// A scene of `references` textures drawn from the given images: every image is referenced
+// under several paths, and every other reference is a copy with edited metadata. Loaded
+// once through a disabled cache and once through an enabled one; reported are the load
+// time and video memory of both, the duplicates found, and what they saved.
+// ------------------------------------------------------------------------
+inline void benchmarkTextureCache(const std::vector<std::string> &paths, unsigned int references)
+{
+	std::vector<std::vector<unsigned char> > files;
+	for (const std::string &path : paths)
+	{
+		std::ifstream in(path, std::ios::binary);
+		files.push_back(std::vector<unsigned char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()));
+		if (files.back().empty())
+		{
+			std::cout << "ERROR::TEXTURE_CACHE::LOAD_FAILED " << path << std::endl;
+			return;
+		}
+	}
+	std::vector<std::vector<unsigned char> > scene;
+	for (unsigned int i = 0; i < references; i++)
+	{
+		const std::vector<unsigned char> &file = files[i % files.size()];
+		// a handful of edited copies per image, each referenced again later
+		unsigned int copy = (i / (unsigned int)files.size()) % 4;
+		scene.push_back(copy % 2 ? withMetadata(file, "copy " + std::to_string(copy)) : file);
+	}
+
+	MipSettings settings;
+	size_t bytes[2];
+	double ms[2];
+	TextureCacheStats stats;
+	for (int cached = 0; cached < 2; cached++)
+	{
+		TextureCache cache(cached == 1);
+		std::vector<unsigned int> textures;
+		BenchmarkTimer timer;
+		for (size_t i = 0; i < scene.size(); i++)
+			textures.push_back(cache.acquire(&scene[i][0], scene[i].size(), "reference " + std::to_string(i), settings));
+		glFinish();
+		ms[cached] = timer.elapsedMs();
+		bytes[cached] = cache.bytes();
+		stats = cache.statistics();
+		for (unsigned int texture : textures)
+			cache.release(texture);
+		if (cache.textureCount() != 0)
+			std::cout << "ERROR::TEXTURE_CACHE::LEAKED " << cache.textureCount() << " textures" << std::endl;
+	}
+	printBenchmarkResult("TEXTURE_CACHE::UNCACHED", ms[0], "ms for " + std::to_string(references) + " references, " + std::to_string(bytes[0] / 1024) + " KiB VRAM");
+	printBenchmarkResult("TEXTURE_CACHE::CACHED", ms[1], "ms, " + std::to_string(bytes[1] / 1024) + " KiB VRAM in " + std::to_string(stats.decodes) + " decodes");
+	printBenchmarkResult("TEXTURE_CACHE::FILE_DUPLICATES", stats.fileDuplicates, "references");
+	printBenchmarkResult("TEXTURE_CACHE::PIXEL_DUPLICATES", stats.pixelDuplicates, "references");
+	printBenchmarkResult("TEXTURE_CACHE::VRAM_SAVED", stats.savedBytes / 1024.0, "KiB");
+	printBenchmarkResult("TEXTURE_CACHE::DECODE_AVOIDED", stats.savedDecodeMs, "ms, " + std::to_string(stats.hashMs) + " ms spent hashing");
+}
+#endif
@@ -0,0 +1,552 @@
+#ifndef TEXTURE_DISK_CACHE_H
+#define TEXTURE_DISK_CACHE_H
+
+#include <glad/glad.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <iostream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "texture.h"
+#include "textureCache.h"
+#include "lzCodec.h"
+#include "benchmark.h"
+
+// A cached chain: TextureDiskHeader, a packed byte count per stored level, the levels LZ
+// compressed in the chain's own layout, ready to upload once decompressed.
+struct TextureDiskHeader
+{
+	char magic[4];                    // "TXDC"
+	unsigned int version;
+	unsigned long long sourceSize;    // of the source file when it was cached
+	long long sourceTime;             // its modification time then
+	unsigned long long sourceHash;    // contentHash of its bytes
+	unsigned long long optionsHash;   // the decode options
+	int width;
+	int height;
+	unsigned int levels;              // stored, 1 when the mips are rebuilt on load
+	unsigned int internalFormat;
+	unsigned int format;
+	unsigned int type;
+	int channels;
+	int swizzle[4];
+};
+const unsigned int TEXTURE_DISK_CACHE_VERSION = 1;
+// largest width or height find() accepts, a damaged header must not size the level buffers
+const int TEXTURE_DISK_CACHE_MAX_SIZE = 16384;
+
+// what a TextureDiskCache did, since it was created
+struct DiskCacheStats
+{
+	unsigned int hits = 0;
+	unsigned int rehashed = 0;    // hits whose source had a new time but the same bytes
+	unsigned int misses = 0;
+	unsigned int stale = 0;       // entries dropped because their source changed
+	unsigned int writes = 0;
+	unsigned int pruned = 0;      // entries deleted for the size limit
+};
+
+namespace diskcache
+{
+	// a whole file mapped read only
+	class MappedFile
+	{
+	public:
+		const unsigned char *data = NULL;
+		size_t size = 0;
+
+		MappedFile() {}
+		MappedFile(const MappedFile&) = delete;
+		MappedFile &operator=(const MappedFile&) = delete;
+		~MappedFile()
+		{
+			close();
+		}
+		// ------------------------------------------------------------------------
+		bool open(const std::string &path)
+		{
+			close();
+#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			LARGE_INTEGER bytes;
+			if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &bytes) || bytes.QuadPart == 0)
+			{
+				close();
+				return false;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+			if (!view)
+			{
+				close();
+				return false;
+			}
+			data = (const unsigned char*)view;
+			size = (size_t)bytes.QuadPart;
+#else
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				return false;
+			struct stat info;
+			void *view = fstat(fd, &info) == 0 && info.st_size > 0 ? mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+			::close(fd);
+			if (view == MAP_FAILED)
+				return false;
+			data = (const unsigned char*)view;
+			size = (size_t)info.st_size;
+#endif
+			return true;
+		}
+		// ------------------------------------------------------------------------
+		void close()
+		{
+#ifdef _WIN32
+			if (data)
+				UnmapViewOfFile(data);
+			if (mapping)
+				CloseHandle(mapping);
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (data)
+				munmap((void*)data, size);
+#endif
+			data = NULL;
+			size = 0;
+		}
+
+	private:
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#endif
+	};
+
+	// ------------------------------------------------------------------------
+	inline bool fileStat(const std::string &path, unsigned long long &size, long long &time)
+	{
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return false;
+		size = (unsigned long long)info.st_size;
+		time = (long long)info.st_mtime;
+		return true;
+	}
+	inline void makeDirectory(const std::string &path)
+	{
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+	}
+	inline void removeDirectory(const std::string &path)
+	{
+#ifdef _WIN32
+		_rmdir(path.c_str());
+#else
+		rmdir(path.c_str());
+#endif
+	}
+	inline std::vector<unsigned char> readFile(const std::string &path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		return std::vector<unsigned char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	}
+}
+
+// Decoded mip chains kept on disk between runs, so a relaunch skips the JPEG / PNG decode
+// and the mip filtering. An entry is named after the source path and decode options and
+// is valid while the source has the size, modification time and content hash it had when
+// it was cached; a source with a new time is hashed again from the bytes the caller reads
+// to decode it anyway, a touched but unchanged file keeps its entry. Entries are memory mapped and decompressed straight into the chain.
+// Without storeMips only level 0 is kept and the mips are filtered again on load, a
+// quarter less disk for the filter time.
+//
+// The directory holds the entries and an index of their sizes and last use; past
+// limitBytes the least recently used entries are deleted. The cache is safe to use from
+// the loader threads.
+//
+//   TextureDiskCache diskCache("textureCache", 256 * 1024 * 1024);
+//   MipChain chain = diskCache.load(path, settings);
+class TextureDiskCache
+{
+public:
+	// flippedOnLoad mirrors stbi_set_flip_vertically_on_load, it changes the pixels too
+	TextureDiskCache(const std::string &directoryPath, size_t limitBytes = 256 * 1024 * 1024, bool storeMips = true, bool flippedOnLoad = false)
+		: directory(directoryPath), limit(limitBytes), mips(storeMips), flipped(flippedOnLoad)
+	{
+		diskcache::makeDirectory(directory);
+		std::ifstream index(directory + "/index");
+		std::string name;
+		Record record;
+		while (index >> name >> record.bytes >> record.lastUsed)
+		{
+			records[name] = record;
+			total += record.bytes;
+			clock = std::max(clock, record.lastUsed);
+		}
+	}
+	~TextureDiskCache()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		saveIndex();
+	}
+
+	// the chain of path decoded with settings, empty when it is not cached or its source
+	// changed since. The source is never read here: when it only has a new time the entry
+	// is checked against file (its bytes) if given, else retimed is set and the caller
+	// finds again with the bytes it reads anyway
+	// ------------------------------------------------------------------------
+	MipChain find(const std::string &path, const MipSettings &settings, const unsigned char *file = NULL, size_t fileSize = 0, bool *retimed = NULL)
+	{
+		if (retimed)
+			*retimed = false;
+		MipChain chain;
+		unsigned long long size;
+		long long time;
+		std::string name = entryName(path, settings);
+		diskcache::MappedFile entry;
+		if (!diskcache::fileStat(path, size, time) || !entry.open(directory + "/" + name))
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stats.misses++;
+			return chain;
+		}
+		TextureDiskHeader header;
+		bool valid = entry.size >= sizeof(header);
+		if (valid)
+		{
+			std::memcpy(&header, entry.data, sizeof(header));
+			valid = std::memcmp(header.magic, "TXDC", 4) == 0 && header.version == TEXTURE_DISK_CACHE_VERSION && header.optionsHash == optionsHash(settings)
+				&& header.sourceSize == size
+				&& header.width > 0 && header.width <= TEXTURE_DISK_CACHE_MAX_SIZE && header.height > 0 && header.height <= TEXTURE_DISK_CACHE_MAX_SIZE
+				&& (header.levels == 1 || header.levels == (unsigned int)mipLevelCount(header.width, header.height))
+				&& (header.channels == 1 || header.channels == 2 || header.channels == 4);
+		}
+		// a new time: the file may only have been touched or copied over with itself
+		bool touched = valid && header.sourceTime != time;
+		if (touched && !file)
+		{
+			entry.close();
+			if (retimed)
+				*retimed = true;
+			else
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stats.misses++;
+			}
+			return chain;
+		}
+		if (touched)
+			valid = fileSize == size && contentHash(file, fileSize) == header.sourceHash;
+		size_t offset = sizeof(header) + (valid ? header.levels * 4 : 0);
+		valid = valid && offset <= entry.size;
+		if (valid)
+		{
+			chain.width = header.width;
+			chain.height = header.height;
+			chain.format.internalFormat = header.internalFormat;
+			chain.format.format = header.format;
+			chain.format.type = header.type;
+			chain.format.channels = header.channels;
+			std::copy(header.swizzle, header.swizzle + 4, chain.format.swizzle);
+			for (unsigned int level = 0; level < header.levels && valid; level++)
+			{
+				unsigned int packed;
+				std::memcpy(&packed, entry.data + sizeof(header) + level * 4, 4);
+				chain.levels.push_back(std::vector<unsigned char>((size_t)chain.levelWidth((int)level) * chain.levelHeight((int)level) * chain.format.channels));
+				valid = packed <= entry.size - offset && lzDecompress(entry.data + offset, packed, &chain.levels.back()[0], chain.levels.back().size());
+				offset += packed;
+			}
+		}
+		entry.close();
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!valid)
+		{
+			// the source changed or the entry is damaged, it is written again after the decode
+			std::remove((directory + "/" + name).c_str());
+			forget(name);
+			stats.misses++;
+			stats.stale++;
+			return MipChain();
+		}
+		if (touched)
+		{
+			std::fstream out(directory + "/" + name, std::ios::binary | std::ios::in | std::ios::out);
+			out.seekp(offsetof(TextureDiskHeader, sourceTime));
+			out.write((const char*)&time, sizeof(time));
+			stats.rehashed++;
+		}
+		std::map<std::string, Record>::iterator record = records.find(name);
+		if (record != records.end())
+			record->second.lastUsed = ++clock;
+		stats.hits++;
+		if ((int)chain.levels.size() < mipLevelCount(chain.width, chain.height))
+			chain = rebuildMips(chain, settings);
+		return chain;
+	}
+	// cache chain, decoded with settings from the file bytes read from path
+	// ------------------------------------------------------------------------
+	void store(const std::string &path, const MipSettings &settings, const unsigned char *file, size_t size, const MipChain &chain)
+	{
+		if (chain.levels.empty() || compressedBlockBytes(chain.format.internalFormat)
+			|| chain.width > TEXTURE_DISK_CACHE_MAX_SIZE || chain.height > TEXTURE_DISK_CACHE_MAX_SIZE)
+			return;
+		TextureDiskHeader header = {};
+		std::memcpy(header.magic, "TXDC", 4);
+		header.version = TEXTURE_DISK_CACHE_VERSION;
+		if (!diskcache::fileStat(path, header.sourceSize, header.sourceTime) || header.sourceSize != size)
+			return;
+		header.sourceHash = contentHash(file, size);
+		header.optionsHash = optionsHash(settings);
+		header.width = chain.width;
+		header.height = chain.height;
+		header.levels = mips ? (unsigned int)chain.levels.size() : 1;
+		header.internalFormat = chain.format.internalFormat;
+		header.format = chain.format.format;
+		header.type = chain.format.type;
+		header.channels = chain.format.channels;
+		std::copy(chain.format.swizzle, chain.format.swizzle + 4, header.swizzle);
+		std::vector<std::vector<unsigned char> > packed;
+		size_t bytes = sizeof(header);
+		for (unsigned int level = 0; level < header.levels; level++)
+		{
+			packed.push_back(lzCompress(chain.levels[level]));
+			bytes += 4 + packed.back().size();
+		}
+
+		std::string name = entryName(path, settings);
+		std::string temporary;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			temporary = directory + "/" + name + "." + std::to_string(++writing);
+		}
+		// written aside and renamed, a crash never leaves half an entry under the real name
+		std::ofstream out(temporary, std::ios::binary);
+		out.write((const char*)&header, sizeof(header));
+		for (const std::vector<unsigned char> &level : packed)
+		{
+			unsigned int count = (unsigned int)level.size();
+			out.write((const char*)&count, 4);
+		}
+		for (const std::vector<unsigned char> &level : packed)
+			out.write((const char*)level.data(), level.size());
+		out.close();
+		std::lock_guard<std::mutex> lock(mutex);
+		std::remove((directory + "/" + name).c_str());
+		if (!out || std::rename(temporary.c_str(), (directory + "/" + name).c_str()) != 0)
+		{
+			std::cout << "ERROR::TEXTURE_DISK_CACHE::WRITE_FAILED " << name << std::endl;
+			std::remove(temporary.c_str());
+			forget(name);
+			return;
+		}
+		forget(name);
+		Record record = { bytes, ++clock };
+		records[name] = record;
+		total += bytes;
+		stats.writes++;
+		prune();
+		saveIndex();
+	}
+	// find(), or decode path and store it
+	// ------------------------------------------------------------------------
+	MipChain load(const std::string &path, const MipSettings &settings = MipSettings())
+	{
+		bool retimed;
+		MipChain chain = find(path, settings, NULL, 0, &retimed);
+		if (!chain.levels.empty())
+			return chain;
+		std::vector<unsigned char> file = diskcache::readFile(path);
+		if (file.empty())
+		{
+			std::cout << "ERROR::TEXTURE_DISK_CACHE::LOAD_FAILED " << path << std::endl;
+			return chain;
+		}
+		if (retimed)
+		{
+			chain = find(path, settings, &file[0], file.size());
+			if (!chain.levels.empty())
+				return chain;
+		}
+		chain = decodeMipChain(&file[0], file.size(), path, settings);
+		store(path, settings, &file[0], file.size(), chain);
+		return chain;
+	}
+
+	// delete every entry
+	// ------------------------------------------------------------------------
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (std::map<std::string, Record>::iterator it = records.begin(); it != records.end(); ++it)
+			std::remove((directory + "/" + it->first).c_str());
+		records.clear();
+		total = 0;
+		saveIndex();
+	}
+	// size on disk of every entry
+	// ------------------------------------------------------------------------
+	size_t bytes()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return total;
+	}
+	size_t entryCount()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return records.size();
+	}
+	DiskCacheStats statistics()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return stats;
+	}
+
+private:
+	struct Record
+	{
+		size_t bytes = 0;
+		unsigned long long lastUsed = 0;
+	};
+	std::string directory;
+	size_t limit;
+	bool mips;
+	bool flipped;
+	std::mutex mutex;
+	std::map<std::string, Record> records;   // by entry file name
+	size_t total = 0;
+	unsigned long long clock = 0;            // use counter, saved with the index
+	unsigned int writing = 0;
+	DiskCacheStats stats;
+
+	// ------------------------------------------------------------------------
+	unsigned long long optionsHash(const MipSettings &settings) const
+	{
+		unsigned int options[2] = { flipped ? 1u : 0u, mips ? 1u : 0u };
+		return contentHash(options, sizeof(options), mipSettingsHash(settings));
+	}
+	std::string entryName(const std::string &path, const MipSettings &settings) const
+	{
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", contentHash(path.data(), path.size(), optionsHash(settings)));
+		return name;
+	}
+	// level 0 filtered down again; stored pixels are in the chain's layout already, so the
+	// filter runs without the BGRA swap and the stored format is kept
+	// ------------------------------------------------------------------------
+	static MipChain rebuildMips(const MipChain &stored, const MipSettings &settings)
+	{
+		MipSettings layout = settings;
+		layout.bgra = false;
+		MipChain chain = buildMipChain(&stored.levels[0][0], stored.width, stored.height, stored.format.channels, layout);
+		chain.format = stored.format;
+		return chain;
+	}
+	// mutex held
+	// ------------------------------------------------------------------------
+	void forget(const std::string &name)
+	{
+		std::map<std::string, Record>::iterator record = records.find(name);
+		if (record == records.end())
+			return;
+		total -= record->second.bytes;
+		records.erase(record);
+	}
+	// delete least recently used entries until the cache fits its limit; mutex held
+	// ------------------------------------------------------------------------
+	void prune()
+	{
+		if (total <= limit)
+			return;
+		std::vector<std::pair<unsigned long long, std::string> > byUse;
+		for (std::map<std::string, Record>::iterator it = records.begin(); it != records.end(); ++it)
+			byUse.push_back(std::make_pair(it->second.lastUsed, it->first));
+		std::sort(byUse.begin(), byUse.end());
+		for (size_t i = 0; i < byUse.size() && total > limit; i++)
+		{
+			std::remove((directory + "/" + byUse[i].second).c_str());
+			forget(byUse[i].second);
+			stats.pruned++;
+		}
+	}
+	// mutex held
+	// ------------------------------------------------------------------------
+	void saveIndex()
+	{
+		std::ofstream index(directory + "/index");
+		for (std::map<std::string, Record>::iterator it = records.begin(); it != records.end(); ++it)
+			index << it->first << " " << it->second.bytes << " " << it->second.lastUsed << "\n";
+	}
+};
+
+// Load the images through an empty disk cache (cold, as on a first launch) and through a
+// second cache on the same directory (warm, as on the next launch), with and without the
+// mips stored; plain decodes for comparison. The directory is deleted afterwards.
+// ------------------------------------------------------------------------
+inline void benchmarkTextureDiskCache(const std::vector<std::string> &paths, unsigned int repeats)
+{
+	const char *directory = "benchmarkTextureCache";
+	MipSettings settings;
+	settings.filter = MIP_FILTER_KAISER;
+	settings.srgb = true;
+	BenchmarkTimer timer;
+	for (unsigned int r = 0; r < repeats; r++)
+		for (const std::string &path : paths)
+			loadMipChain(path, settings);
+	printBenchmarkResult("TEXTURE_DISK_CACHE::DECODE", timer.elapsedMs() / repeats, "ms for " + std::to_string(paths.size()) + " images");
+
+	for (int storeMips = 1; storeMips >= 0; storeMips--)
+	{
+		double coldMs = 0.0, warmMs = 0.0;
+		size_t bytes = 0;
+		for (unsigned int r = 0; r < repeats; r++)
+		{
+			{
+				TextureDiskCache cold(directory, 256 * 1024 * 1024, storeMips == 1);
+				timer.restart();
+				for (const std::string &path : paths)
+					cold.load(path, settings);
+				coldMs += timer.elapsedMs();
+				bytes = cold.bytes();
+			}
+			TextureDiskCache warm(directory, 256 * 1024 * 1024, storeMips == 1);
+			timer.restart();
+			for (const std::string &path : paths)
+				warm.load(path, settings);
+			warmMs += timer.elapsedMs();
+			if (warm.statistics().hits != paths.size())
+				std::cout << "ERROR::TEXTURE_DISK_CACHE::MISSED " << warm.statistics().misses << " warm loads" << std::endl;
+			warm.clear();
+		}
+		std::string name = storeMips ? "TEXTURE_DISK_CACHE::MIPS" : "TEXTURE_DISK_CACHE::LEVEL0";
+		printBenchmarkResult(name + "_COLD", coldMs / repeats, "ms");
+		printBenchmarkResult(name + "_WARM", warmMs / repeats, "ms, " + std::to_string(bytes / 1024) + " KiB on disk");
+	}
+	std::remove((std::string(directory) + "/index").c_str());
+	diskcache::removeDirectory(directory);
+}
+#endif
@@ -4,14 +4,84 @@
 out vec4 FragColor;
 
 in vec2 TexCoord;
+#ifdef VERTEX_COLOR
+in vec3 ourColor;
+#endif
 
-// texture samplers
+#if defined(VIRTUAL_TEXTURE)
+// pages of one large texture in a cache texture, see virtualTexture.h. pageTable has a
+// texel per page of every mip level: the cache slot (xy) and level (z) of the finest
+// resident page covering it, possibly an ancestor.
+#ifdef GL_SPIRV
+layout (binding = 0) uniform sampler2D pageCache;
+layout (binding = 1) uniform sampler2D pageTable;
+layout (location = 0) uniform vec4 virtualPages;
+layout (location = 1) uniform vec4 virtualCache;
+#else
+uniform sampler2D pageCache;
+uniform sampler2D pageTable;
+uniform vec4 virtualPages;  // xy: pages of level 0, z: mip levels, w: lod bias
+uniform vec4 virtualCache;  // x: page size, y: border, z: page size with borders, w: cache size in texels
+#endif
+#elif defined(TEXTURE_ARRAY)
+// every material is a layer of one array texture, see texturePacker.h
+flat in vec4 UvRect;
+flat in float Layer;
+#ifdef GL_SPIRV
+layout (binding = 0) uniform sampler2DArray textures;
+#else
+uniform sampler2DArray textures;
+#endif
+#else
+// texture samplers, SPIR-V modules fix the units the application would set
+#ifdef GL_SPIRV
+layout (binding = 0) uniform sampler2D texture1;
+#else
 uniform sampler2D texture1;
+#endif
+#ifndef SINGLE_TEXTURE
+#ifdef GL_SPIRV
+layout (binding = 1) uniform sampler2D texture2;
+#else
 uniform sampler2D texture2;
+#endif
+#endif
+#endif
 
+// Permutations (defines injected by ShaderPermutations):
+//   SINGLE_TEXTURE  only sample texture1
+//   VERTEX_COLOR    tint by the vertex color (the old textureRainbowFragment.fs)
+//   TEXTURE_ARRAY   sample the per-instance layer and atlas rectangle of textures
+//   VIRTUAL_TEXTURE sample the virtual texture through pageTable
+//   VIRTUAL_TEXTURE_FEEDBACK  with VIRTUAL_TEXTURE, write the page the fragment needs
+//                   instead: (x, y, level, 1) / 255, cleared to 0 where nothing is drawn
 void main()
 {
+#if defined(VIRTUAL_TEXTURE)
+	// the mip level from the texel footprint, one level per draw, no blending between levels
+	vec2 uv = clamp(TexCoord, 0.0, 0.99999);
+	vec2 texels = TexCoord * virtualPages.xy * virtualCache.x;
+	vec2 dx = dFdx(texels), dy = dFdy(texels);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + virtualPages.w;
+	float level = floor(clamp(lod, 0.0, virtualPages.z - 1.0));
+#ifdef VIRTUAL_TEXTURE_FEEDBACK
+	FragColor = vec4(floor(uv * max(virtualPages.xy / exp2(level), 1.0)), level, 1.0) / 255.0;
+#else
+	vec3 page = floor(texelFetch(pageTable, ivec2(uv * virtualPages.xy) >> int(level), int(level)).xyz * 255.0 + 0.5);
+	vec2 inPage = fract(uv * max(virtualPages.xy / exp2(page.z), 1.0)) * virtualCache.x;
+	FragColor = textureLod(pageCache, (page.xy * virtualCache.z + virtualCache.y + inPage) / virtualCache.w, 0.0);
+#endif
+#elif defined(TEXTURE_ARRAY)
+	FragColor = texture(textures, vec3(UvRect.xy + TexCoord * UvRect.zw, Layer));
+#elif defined(SINGLE_TEXTURE)
+	FragColor = texture(texture1, TexCoord);
+#else
 	// linearly interpolate between both textures (80% container, 20% awesomeface)
 	FragColor = mix(texture(texture1, TexCoord), texture(texture2, TexCoord), 0.2);
+#endif
+#ifdef VERTEX_COLOR
+	FragColor *= vec4(ourColor, 1.0);
+#endif
 }
 
+
@@ -0,0 +1,404 @@
+#ifndef TEXTURE_PACKER_H
+#define TEXTURE_PACKER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+
+#include "stb_image.h"
+#include "shaderProgram.h"
+#include "shaderPermutations.h"
+#include "benchmark.h"
+
+// Where a packed image ended up: a layer of an array texture, and the rectangle inside
+// that layer (offset xy, size zw in UV units), which is the whole layer unless the
+// image was packed into an atlas page
+struct PackedTexture
+{
+	unsigned int texture;
+	float layer;
+	glm::vec4 uvRect;
+};
+
+// Per instance vertex data for textureFragment.fs with TEXTURE_ARRAY
+struct TextureInstance
+{
+	glm::vec4 uvRect;
+	float layer;
+};
+
+// attributes 2 (aUvRect) and 3 (aLayer) of basicVertexShader.vs, advancing once per
+// instance, for the bound VAO and GL_ARRAY_BUFFER
+// ------------------------------------------------------------------------
+inline void setupTextureInstanceAttributes(size_t baseOffset = 0)
+{
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(TextureInstance), (void*)(baseOffset + offsetof(TextureInstance, uvRect)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribDivisor(2, 1);
+	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(TextureInstance), (void*)(baseOffset + offsetof(TextureInstance, layer)));
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+}
+
+// Packs many images into few textures so draws with different materials need no
+// rebinding. Images sharing a size become layers of one GL_TEXTURE_2D_ARRAY. The rest
+// are shelf packed into square atlas pages, themselves the layers of another array, so
+// the shader samples both the same way. Atlas rectangles are aligned to and padded by
+// 2^(atlasMipLevels - 1) texels with their edge texels repeated into the padding, and
+// the atlas mip chain stops at that level, so no mip level blends two images.
+// All images are stored RGBA8.
+class TexturePacker
+{
+public:
+	explicit TexturePacker(int atlasSize = 2048, int atlasMipLevels = 4) : atlasSize(atlasSize), atlasMipLevels(atlasMipLevels)
+	{
+		GLint maxSize = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+		if (maxSize > 0)
+			this->atlasSize = std::min(atlasSize, (int)maxSize);
+	}
+	~TexturePacker()
+	{
+		if (!textures.empty())
+			glDeleteTextures((GLsizei)textures.size(), &textures[0]);
+	}
+	TexturePacker(const TexturePacker&) = delete;
+	TexturePacker &operator=(const TexturePacker&) = delete;
+
+	// load an image through stb_image, returns its handle or -1
+	// ------------------------------------------------------------------------
+	int add(const std::string &path)
+	{
+		int width, height, channels;
+		unsigned char *data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+		if (!data)
+		{
+			std::cout << "ERROR::TEXTURE_PACKER::LOAD_FAILED " << path << std::endl;
+			return -1;
+		}
+		int handle = add(width, height, data);
+		stbi_image_free(data);
+		return handle;
+	}
+	// tightly packed RGBA8 pixels, copied
+	// ------------------------------------------------------------------------
+	int add(int width, int height, const unsigned char *rgba)
+	{
+		Image image;
+		image.width = width;
+		image.height = height;
+		image.pixels.assign(rgba, rgba + (size_t)width * height * 4);
+		images.push_back(image);
+		return (int)images.size() - 1;
+	}
+	// create the textures, get() is valid afterwards and the CPU copies are released
+	// ------------------------------------------------------------------------
+	void build()
+	{
+		placed.assign(images.size(), PackedTexture());
+		std::map<std::pair<int, int>, std::vector<int> > sizes;
+		for (size_t i = 0; i < images.size(); i++)
+			sizes[std::make_pair(images[i].width, images[i].height)].push_back((int)i);
+
+		const int padding = 1 << (atlasMipLevels - 1);
+		std::vector<int> atlased;
+		for (auto &size : sizes)
+		{
+			bool fitsAtlas = size.first.first + 2 * padding <= atlasSize && size.first.second + 2 * padding <= atlasSize;
+			if (size.second.size() >= 2 || !fitsAtlas)
+				buildArray(size.second);
+			else
+				atlased.push_back(size.second[0]);
+		}
+		if (!atlased.empty())
+			buildAtlas(atlased, padding);
+		for (Image &image : images)
+			std::vector<unsigned char>().swap(image.pixels);
+	}
+	// ------------------------------------------------------------------------
+	const PackedTexture &get(int handle) const
+	{
+		return placed[handle];
+	}
+	size_t textureCount() const
+	{
+		return textures.size();
+	}
+	// image texels over allocated level 0 texels
+	double packingEfficiency() const
+	{
+		return allocatedTexels ? (double)usedTexels / (double)allocatedTexels : 1.0;
+	}
+	// ------------------------------------------------------------------------
+	void printStats() const
+	{
+		std::cout << "TEXTURE_PACKER::" << images.size() << " images in " << textures.size() << " array textures ("
+		          << atlasPages << " atlas pages), packing efficiency " << packingEfficiency() * 100.0 << "%" << std::endl;
+	}
+
+private:
+	struct Image
+	{
+		int width, height;
+		std::vector<unsigned char> pixels;
+	};
+	std::vector<Image> images;
+	std::vector<PackedTexture> placed;
+	std::vector<unsigned int> textures;
+	int atlasSize;
+	int atlasMipLevels;
+	int atlasPages = 0;
+	unsigned long long usedTexels = 0;
+	unsigned long long allocatedTexels = 0;
+
+	// one layer per image, all of the same size, with a full mip chain
+	// ------------------------------------------------------------------------
+	void buildArray(const std::vector<int> &members)
+	{
+		int width = images[members[0]].width, height = images[members[0]].height;
+		unsigned int texture = createArray(width, height, (int)members.size());
+		for (size_t layer = 0; layer < members.size(); layer++)
+		{
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, &images[members[layer]].pixels[0]);
+			PackedTexture result = { texture, (float)layer, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f) };
+			placed[members[layer]] = result;
+		}
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		usedTexels += (unsigned long long)width * height * members.size();
+		allocatedTexels += (unsigned long long)width * height * members.size();
+	}
+	// shelf packing, tallest first: a row is as high as its first image
+	// ------------------------------------------------------------------------
+	void buildAtlas(std::vector<int> members, int padding)
+	{
+		std::sort(members.begin(), members.end(), [this](int a, int b) { return images[a].height > images[b].height; });
+		struct Placement { int image, page, x, y; };
+		std::vector<Placement> placements;
+		int page = 0, x = 0, y = 0, shelfHeight = 0;
+		for (int member : members)
+		{
+			// padded size, rounded up so the next rectangle starts aligned
+			int w = (images[member].width + 2 * padding + padding - 1) / padding * padding;
+			int h = (images[member].height + 2 * padding + padding - 1) / padding * padding;
+			if (x + w > atlasSize)
+			{
+				x = 0;
+				y += shelfHeight;
+				shelfHeight = 0;
+			}
+			if (y + h > atlasSize)
+			{
+				page++;
+				x = y = shelfHeight = 0;
+			}
+			Placement placement = { member, page, x + padding, y + padding };
+			placements.push_back(placement);
+			x += w;
+			shelfHeight = std::max(shelfHeight, h);
+		}
+		atlasPages = page + 1;
+
+		unsigned int texture = createArray(atlasSize, atlasSize, atlasPages);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, atlasMipLevels - 1);
+		std::vector<unsigned char> pixels((size_t)atlasSize * atlasSize * 4, 0);
+		for (int layer = 0; layer < atlasPages; layer++)
+		{
+			std::fill(pixels.begin(), pixels.end(), 0);
+			for (const Placement &placement : placements)
+			{
+				if (placement.page == layer)
+					blit(pixels, images[placement.image], placement.x, placement.y, padding);
+			}
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, atlasSize, atlasSize, 1, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		}
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		for (const Placement &placement : placements)
+		{
+			const Image &image = images[placement.image];
+			PackedTexture result = { texture, (float)placement.page, glm::vec4((float)placement.x / atlasSize, (float)placement.y / atlasSize,
+				(float)image.width / atlasSize, (float)image.height / atlasSize) };
+			placed[placement.image] = result;
+			usedTexels += (unsigned long long)image.width * image.height;
+		}
+		allocatedTexels += (unsigned long long)atlasSize * atlasSize * atlasPages;
+	}
+	// copy an image into a page and repeat its edge texels into the padding around it
+	// ------------------------------------------------------------------------
+	void blit(std::vector<unsigned char> &page, const Image &image, int left, int top, int padding) const
+	{
+		for (int y = -padding; y < image.height + padding; y++)
+		{
+			int sourceY = std::min(std::max(y, 0), image.height - 1);
+			for (int x = -padding; x < image.width + padding; x++)
+			{
+				int sourceX = std::min(std::max(x, 0), image.width - 1);
+				std::memcpy(&page[((size_t)(top + y) * atlasSize + left + x) * 4], &image.pixels[((size_t)sourceY * image.width + sourceX) * 4], 4);
+			}
+		}
+	}
+	// ------------------------------------------------------------------------
+	unsigned int createArray(int width, int height, int layers)
+	{
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		textures.push_back(texture);
+		return texture;
+	}
+};
+
+// A material set of the project's two textures plus procedurally generated images in
+// a few common sizes and many odd ones, drawn by objects sorted by material. Separate
+// 2D textures bind on every material change; the packed set binds each array once and
+// draws its objects instanced with the layer and rectangle in the vertex stream.
+// ------------------------------------------------------------------------
+inline void benchmarkTexturePacker(unsigned int materials, unsigned int objects, unsigned int frames)
+{
+	const char *files[2] = { ".\\resources\\texture\\container.jpg", ".\\resources\\texture\\awesomeface.jpg" };
+	std::vector<std::vector<unsigned char> > generated;
+	std::vector<glm::ivec2> sizes;
+	unsigned int seed = 12345;
+	for (unsigned int m = 2; m < materials; m++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		// most materials come in a few standard sizes, every fourth one is odd
+		int common[3] = { 64, 128, 256 };
+		glm::ivec2 size = (m % 4 != 0) ? glm::ivec2(common[seed % 3], common[seed % 3]) : glm::ivec2(24 + (seed >> 8) % 200, 24 + (seed >> 16) % 200);
+		std::vector<unsigned char> pixels((size_t)size.x * size.y * 4);
+		for (size_t i = 0; i < pixels.size(); i++)
+			pixels[i] = (unsigned char)((i * m) >> 4);
+		generated.push_back(pixels);
+		sizes.push_back(size);
+	}
+
+	// separate textures
+	std::vector<unsigned int> separate;
+	for (int f = 0; f < 2; f++)
+	{
+		int width, height, channels;
+		unsigned char *data = stbi_load(files[f], &width, &height, &channels, 4);
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, data ? width : 1, data ? height : 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		stbi_image_free(data);
+		separate.push_back(texture);
+	}
+	for (size_t g = 0; g < generated.size(); g++)
+	{
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, sizes[g].x, sizes[g].y, 0, GL_RGBA, GL_UNSIGNED_BYTE, &generated[g][0]);
+		separate.push_back(texture);
+	}
+
+	TexturePacker packer;
+	std::vector<int> handles;
+	for (int f = 0; f < 2; f++)
+		handles.push_back(packer.add(files[f]));
+	for (size_t g = 0; g < generated.size(); g++)
+		handles.push_back(packer.add(sizes[g].x, sizes[g].y, &generated[g][0]));
+	packer.build();
+
+	ShaderPermutations permutations;
+	permutations.declare("texture", "basicVertexShader.vs", "textureFragment.fs");
+	ShaderDefines single, packed;
+	single["SINGLE_TEXTURE"] = "1";
+	packed["TEXTURE_ARRAY"] = "1";
+	Shader &singleShader = permutations.get("texture", single);
+	Shader &packedShader = permutations.get("texture", packed);
+
+	// objects sorted by material, as a renderer would submit them
+	std::vector<unsigned int> objectMaterial(objects);
+	for (unsigned int o = 0; o < objects; o++)
+		objectMaterial[o] = (unsigned int)((unsigned long long)o * materials / objects);
+
+	unsigned int vao, instanceBuffer;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glGenBuffers(1, &instanceBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, objects * sizeof(TextureInstance), NULL, GL_STREAM_DRAW);
+	setupTextureInstanceAttributes();
+	glEnable(GL_RASTERIZER_DISCARD);
+	glActiveTexture(GL_TEXTURE0);
+
+	unsigned int separateBinds = 0;
+	singleShader.use();
+	BenchmarkTimer timer;
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		unsigned int bound = 0;
+		for (unsigned int o = 0; o < objects; o++)
+		{
+			if (separate[objectMaterial[o]] != bound)
+			{
+				bound = separate[objectMaterial[o]];
+				glBindTexture(GL_TEXTURE_2D, bound);
+				separateBinds++;
+			}
+			glDrawArrays(GL_POINTS, 0, 1);
+		}
+	}
+	glFinish();
+	double separateMs = timer.elapsedMs();
+
+	unsigned int packedBinds = 0;
+	packedShader.use();
+	timer.restart();
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		// group by array texture, the order inside a group no longer matters
+		std::map<unsigned int, std::vector<TextureInstance> > batches;
+		for (unsigned int o = 0; o < objects; o++)
+		{
+			const PackedTexture &texture = packer.get(handles[objectMaterial[o]]);
+			TextureInstance instance = { texture.uvRect, texture.layer };
+			batches[texture.texture].push_back(instance);
+		}
+		GLint first = 0;
+		std::vector<TextureInstance> stream;
+		for (auto &batch : batches)
+			stream.insert(stream.end(), batch.second.begin(), batch.second.end());
+		glBufferSubData(GL_ARRAY_BUFFER, 0, stream.size() * sizeof(TextureInstance), &stream[0]);
+		for (auto &batch : batches)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, batch.first);
+			packedBinds++;
+			// GL 3.3 has no base instance, so each batch gets its own attribute offset
+			setupTextureInstanceAttributes(first * sizeof(TextureInstance));
+			glDrawArraysInstanced(GL_POINTS, 0, 1, (GLsizei)batch.second.size());
+			first += (GLint)batch.second.size();
+		}
+	}
+	glFinish();
+	double packedMs = timer.elapsedMs();
+
+	printBenchmarkResult("TEXTURE_PACKER::SEPARATE_BINDS", (double)separateBinds / frames, "binds/frame");
+	printBenchmarkResult("TEXTURE_PACKER::PACKED_BINDS", (double)packedBinds / frames, "binds/frame");
+	printBenchmarkResult("TEXTURE_PACKER::SEPARATE_FRAME", separateMs / frames, "ms");
+	printBenchmarkResult("TEXTURE_PACKER::PACKED_FRAME", packedMs / frames, "ms");
+	printBenchmarkResult("TEXTURE_PACKER::PACKING_EFFICIENCY", packer.packingEfficiency() * 100.0, "%");
+	packer.printStats();
+
+	glDisable(GL_RASTERIZER_DISCARD);
+	glDeleteBuffers(1, &instanceBuffer);
+	glDeleteVertexArrays(1, &vao);
+	glDeleteTextures((GLsizei)separate.size(), &separate[0]);
+}
+#endif
@@ -0,0 +1,355 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "texture.h"
+#include "universalTexture.h"
+#include "lzCodec.h"
+#include "benchmark.h"
+
+// per frame numbers of a TextureResidency
+struct ResidencyStats
+{
+	size_t budgetBytes = 0;
+	size_t residentBytes = 0;     // video memory of every resident level
+	size_t ramBytes = 0;          // compressed level copies held in RAM
+	unsigned int evictions = 0;   // top levels dropped
+	unsigned int restores = 0;    // levels brought back
+	unsigned int reloads = 0;     // textures decoded from disk again to restore levels
+};
+
+// Keeps the textures it owns under a video memory budget. Memory is accounted per mip
+// level; when the resident levels exceed the budget, the top (largest) levels of the
+// least recently used textures are dropped, down to minResidentSize texels. Textures
+// used again get their levels back, as far as the budget allows, at the end of the frame.
+//
+// Dropping or restoring levels reallocates the texture's immutable storage, so the GL
+// name behind a handle changes; look it up through use() when binding, every frame.
+// With the compressed tier every level is kept LZ compressed in RAM and restored from
+// there, without it dropped levels are decoded from the texture's file again.
+//
+//   int handle = residency.add(path, settings, loadMipChain(path, settings));
+//   glBindTexture(GL_TEXTURE_2D, residency.use(handle));
+//   ...
+//   residency.endFrame();
+class TextureResidency
+{
+public:
+	TextureResidency(size_t budgetBytes, bool compressedTier = true, int minResidentSize = 64)
+		: budget(budgetBytes), compressed(compressedTier), minSize(minResidentSize)
+	{
+	}
+	~TextureResidency()
+	{
+		for (Entry &entry : entries)
+			entry.texture.release();
+	}
+	TextureResidency(const TextureResidency&) = delete;
+	TextureResidency &operator=(const TextureResidency&) = delete;
+
+	// takes over a chain decoded from path with settings, every level starts resident;
+	// the budget is enforced at the next endFrame()
+	// ------------------------------------------------------------------------
+	int add(const std::string &path, const MipSettings &settings, const MipChain &chain, const TextureSampling &sampling = TextureSampling())
+	{
+		if (chain.levels.empty())
+			return -1;
+		Entry entry;
+		entry.path = path;
+		entry.settings = settings;
+		entry.sampling = sampling;
+		entry.width = chain.width;
+		entry.height = chain.height;
+		entry.levels = (int)chain.levels.size();
+		entry.format = chain.format;
+		entry.wanted = entry.levels;
+		entry.texture = createTexture(chain);
+		entry.sampling.apply();
+		if (compressed)
+		{
+			for (const std::vector<unsigned char> &level : chain.levels)
+				entry.packed.push_back(lzCompress(level));
+		}
+		entries.push_back(entry);
+		return (int)entries.size() - 1;
+	}
+	// new pixels for handle, e.g. the refined image after a progressive preview; the chain
+	// may have another size, every level starts resident again
+	// ------------------------------------------------------------------------
+	void replace(int handle, const MipChain &chain)
+	{
+		if (handle < 0 || handle >= (int)entries.size() || chain.levels.empty())
+			return;
+		Entry &entry = entries[handle];
+		entry.texture.release();
+		entry.width = chain.width;
+		entry.height = chain.height;
+		entry.levels = (int)chain.levels.size();
+		entry.format = chain.format;
+		entry.top = 0;
+		entry.wanted = entry.levels;
+		entry.texture = createTexture(chain);
+		entry.sampling.apply();
+		entry.packed.clear();
+		if (compressed)
+		{
+			for (const std::vector<unsigned char> &level : chain.levels)
+				entry.packed.push_back(lzCompress(level));
+		}
+	}
+	// the texture's GL name for this frame; level is the finest level the draw needs
+	// ------------------------------------------------------------------------
+	unsigned int use(int handle, int level = 0)
+	{
+		if (handle < 0 || handle >= (int)entries.size())
+			return 0;
+		Entry &entry = entries[handle];
+		entry.lastUsed = frame;
+		entry.wanted = std::min(entry.wanted, std::max(level, 0));
+		return entry.texture.ID;
+	}
+	// restore the levels used this frame wants and evict down to the budget
+	// ------------------------------------------------------------------------
+	void endFrame()
+	{
+		// the top level each texture should end up with, used textures ask for theirs
+		std::vector<int> target(entries.size());
+		size_t resident = 0;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			Entry &entry = entries[i];
+			target[i] = entry.lastUsed == frame ? std::min(entry.top, entry.wanted) : entry.top;
+			resident += bytesFrom(entry, target[i]);
+		}
+		// drop one top level at a time: textures not used this frame, least recently used
+		// first, then restores of this frame that do not fit, then levels in use
+		while (resident > budget)
+		{
+			int victim = -1, victimRank = 0;
+			for (size_t i = 0; i < entries.size(); i++)
+			{
+				const Entry &entry = entries[i];
+				if (target[i] >= lowestTop(entry))
+					continue;
+				int rank = entry.lastUsed != frame ? 0 : target[i] < entry.top ? 1 : 2;
+				if (victim < 0 || rank < victimRank || (rank == victimRank && entry.lastUsed < entries[victim].lastUsed))
+				{
+					victim = (int)i;
+					victimRank = rank;
+				}
+			}
+			if (victim < 0)
+				break;
+			resident -= levelBytes(entries[victim], target[victim]);
+			target[victim]++;
+		}
+
+		stats = ResidencyStats();
+		stats.budgetBytes = budget;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			Entry &entry = entries[i];
+			int top = entry.top;
+			if (target[i] != entry.top && setTop(entry, target[i]))
+			{
+				if (target[i] > top)
+					stats.evictions += target[i] - top;
+				else
+					stats.restores += top - target[i];
+			}
+			entry.wanted = entry.levels;
+			stats.residentBytes += entry.texture.bytes();
+			for (const std::vector<unsigned char> &level : entry.packed)
+				stats.ramBytes += level.size();
+		}
+		frame++;
+	}
+	// ------------------------------------------------------------------------
+	void setBudget(size_t budgetBytes)
+	{
+		budget = budgetBytes;
+	}
+	// the finest level of handle in video memory
+	int residentLevel(int handle) const
+	{
+		return entries[handle].top;
+	}
+	// numbers of the last endFrame()
+	const ResidencyStats &frameStats() const
+	{
+		return stats;
+	}
+	// ------------------------------------------------------------------------
+	void printStats() const
+	{
+		std::cout << "TEXTURE_RESIDENCY::FRAME " << frame << ": " << stats.residentBytes / 1024 << " of " << stats.budgetBytes / 1024
+			<< " KiB resident, " << stats.ramBytes / 1024 << " KiB compressed in RAM, " << stats.evictions << " levels evicted, "
+			<< stats.restores << " restored, " << stats.reloads << " textures reloaded" << std::endl;
+	}
+
+private:
+	struct Entry
+	{
+		std::string path;
+		MipSettings settings;
+		TextureSampling sampling;
+		Texture texture;          // levels top .. levels - 1
+		TextureFormat format;
+		int width = 0;            // of level 0
+		int height = 0;
+		int levels = 0;
+		int top = 0;              // finest resident level
+		int wanted = 0;           // finest level asked for by use() this frame
+		unsigned long long lastUsed = 0;
+		std::vector<std::vector<unsigned char> > packed;  // compressed tier, every level
+	};
+	std::vector<Entry> entries;
+	size_t budget;
+	bool compressed;
+	int minSize;
+	unsigned long long frame = 1;
+	ResidencyStats stats;
+
+	// ------------------------------------------------------------------------
+	static size_t levelBytes(const Entry &entry, int level)
+	{
+		return textureLevelBytes(entry.format.internalFormat, std::max(1, entry.width >> level), std::max(1, entry.height >> level));
+	}
+	static size_t bytesFrom(const Entry &entry, int top)
+	{
+		size_t total = 0;
+		for (int level = top; level < entry.levels; level++)
+			total += levelBytes(entry, level);
+		return total;
+	}
+	// coarsest top level eviction may go to, textures smaller than minSize are never cut
+	int lowestTop(const Entry &entry) const
+	{
+		int top = 0;
+		while (top + 1 < entry.levels && std::max(entry.width >> (top + 1), entry.height >> (top + 1)) >= minSize)
+			top++;
+		return top;
+	}
+	// reallocate storage for levels top .. levels - 1 and fill it from the compressed copies,
+	// from the old storage or from the file; false keeps the old storage
+	// ------------------------------------------------------------------------
+	bool setTop(Entry &entry, int top)
+	{
+		Texture next;
+		next.allocate(std::max(1, entry.width >> top), std::max(1, entry.height >> top), entry.levels - top, entry.format);
+		entry.sampling.apply();
+
+		MipChain reloaded;
+		std::vector<unsigned char> pixels;
+		for (int level = top; level < entry.levels; level++)
+		{
+			int w = std::max(1, entry.width >> level);
+			pixels.resize(levelBytes(entry, level));
+			bool filled = false;
+			if (compressed)
+			{
+				const std::vector<unsigned char> &packed = entry.packed[level];
+				filled = lzDecompress(packed.empty() ? NULL : &packed[0], packed.size(), &pixels[0], pixels.size());
+				if (!filled)
+					std::cout << "ERROR::TEXTURE_RESIDENCY::CORRUPT_LEVEL " << level << " of " << entry.path << std::endl;
+			}
+			if (!filled && level >= entry.top)
+			{
+				// still resident, read it back instead of touching the disk
+				glBindTexture(GL_TEXTURE_2D, entry.texture.ID);
+				if (compressedBlockBytes(entry.format.internalFormat))
+					glGetCompressedTexImage(GL_TEXTURE_2D, level - entry.top, &pixels[0]);
+				else
+				{
+					GLint packAlignment;
+					glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+					glPixelStorei(GL_PACK_ALIGNMENT, unpackAlignment((size_t)w * entry.format.channels));
+					glGetTexImage(GL_TEXTURE_2D, level - entry.top, entry.format.format, entry.format.type, &pixels[0]);
+					glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+				}
+			}
+			else if (!filled && compressed)
+			{
+				// a damaged copy of a level that is not resident, the texture stays as it is
+				next.release();
+				return false;
+			}
+			else if (!filled)
+			{
+				if (reloaded.levels.empty())
+				{
+					if (isUniversalTexturePath(entry.path))
+						reloaded = loadUniversalTexture(entry.path, universalTargetOf(entry.format));
+					else
+						reloaded = loadMipChain(entry.path, entry.settings);
+					stats.reloads++;
+				}
+				if ((int)reloaded.levels.size() != entry.levels)
+				{
+					std::cout << "ERROR::TEXTURE_RESIDENCY::RELOAD_MISMATCH " << entry.path << std::endl;
+					next.release();
+					return false;
+				}
+				pixels = reloaded.levels[level];
+			}
+			next.uploadLevel(level - top, &pixels[0]);
+		}
+		entry.texture.release();
+		entry.texture = next;
+		entry.top = top;
+		return true;
+	}
+};
+
+// textureCount textures cycled through the container and awesomeface images, a window
+// of visible textures slides over them by one texture a frame, under a budget that holds
+// about a third of them at full resolution. Run with and without the compressed tier.
+// ------------------------------------------------------------------------
+inline void benchmarkTextureResidency(unsigned int textureCount, unsigned int visible, unsigned int frames)
+{
+	const char *paths[2] = { ".\\resources\\texture\\container.jpg", ".\\resources\\texture\\awesomeface.jpg" };
+	MipSettings settings;
+	MipChain chains[2] = { loadMipChain(paths[0], settings), loadMipChain(paths[1], settings) };
+	if (chains[0].levels.empty() || chains[1].levels.empty())
+		return;
+	Texture probe = createTexture(chains[0]);
+	size_t budget = probe.bytes() * textureCount / 3;
+	probe.release();
+
+	for (int tier = 1; tier >= 0; tier--)
+	{
+		TextureResidency residency(budget, tier == 1);
+		std::vector<int> handles;
+		for (unsigned int i = 0; i < textureCount; i++)
+			handles.push_back(residency.add(paths[i % 2], settings, chains[i % 2]));
+		residency.endFrame();
+
+		BenchmarkTimer timer;
+		unsigned int evictions = 0, restores = 0, reloads = 0;
+		size_t peak = 0;
+		for (unsigned int frame = 0; frame < frames; frame++)
+		{
+			for (unsigned int v = 0; v < visible; v++)
+				glBindTexture(GL_TEXTURE_2D, residency.use(handles[(frame + v) % textureCount]));
+			residency.endFrame();
+			const ResidencyStats &stats = residency.frameStats();
+			evictions += stats.evictions;
+			restores += stats.restores;
+			reloads += stats.reloads;
+			peak = std::max(peak, stats.residentBytes);
+		}
+		glFinish();
+		std::string name = tier ? "TEXTURE_RESIDENCY::COMPRESSED_TIER" : "TEXTURE_RESIDENCY::DISK_RELOAD";
+		printBenchmarkResult(name, timer.elapsedMs() / frames, "ms/frame");
+		printBenchmarkResult(name + "_EVICTIONS", (double)evictions / frames, "levels/frame");
+		printBenchmarkResult(name + "_RESTORES", (double)restores / frames, "levels/frame, " + std::to_string(reloads) + " file reloads");
+		printBenchmarkResult(name + "_PEAK", peak / 1024.0, "KiB of " + std::to_string(budget / 1024) + " budget, "
+			+ std::to_string(residency.frameStats().ramBytes / 1024) + " KiB in RAM");
+	}
+}
+#endif
@@ -0,0 +1,587 @@
+#ifndef TEXTURE_SCHEDULER_H
+#define TEXTURE_SCHEDULER_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <condition_variable>
+
+#include "texture.h"
+#include "textureResidency.h"
+#include "universalTexture.h"
+#include "textureCache.h"
+#include "textureDiskCache.h"
+#include "benchmark.h"
+
+// the camera as the scheduler sees it
+struct TextureView
+{
+	glm::vec3 position;
+	glm::vec3 forward;         // normalized
+	float fovY;                // radians
+	float aspect;
+	float viewportHeight;      // pixels
+};
+
+// the scheduler's view of the camera that view and a perspective projection describe
+// ------------------------------------------------------------------------
+inline TextureView makeTextureView(const glm::mat4 &view, const glm::mat4 &projection, int viewportHeight)
+{
+	glm::mat4 camera = glm::inverse(view);
+	TextureView textureView;
+	textureView.position = glm::vec3(camera[3]);
+	textureView.forward = glm::normalize(-glm::vec3(camera[2]));
+	textureView.fovY = 2.0f * std::atan(1.0f / projection[1][1]);
+	textureView.aspect = projection[1][1] / projection[0][0];
+	textureView.viewportHeight = (float)viewportHeight;
+	return textureView;
+}
+
+// Loads textures on worker threads in the order the screen needs them. Each request
+// carries the world bounds of what it is drawn on; every update() projects the bounds
+// with the camera into an on-screen size, from which the finest mip level the texture
+// needs follows, and the request's priority is the texel count of that level (nothing
+// for requests outside the view). Workers always take the highest priority request.
+//
+// Files are read in chunks through a shared token bucket, so loading keeps to an I/O
+// bandwidth cap like a disc or a network drive would impose. Between chunks a worker
+// gives its request back to the queue, keeping what it read, when a request at least
+// twice as important is waiting. The camera's motion is extrapolated prefetchSeconds
+// ahead and what the camera is about to see is scheduled before it is on screen.
+// Finished chains are handed to a TextureResidency in update(), on the GL thread.
+// Progressive JPEGs are handed over early as well, blurry after their first scans and
+// refined as the decode goes on; a texture is only sharp() once its final chain is in.
+// Cooked .utex files are transcoded into the block format the context samples.
+// Requests whose files hash the same, or decode to the same pixels, share one texture.
+// With a disk cache, chains decoded in an earlier run are read from it instead.
+//
+//   int request = scheduler.request(path, boundsMin, boundsMax);
+//   scheduler.update(view, deltaTime);                                  // every frame
+//   glBindTexture(GL_TEXTURE_2D, residency.use(scheduler.handle(request)));
+class TextureScheduler
+{
+public:
+	// 0 bytesPerSecond is no cap; prioritize false loads in request order, for comparison
+	TextureScheduler(TextureResidency *textureResidency, double bytesPerSecond = 0.0, unsigned int workerCount = 2, bool prioritize = true)
+		: residency(textureResidency), bandwidth(bytesPerSecond), byPriority(prioritize), target(universalTarget()), preemptions(0), readBytes(0)
+	{
+		ioNext = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < workerCount; i++)
+			workers.push_back(std::thread(&TextureScheduler::work, this));
+	}
+	~TextureScheduler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+
+	// a texture drawn on an object within the bounds; sizeHint is the texture's larger
+	// side, used for the mip estimate until the file header has been read
+	// ------------------------------------------------------------------------
+	int request(const std::string &path, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const MipSettings &settings = MipSettings(), int sizeHint = 512)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		Job job;
+		job.path = path;
+		job.settings = settings;
+		job.size = sizeHint;
+		jobs.push_back(job);
+		setBounds(jobs.back(), boundsMin, boundsMax);
+		queued++;
+		wake.notify_one();
+		return (int)jobs.size() - 1;
+	}
+	// ------------------------------------------------------------------------
+	void moveObject(int request, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		setBounds(jobs[request], boundsMin, boundsMax);
+	}
+	// reprioritize from the camera and hand finished textures to the residency manager
+	// ------------------------------------------------------------------------
+	void update(const TextureView &view, float deltaTime)
+	{
+		// camera motion, smoothed over a few frames
+		if (hasView && deltaTime > 0.0f)
+		{
+			float blend = std::min(1.0f, deltaTime * 8.0f);
+			velocity = velocity * (1.0f - blend) + (view.position - lastView.position) / deltaTime * blend;
+			turn = turn * (1.0f - blend) + (view.forward - lastView.forward) / deltaTime * blend;
+		}
+		lastView = view;
+		hasView = true;
+		TextureView ahead = view;
+		ahead.position = view.position + velocity * prefetchSeconds;
+		ahead.forward = glm::normalize(view.forward + turn * prefetchSeconds);
+
+		std::vector<size_t> finished, previewed;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < jobs.size(); i++)
+			{
+				Job &job = jobs[i];
+				float pixels = projectedPixels(view, job.center, job.radius);
+				job.visible = pixels > 0.0f;
+				job.level = levelFor(job.size, pixels);
+				job.priority = job.visible ? texels(job.size, job.level) : 0.0f;
+				// about to be seen, half weight so what is on screen now still goes first
+				float aheadPixels = projectedPixels(ahead, job.center, job.radius);
+				if (aheadPixels > 0.0f)
+					job.priority = std::max(job.priority, 0.5f * texels(job.size, levelFor(job.size, aheadPixels)));
+				if (job.state == DECODED)
+					finished.push_back(i);
+				else if (job.previewReady)
+					previewed.push_back(i);
+			}
+		}
+		wake.notify_all();
+		// uploads happen here, the chains are no longer touched by the workers
+		for (size_t i : previewed)
+		{
+			Job &job = jobs[i];
+			MipChain preview;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				preview = std::move(job.preview);
+				job.preview = MipChain();
+				job.previewReady = false;
+			}
+			show(job, preview);
+			previews++;
+		}
+		for (size_t i : finished)
+		{
+			Job &job = jobs[i];
+			if (!job.same && job.handle < 0 && !job.chain.levels.empty())
+			{
+				std::map<TextureKey, Job*>::iterator found = pixelOwners.find(job.pixelKey);
+				if (found != pixelOwners.end())
+					job.same = found->second;
+				else if (deduplicate)
+					pixelOwners[job.pixelKey] = &job;
+			}
+			if (job.same)
+			{
+				// drawn with the other request's texture, blurry until it is complete
+				job.handle = job.same->handle;
+				if (!job.same->complete)
+					continue;
+				duplicates++;
+			}
+			else
+				show(job, job.chain);
+			job.chain = MipChain();
+			job.complete = true;
+			std::lock_guard<std::mutex> lock(mutex);
+			job.state = RESIDENT;
+			job.preview = MipChain();
+			job.previewReady = false;
+			if (!job.visible)
+				prefetched++;
+		}
+	}
+	// residency handle of request, -1 while it loads
+	// ------------------------------------------------------------------------
+	int handle(int request) const
+	{
+		return jobs[request].handle;
+	}
+	// finest level request needs for the current view
+	int requiredLevel(int request) const
+	{
+		return jobs[request].level;
+	}
+	// on screen in the current view
+	bool visible(int request) const
+	{
+		return jobs[request].visible;
+	}
+	// loaded, with at least the level the view needs resident
+	bool sharp(int request) const
+	{
+		const Job &job = jobs[request];
+		return job.complete && job.handle >= 0 && residency->residentLevel(job.handle) <= job.level;
+	}
+	// every texture in view can be drawn, if only from a preview
+	bool allVisibleShown() const
+	{
+		for (const Job &job : jobs)
+			if (job.visible && job.handle < 0)
+				return false;
+		return true;
+	}
+	// every texture in view is sharp
+	bool allVisibleSharp() const
+	{
+		for (size_t i = 0; i < jobs.size(); i++)
+			if (jobs[i].visible && !sharp((int)i))
+				return false;
+		return true;
+	}
+	// ------------------------------------------------------------------------
+	unsigned int pendingCount() const
+	{
+		unsigned int pending = 0;
+		for (const Job &job : jobs)
+			pending += job.complete ? 0 : 1;
+		return pending;
+	}
+	// requests drawn with the texture of another request with the same contents
+	unsigned int duplicateCount() const
+	{
+		return duplicates;
+	}
+	// progressive previews uploaded before their final chains
+	unsigned int previewCount() const
+	{
+		return previews;
+	}
+	// reads handed back to the queue for a more important request
+	unsigned int preemptionCount() const
+	{
+		return preemptions;
+	}
+	// textures that finished loading before they were on screen
+	unsigned int prefetchCount() const
+	{
+		return prefetched;
+	}
+	size_t bytesRead() const
+	{
+		return readBytes;
+	}
+
+	float prefetchSeconds = 0.5f;
+	size_t chunkBytes = 16 * 1024;
+	bool progressive = true;       // upload previews of progressive JPEGs while they decode
+	bool deduplicate = true;       // share textures between requests with the same contents
+	TextureDiskCache *diskCache = NULL;   // decoded chains kept between runs, optional
+
+private:
+	enum State { QUEUED, READING, DECODED, RESIDENT };
+	struct Job
+	{
+		std::string path;
+		MipSettings settings;
+		glm::vec3 center;
+		float radius = 0.0f;
+		int size = 0;                  // larger side of level 0
+		int level = 0;                 // finest level the view needs
+		bool visible = false;
+		float priority = 0.0f;
+		State state = QUEUED;
+		std::vector<unsigned char> file;   // read so far
+		MipChain chain;
+		MipChain preview;              // latest preview not uploaded yet
+		bool previewReady = false;
+		bool complete = false;         // the final chain is in the residency
+		int handle = -1;
+		TextureKey pixelKey;
+		Job *same = NULL;              // the request whose texture this one shares
+		bool cacheRetimed = false;     // its disk cache entry waits for the file's bytes
+	};
+	// a deque so workers keep their reference while requests are added
+	std::deque<Job> jobs;
+	TextureResidency *residency;
+	double bandwidth;
+	bool byPriority;
+	UniversalTarget target;        // cooked textures are transcoded into, chosen on the GL thread
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	unsigned int queued = 0;
+	bool stopping = false;
+	std::mutex ioMutex;
+	std::chrono::steady_clock::time_point ioNext;
+	TextureView lastView;
+	bool hasView = false;
+	glm::vec3 velocity = glm::vec3(0.0f);
+	glm::vec3 turn = glm::vec3(0.0f);
+	std::atomic<unsigned int> preemptions;
+	unsigned int prefetched = 0;
+	unsigned int previews = 0;
+	unsigned int duplicates = 0;
+	std::map<TextureKey, Job*> fileOwners;    // by file contents, filled by the workers
+	std::map<TextureKey, Job*> pixelOwners;   // by decoded pixels, filled on the GL thread
+	std::atomic<size_t> readBytes;
+
+	// ------------------------------------------------------------------------
+	void show(Job &job, const MipChain &chain)
+	{
+		if (chain.levels.empty())
+			return;
+		if (job.handle < 0)
+			job.handle = residency->add(job.path, job.settings, chain);
+		else
+			residency->replace(job.handle, chain);
+	}
+	// ------------------------------------------------------------------------
+	static void setBounds(Job &job, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+	{
+		job.center = (boundsMin + boundsMax) * 0.5f;
+		job.radius = glm::length(boundsMax - boundsMin) * 0.5f;
+	}
+	// on-screen diameter in pixels of a bounding sphere, 0 outside the view; the view
+	// is treated as a cone around the screen diagonal, an estimate on the generous side
+	// ------------------------------------------------------------------------
+	static float projectedPixels(const TextureView &view, const glm::vec3 &center, float radius)
+	{
+		glm::vec3 toCenter = center - view.position;
+		float distance = glm::length(toCenter);
+		if (distance <= radius)
+			return view.viewportHeight;
+		float tanHalf = std::tan(view.fovY * 0.5f);
+		float halfDiagonal = std::atan(tanHalf * std::sqrt(1.0f + view.aspect * view.aspect));
+		float angle = std::acos(std::max(-1.0f, std::min(1.0f, glm::dot(toCenter, view.forward) / distance)));
+		if (angle - std::asin(radius / distance) > halfDiagonal)
+			return 0.0f;
+		return std::min(view.viewportHeight, radius / (distance * tanHalf) * view.viewportHeight);
+	}
+	// ------------------------------------------------------------------------
+	static int levelFor(int size, float pixels)
+	{
+		int level = 0;
+		while ((size >> (level + 1)) >= pixels && (size >> (level + 1)) > 0)
+			level++;
+		return level;
+	}
+	static float texels(int size, int level)
+	{
+		float side = (float)std::max(1, size >> level);
+		return side * side;
+	}
+	// highest priority queued job, requests in order break ties; mutex held
+	// ------------------------------------------------------------------------
+	Job *next()
+	{
+		Job *best = NULL;
+		for (Job &job : jobs)
+		{
+			if (job.state != QUEUED)
+				continue;
+			if (!byPriority)
+				return &job;
+			if (!best || job.priority > best->priority)
+				best = &job;
+		}
+		return best;
+	}
+	// wait for the bandwidth cap to allow another bytes
+	// ------------------------------------------------------------------------
+	void throttle(size_t bytes)
+	{
+		if (bandwidth <= 0.0)
+			return;
+		std::chrono::steady_clock::time_point done;
+		{
+			std::lock_guard<std::mutex> lock(ioMutex);
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (ioNext < now)
+				ioNext = now;
+			ioNext += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(bytes / bandwidth));
+			done = ioNext;
+		}
+		std::this_thread::sleep_until(done);
+	}
+	// ------------------------------------------------------------------------
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			Job *job = NULL;
+			wake.wait(lock, [&]() { return stopping || (queued > 0 && (job = next()) != NULL); });
+			if (stopping)
+				return;
+			job->state = READING;
+			queued--;
+			std::string path = job->path;
+			size_t offset = job->file.size();
+			lock.unlock();
+
+			// a chain from the disk cache replaces the read and the decode, lock is held after
+			auto takeCached = [&](MipChain &cached)
+			{
+				TextureKey pixelKey = deduplicate ? pixelTextureKey(cached, job->settings) : TextureKey();
+				lock.lock();
+				job->size = std::max(cached.width, cached.height);
+				job->chain = std::move(cached);
+				job->pixelKey = pixelKey;
+				job->file = std::vector<unsigned char>();
+				job->state = DECODED;
+			};
+			MipChain cached;
+			if (diskCache && offset == 0 && !isUniversalTexturePath(path))
+				cached = diskCache->find(path, job->settings, NULL, 0, &job->cacheRetimed);
+			if (!cached.levels.empty())
+			{
+				takeCached(cached);
+				continue;
+			}
+
+			// read the rest of the file chunk by chunk, yielding to more important requests
+			std::ifstream file(path, std::ios::binary);
+			file.seekg(0, std::ios::end);
+			size_t size = file.good() ? (size_t)file.tellg() : 0;
+			file.seekg(offset);
+			bool preempted = false;
+			std::vector<unsigned char> chunk(chunkBytes);
+			while (offset < size)
+			{
+				size_t count = std::min(chunkBytes, size - offset);
+				throttle(count);
+				file.read((char*)&chunk[0], count);
+				offset += count;
+
+				lock.lock();
+				job->file.insert(job->file.end(), chunk.begin(), chunk.begin() + count);
+				readBytes += count;
+				Job *waiting = byPriority && offset < size ? next() : NULL;
+				if (waiting && waiting->priority > 2.0f * job->priority)
+				{
+					job->state = QUEUED;
+					queued++;
+					preemptions++;
+					preempted = true;
+				}
+				lock.unlock();
+				if (preempted)
+					break;
+			}
+			// a source with a new time is checked against its cache entry with the bytes
+			// just read, under the same throttle and preemption as any other read
+			if (!preempted && job->cacheRetimed && size > 0)
+			{
+				cached = diskCache->find(path, job->settings, &job->file[0], job->file.size());
+				if (!cached.levels.empty())
+				{
+					takeCached(cached);
+					continue;
+				}
+			}
+			Job *same = NULL;
+			TextureKey fileKey;
+			if (!preempted && deduplicate && size > 0)
+			{
+				fileKey = fileTextureKey(&job->file[0], job->file.size(), job->settings);
+				lock.lock();
+				std::map<TextureKey, Job*>::iterator found = fileOwners.find(fileKey);
+				if (found == fileOwners.end())
+					fileOwners[fileKey] = job;
+				else
+				{
+					same = found->second;
+					job->same = same;
+					job->file = std::vector<unsigned char>();
+					job->state = DECODED;
+				}
+				lock.unlock();
+			}
+			if (!preempted && !same)
+			{
+				MipChain chain;
+				// a preview waiting for the GL thread is replaced by a newer one
+				MipPreviewCallback preview = [&](MipChain &next)
+				{
+					std::lock_guard<std::mutex> previewLock(mutex);
+					job->preview = std::move(next);
+					job->previewReady = true;
+					return !stopping;
+				};
+				if (size > 0 && isUniversalTexture(job->file.data(), job->file.size()))
+					chain = decodeUniversalTexture(&job->file[0], job->file.size(), path, target);
+				else if (size > 0 && !job->file.empty() && progressive)
+					chain = decodeMipChainProgressive(&job->file[0], job->file.size(), path, job->settings, preview);
+				else if (size > 0 && !job->file.empty())
+					chain = decodeMipChain(&job->file[0], job->file.size(), path, job->settings);
+				else
+					std::cout << "ERROR::TEXTURE_SCHEDULER::READ_FAILED " << path << std::endl;
+				if (diskCache && !chain.levels.empty() && !isUniversalTexture(job->file.data(), job->file.size()))
+					diskCache->store(path, job->settings, &job->file[0], job->file.size(), chain);
+				TextureKey pixelKey = deduplicate ? pixelTextureKey(chain, job->settings) : TextureKey();
+				lock.lock();
+				job->chain = chain;
+				job->pixelKey = pixelKey;
+				job->file = std::vector<unsigned char>();
+				// the real size replaces the hint for the mip estimate
+				if (!chain.levels.empty())
+					job->size = std::max(chain.width, chain.height);
+				job->state = DECODED;
+				lock.unlock();
+			}
+			lock.lock();
+		}
+	}
+};
+
+// A grid of gridSize x gridSize textured boxes, every box with its own texture request,
+// seen by a camera panning across the grid from its middle. Textures are read through a bandwidthMBs cap,
+// once in request order and once by screen priority with prefetch; reported is the time
+// until every box in view is drawn at the mip level it needs.
+// ------------------------------------------------------------------------
+inline void benchmarkTextureScheduler(unsigned int gridSize, double bandwidthMBs)
+{
+	const char *paths[2] = { ".\\resources\\texture\\container.jpg", ".\\resources\\texture\\awesomeface.jpg" };
+	for (int prioritize = 0; prioritize < 2; prioritize++)
+	{
+		TextureResidency residency(96 * 1024 * 1024, false);
+		TextureScheduler scheduler(&residency, bandwidthMBs * 1024.0 * 1024.0, 2, prioritize == 1);
+		// the two images stand in for a grid of different textures
+		scheduler.deduplicate = false;
+		for (unsigned int z = 0; z < gridSize; z++)
+		{
+			for (unsigned int x = 0; x < gridSize; x++)
+			{
+				glm::vec3 center((float)x * 3.0f, 0.0f, (float)z * 3.0f);
+				scheduler.request(paths[(x + z) % 2], center - glm::vec3(0.5f), center + glm::vec3(0.5f));
+			}
+		}
+		// from the middle of the grid looking out along x, a fifth of the boxes are in view
+		float middle = gridSize * 1.5f;
+		TextureView view = { glm::vec3(middle, 2.0f, middle), glm::normalize(glm::vec3(1.0f, -0.1f, 0.0f)), glm::radians(45.0f), 800.0f / 600.0f, 600.0f };
+		BenchmarkTimer timer;
+		double lastMs = 0.0, shownMs = -1.0, sharpMs = -1.0;
+		while (timer.elapsedMs() < 60000.0 && scheduler.pendingCount() > 0)
+		{
+			double nowMs = timer.elapsedMs();
+			float deltaTime = (float)(nowMs - lastMs) / 1000.0f;
+			lastMs = nowMs;
+			// pan sideways at a box every two seconds
+			view.position.z = middle + (float)(nowMs / 1000.0) * 1.5f;
+			scheduler.update(view, deltaTime);
+			// draw what is in view, at the level each box needs
+			for (unsigned int i = 0; i < gridSize * gridSize; i++)
+				if (scheduler.handle(i) >= 0 && scheduler.visible(i))
+					glBindTexture(GL_TEXTURE_2D, residency.use(scheduler.handle(i), scheduler.requiredLevel(i)));
+			residency.endFrame();
+			if (shownMs < 0.0 && scheduler.allVisibleShown())
+				shownMs = nowMs;
+			if (sharpMs < 0.0 && scheduler.allVisibleSharp())
+				sharpMs = nowMs;
+			std::this_thread::sleep_for(std::chrono::milliseconds(16));
+		}
+		glFinish();
+		std::string name = prioritize ? "TEXTURE_SCHEDULER::PRIORITY" : "TEXTURE_SCHEDULER::REQUEST_ORDER";
+		printBenchmarkResult(name + "_FIRST_COMPLETE_FRAME", shownMs, "ms, " + std::to_string(scheduler.previewCount()) + " previews");
+		printBenchmarkResult(name + "_FIRST_SHARP_FRAME", sharpMs, "ms");
+		printBenchmarkResult(name + "_ALL_LOADED", timer.elapsedMs(), "ms, " + std::to_string(scheduler.bytesRead() / 1024) + " KiB read");
+		printBenchmarkResult(name + "_PREEMPTIONS", (double)scheduler.preemptionCount(), std::to_string(scheduler.prefetchCount()) + " prefetched");
+	}
+}
+#endif
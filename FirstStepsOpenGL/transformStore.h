@@ -0,0 +1,278 @@
+#ifndef TRANSFORM_STORE_H
+#define TRANSFORM_STORE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstring>
+
+#include "benchmark.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define TRANSFORM_STORE_SSE
+#endif
+
+// Data oriented storage for object transforms.
+// Positions, rotations and scales are kept as structure of arrays so the local
+// matrices of four transforms can be built at once with SSE. Only transforms
+// marked dirty (or whose parent changed) are recomputed in update().
+class TransformStore
+{
+public:
+	// add a transform and return its index, a parent must be added before its children
+	// ------------------------------------------------------------------------
+	unsigned int add(const glm::vec3 &position, const glm::quat &rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3 &scale = glm::vec3(1.0f), int parent = -1)
+	{
+		unsigned int index = (unsigned int)parents.size();
+		posX.push_back(position.x);
+		posY.push_back(position.y);
+		posZ.push_back(position.z);
+		rotX.push_back(rotation.x);
+		rotY.push_back(rotation.y);
+		rotZ.push_back(rotation.z);
+		rotW.push_back(rotation.w);
+		scaleX.push_back(scale.x);
+		scaleY.push_back(scale.y);
+		scaleZ.push_back(scale.z);
+		parents.push_back(parent);
+		dirty.push_back(1);
+		worldChanged.push_back(0);
+		localMatrices.push_back(glm::mat4(1.0f));
+		worldMatrices.push_back(glm::mat4(1.0f));
+		return index;
+	}
+	// ------------------------------------------------------------------------
+	void setPosition(unsigned int i, const glm::vec3 &position)
+	{
+		posX[i] = position.x;
+		posY[i] = position.y;
+		posZ[i] = position.z;
+		dirty[i] = 1;
+	}
+	// ------------------------------------------------------------------------
+	void setRotation(unsigned int i, const glm::quat &rotation)
+	{
+		rotX[i] = rotation.x;
+		rotY[i] = rotation.y;
+		rotZ[i] = rotation.z;
+		rotW[i] = rotation.w;
+		dirty[i] = 1;
+	}
+	// ------------------------------------------------------------------------
+	void setScale(unsigned int i, const glm::vec3 &scale)
+	{
+		scaleX[i] = scale.x;
+		scaleY[i] = scale.y;
+		scaleZ[i] = scale.z;
+		dirty[i] = 1;
+	}
+	// ------------------------------------------------------------------------
+	const glm::mat4 &local(unsigned int i) const
+	{
+		return localMatrices[i];
+	}
+	const glm::mat4 &world(unsigned int i) const
+	{
+		return worldMatrices[i];
+	}
+	unsigned int size() const
+	{
+		return (unsigned int)parents.size();
+	}
+	// recompute the dirty local and world matrices. Every world matrix that changed
+	// is also written to gpuDst (16 floats per transform, indexed like the store),
+	// which is meant to be a mapped buffer. Returns the number of world matrices written.
+	// ------------------------------------------------------------------------
+	unsigned int update(float *gpuDst = nullptr)
+	{
+		// gather the dirty transforms and build their local matrices four at a time
+		batch.clear();
+		for (unsigned int i = 0; i < size(); i++)
+		{
+			if (dirty[i])
+				batch.push_back(i);
+		}
+		unsigned int n = (unsigned int)batch.size();
+		unsigned int i = 0;
+		for (; i + 4 <= n; i += 4)
+			buildLocalBatch(&batch[i]);
+		for (; i < n; i++)
+			buildLocal(batch[i]);
+
+		// parents always come before their children so one pass propagates world matrices
+		unsigned int written = 0;
+		for (unsigned int t = 0; t < size(); t++)
+		{
+			int parent = parents[t];
+			bool changed = dirty[t] || (parent >= 0 && worldChanged[parent]);
+			worldChanged[t] = changed;
+			dirty[t] = 0;
+			if (!changed)
+				continue;
+			if (parent >= 0)
+				worldMatrices[t] = worldMatrices[parent] * localMatrices[t];
+			else
+				worldMatrices[t] = localMatrices[t];
+			if (gpuDst != nullptr)
+				std::memcpy(gpuDst + 16 * t, &worldMatrices[t][0][0], 16 * sizeof(float));
+			written++;
+		}
+		return written;
+	}
+	// copy every world matrix to dst, used when the destination does not persist between
+	// frames. strideFloats spaces the matrices out, e.g. to the uniform buffer offset alignment.
+	// ------------------------------------------------------------------------
+	void writeAll(float *dst, size_t strideFloats = 16) const
+	{
+		if (strideFloats == 16)
+		{
+			if (!worldMatrices.empty())
+				std::memcpy(dst, &worldMatrices[0][0][0], worldMatrices.size() * 16 * sizeof(float));
+			return;
+		}
+		for (size_t t = 0; t < worldMatrices.size(); t++)
+			std::memcpy(dst + t * strideFloats, &worldMatrices[t][0][0], 16 * sizeof(float));
+	}
+
+private:
+	std::vector<float> posX, posY, posZ;
+	std::vector<float> rotX, rotY, rotZ, rotW;
+	std::vector<float> scaleX, scaleY, scaleZ;
+	std::vector<int> parents;
+	std::vector<unsigned char> dirty;
+	std::vector<unsigned char> worldChanged;
+	std::vector<glm::mat4> localMatrices;
+	std::vector<glm::mat4> worldMatrices;
+	std::vector<unsigned int> batch;
+
+	// translation * rotation * scale for a single transform
+	// ------------------------------------------------------------------------
+	void buildLocal(unsigned int t)
+	{
+		float x = rotX[t], y = rotY[t], z = rotZ[t], w = rotW[t];
+		float *m = &localMatrices[t][0][0];
+		m[0] = (1.0f - 2.0f * (y * y + z * z)) * scaleX[t];
+		m[1] = (2.0f * (x * y + w * z)) * scaleX[t];
+		m[2] = (2.0f * (x * z - w * y)) * scaleX[t];
+		m[3] = 0.0f;
+		m[4] = (2.0f * (x * y - w * z)) * scaleY[t];
+		m[5] = (1.0f - 2.0f * (x * x + z * z)) * scaleY[t];
+		m[6] = (2.0f * (y * z + w * x)) * scaleY[t];
+		m[7] = 0.0f;
+		m[8] = (2.0f * (x * z + w * y)) * scaleZ[t];
+		m[9] = (2.0f * (y * z - w * x)) * scaleZ[t];
+		m[10] = (1.0f - 2.0f * (x * x + y * y)) * scaleZ[t];
+		m[11] = 0.0f;
+		m[12] = posX[t];
+		m[13] = posY[t];
+		m[14] = posZ[t];
+		m[15] = 1.0f;
+	}
+	// same as buildLocal for four transforms, each lane of a register is one transform
+	// ------------------------------------------------------------------------
+	void buildLocalBatch(const unsigned int *t)
+	{
+#ifdef TRANSFORM_STORE_SSE
+		__m128 x = _mm_setr_ps(rotX[t[0]], rotX[t[1]], rotX[t[2]], rotX[t[3]]);
+		__m128 y = _mm_setr_ps(rotY[t[0]], rotY[t[1]], rotY[t[2]], rotY[t[3]]);
+		__m128 z = _mm_setr_ps(rotZ[t[0]], rotZ[t[1]], rotZ[t[2]], rotZ[t[3]]);
+		__m128 w = _mm_setr_ps(rotW[t[0]], rotW[t[1]], rotW[t[2]], rotW[t[3]]);
+		__m128 sx = _mm_setr_ps(scaleX[t[0]], scaleX[t[1]], scaleX[t[2]], scaleX[t[3]]);
+		__m128 sy = _mm_setr_ps(scaleY[t[0]], scaleY[t[1]], scaleY[t[2]], scaleY[t[3]]);
+		__m128 sz = _mm_setr_ps(scaleZ[t[0]], scaleZ[t[1]], scaleZ[t[2]], scaleZ[t[3]]);
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 two = _mm_set1_ps(2.0f);
+
+		__m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+		__m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+		__m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+		// columns of the scaled rotation matrix, in the same order as buildLocal
+		__m128 terms[9];
+		terms[0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		terms[1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		terms[2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+		terms[3] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		terms[4] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		terms[5] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+		terms[6] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		terms[7] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		terms[8] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+
+		// scatter the lanes back out into the four matrices
+		float lanes[9][4];
+		for (int k = 0; k < 9; k++)
+			_mm_storeu_ps(lanes[k], terms[k]);
+		for (int j = 0; j < 4; j++)
+		{
+			float *m = &localMatrices[t[j]][0][0];
+			m[0] = lanes[0][j]; m[1] = lanes[1][j]; m[2] = lanes[2][j]; m[3] = 0.0f;
+			m[4] = lanes[3][j]; m[5] = lanes[4][j]; m[6] = lanes[5][j]; m[7] = 0.0f;
+			m[8] = lanes[6][j]; m[9] = lanes[7][j]; m[10] = lanes[8][j]; m[11] = 0.0f;
+			m[12] = posX[t[j]]; m[13] = posY[t[j]]; m[14] = posZ[t[j]]; m[15] = 1.0f;
+		}
+#else
+		for (int j = 0; j < 4; j++)
+			buildLocal(t[j]);
+#endif
+	}
+};
+
+// Compare building model matrices with glm::translate/glm::rotate per object (the old
+// Application.cpp path) against the transform store, both writing into a mapped buffer.
+// ------------------------------------------------------------------------
+inline void benchmarkTransformStore(unsigned int objectCount, unsigned int frames)
+{
+	std::vector<glm::vec3> positions(objectCount);
+	for (unsigned int i = 0; i < objectCount; i++)
+		positions[i] = glm::vec3((float)(i % 100), (float)(i / 100), -10.0f);
+	const glm::vec3 axis(0.5f, 1.0f, 0.0f);
+
+	unsigned int buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, objectCount * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+
+	// per object glm path
+	BenchmarkTimer timer;
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		float *dst = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, objectCount * sizeof(glm::mat4), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		for (unsigned int i = 0; i < objectCount; i++)
+		{
+			glm::mat4 model(1.0f);
+			model = glm::translate(model, positions[i]);
+			model = glm::rotate(model, (float)f * 0.01f * glm::radians(50.0f), axis);
+			std::memcpy(dst + 16 * i, &model[0][0], sizeof(glm::mat4));
+		}
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	double glmMs = timer.elapsedMs();
+
+	// transform store path, rotation axis is normalized once instead of per object
+	TransformStore store;
+	for (unsigned int i = 0; i < objectCount; i++)
+		store.add(positions[i]);
+	const glm::vec3 unitAxis = glm::normalize(axis);
+	timer.restart();
+	for (unsigned int f = 0; f < frames; f++)
+	{
+		glm::quat rotation = glm::angleAxis((float)f * 0.01f * glm::radians(50.0f), unitAxis);
+		for (unsigned int i = 0; i < objectCount; i++)
+			store.setRotation(i, rotation);
+		float *dst = (float*)glMapBufferRange(GL_ARRAY_BUFFER, 0, objectCount * sizeof(glm::mat4), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		store.update(dst);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	double storeMs = timer.elapsedMs();
+
+	glDeleteBuffers(1, &buffer);
+	double matrices = (double)objectCount * frames;
+	printBenchmarkResult("TRANSFORM::GLM_PER_OBJECT", matrices / (glmMs / 1000.0), "matrices/s");
+	printBenchmarkResult("TRANSFORM::STORE_BATCHED", matrices / (storeMs / 1000.0), "matrices/s");
+}
+#endif
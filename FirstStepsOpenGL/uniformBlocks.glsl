@@ -0,0 +1,23 @@
+// Uniform blocks shared by every shader, mirrored in uniformBlocks.h.
+// Bindings are set from the C++ side by Shader::bindUniformBlocks(). SPIR-V modules
+// (tools/compileSpirv.py) carry no block names to look up, so there they are explicit.
+#ifdef GL_SPIRV
+layout (std140, binding = 1) uniform Object
+#else
+layout (std140) uniform Object
+#endif
+{
+    mat4 model;
+};
+#ifdef GL_SPIRV
+layout (std140, binding = 0) uniform Camera
+#else
+layout (std140) uniform Camera
+#endif
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 time;     // x: seconds since start, y: seconds since last frame
+    vec4 viewport; // x: width, y: height, z: 1 / width, w: 1 / height
+};
@@ -0,0 +1,34 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#include <glm/glm.hpp>
+
+// Binding points of the uniform blocks shared by all shader programs. The matching
+// blocks are declared in uniformBlocks.glsl, which shaders #include, and Shader binds
+// every block it finds to its point right after linking.
+const unsigned int CAMERA_BLOCK_BINDING = 0;  // uniform Camera, see CameraBlock
+const unsigned int OBJECT_BLOCK_BINDING = 1;  // uniform Object { mat4 model; }
+
+// CPU side of the std140 Camera block, written once per frame. Only mat4 and vec4
+// members so the C++ layout is the std140 layout.
+struct CameraBlock
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	glm::vec4 time;      // x: seconds since start, y: seconds since last frame
+	glm::vec4 viewport;  // x: width, y: height, z: 1 / width, w: 1 / height
+};
+
+// ------------------------------------------------------------------------
+inline CameraBlock makeCameraBlock(const glm::mat4 &view, const glm::mat4 &projection, float time, float deltaTime, int width, int height)
+{
+	CameraBlock block;
+	block.view = view;
+	block.projection = projection;
+	block.viewProjection = projection * view;
+	block.time = glm::vec4(time, deltaTime, 0.0f, 0.0f);
+	block.viewport = glm::vec4((float)width, (float)height, 1.0f / (float)width, 1.0f / (float)height);
+	return block;
+}
+#endif
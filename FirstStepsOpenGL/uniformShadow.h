@@ -0,0 +1,259 @@
+#ifndef UNIFORM_SHADOW_H
+#define UNIFORM_SHADOW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+// CPU copy of every loose uniform of one program. Setters compare against the copy and
+// only mark changed values dirty; flush() uploads everything that changed since the last
+// draw in one pass, one glUniform call per changed uniform (per dirty element range for
+// arrays), so values set several times between draws reach the driver once and values
+// equal to what the program already holds never do. The copy starts from the program's
+// current values, initialisers and earlier glUniform calls included.
+//
+// Shader::shadowUniforms() routes a Shader's setters through one of these:
+//
+//   shader.shadowUniforms();
+//   shader.setVec3("boundsMin", mesh.boundsMin);   // skipped if unchanged
+//   shader.use();
+//   shader.flush();
+//   glDrawElements(...);
+class UniformShadow
+{
+public:
+	explicit UniformShadow(unsigned int program)
+	{
+		char name[256];
+		GLint count = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint arraySize;
+			GLenum type;
+			glGetActiveUniform(program, i, sizeof(name), NULL, &arraySize, &type, name);
+			GLint location = glGetUniformLocation(program, name);
+			int components = componentCount(type);
+			// block members have no location, unknown types are left to glUniform
+			if (location < 0 || components == 0)
+				continue;
+			std::string base(name);
+			size_t bracket = base.find('[');
+			if (bracket != std::string::npos)
+				base.erase(bracket);
+			Slot slot = { type, components, words.size(), std::vector<GLint>(), true, -1, -1 };
+			words.resize(words.size() + components * arraySize, 0);
+			// array elements are not promised consecutive locations, each one is looked up
+			for (GLint element = 0; element < arraySize; element++)
+			{
+				std::string elementName = base + "[" + std::to_string(element) + "]";
+				GLint elementLocation = arraySize == 1 ? location : glGetUniformLocation(program, elementName.c_str());
+				slot.locations.push_back(elementLocation);
+				slot.contiguous = slot.contiguous && elementLocation == location + element;
+				if (elementLocation < 0)
+					continue;
+				Element at = { (int)slots.size(), element };
+				elements[elementLocation] = at;
+				if (arraySize > 1)
+					locations[elementName] = elementLocation;
+				read(program, elementLocation, type, &words[slot.offset + element * components]);
+			}
+			slots.push_back(slot);
+			locations[name] = location;
+			locations[base] = location;
+		}
+	}
+	// ------------------------------------------------------------------------
+	GLint location(const std::string &name) const
+	{
+		std::unordered_map<std::string, GLint>::const_iterator found = locations.find(name);
+		return found == locations.end() ? -1 : found->second;
+	}
+	// copy components 4 byte values to location, marks them dirty if they differ;
+	// integer tells int, bool and sampler values from float ones
+	// ------------------------------------------------------------------------
+	void set(GLint location, const void *values, int components, bool integer)
+	{
+		sets++;
+		std::unordered_map<GLint, Element>::const_iterator found = elements.find(location);
+		if (found == elements.end())
+			return;
+		Slot &slot = slots[found->second.slot];
+		if (components != slot.components || integer != isInteger(slot.type))
+		{
+			std::cout << "ERROR::UNIFORM_SHADOW::TYPE_MISMATCH at location " << location << std::endl;
+			return;
+		}
+		int element = found->second.element;
+		unsigned int *shadow = &words[slot.offset + element * slot.components];
+		if (std::memcmp(shadow, values, components * sizeof(unsigned int)) == 0)
+		{
+			avoided++;
+			return;
+		}
+		std::memcpy(shadow, values, components * sizeof(unsigned int));
+		if (slot.dirtyFirst < 0)
+		{
+			dirty.push_back(found->second.slot);
+			slot.dirtyFirst = slot.dirtyLast = element;
+		}
+		else
+		{
+			slot.dirtyFirst = std::min(slot.dirtyFirst, element);
+			slot.dirtyLast = std::max(slot.dirtyLast, element);
+		}
+	}
+	// ------------------------------------------------------------------------
+	void setInt(GLint location, int value) { set(location, &value, 1, true); }
+	void setFloat(GLint location, float value) { set(location, &value, 1, false); }
+	void setVec2(GLint location, const glm::vec2 &value) { set(location, &value[0], 2, false); }
+	void setVec3(GLint location, const glm::vec3 &value) { set(location, &value[0], 3, false); }
+	void setVec4(GLint location, const glm::vec4 &value) { set(location, &value[0], 4, false); }
+	void setMat2(GLint location, const glm::mat2 &value) { set(location, &value[0][0], 4, false); }
+	void setMat3(GLint location, const glm::mat3 &value) { set(location, &value[0][0], 9, false); }
+	void setMat4(GLint location, const glm::mat4 &value) { set(location, &value[0][0], 16, false); }
+	// ------------------------------------------------------------------------
+	void setBool(const std::string &name, bool value) { setInt(location(name), (int)value); }
+	void setInt(const std::string &name, int value) { setInt(location(name), value); }
+	void setFloat(const std::string &name, float value) { setFloat(location(name), value); }
+	void setVec2(const std::string &name, const glm::vec2 &value) { setVec2(location(name), value); }
+	void setVec3(const std::string &name, const glm::vec3 &value) { setVec3(location(name), value); }
+	void setVec4(const std::string &name, const glm::vec4 &value) { setVec4(location(name), value); }
+	void setMat2(const std::string &name, const glm::mat2 &value) { setMat2(location(name), value); }
+	void setMat3(const std::string &name, const glm::mat3 &value) { setMat3(location(name), value); }
+	void setMat4(const std::string &name, const glm::mat4 &value) { setMat4(location(name), value); }
+
+	// upload everything that changed since the last flush, the program must be in use
+	// ------------------------------------------------------------------------
+	void flush()
+	{
+		for (int index : dirty)
+		{
+			Slot &slot = slots[index];
+			if (slot.contiguous)
+			{
+				const unsigned int *first = &words[slot.offset + slot.dirtyFirst * slot.components];
+				upload(slot.type, slot.locations[slot.dirtyFirst], slot.dirtyLast - slot.dirtyFirst + 1, first);
+				uploads++;
+			}
+			else
+			{
+				for (int element = slot.dirtyFirst; element <= slot.dirtyLast; element++)
+				{
+					upload(slot.type, slot.locations[element], 1, &words[slot.offset + element * slot.components]);
+					uploads++;
+				}
+			}
+			slot.dirtyFirst = slot.dirtyLast = -1;
+		}
+		dirty.clear();
+	}
+	// ------------------------------------------------------------------------
+	unsigned int setCount() const
+	{
+		return sets;
+	}
+	// set calls that matched the shadow copy and were dropped
+	unsigned int avoidedCount() const
+	{
+		return avoided;
+	}
+	// glUniform calls made by flush()
+	unsigned int uploadCount() const
+	{
+		return uploads;
+	}
+
+private:
+	struct Slot
+	{
+		GLenum type;
+		int components;                // per array element
+		size_t offset;                 // into words
+		std::vector<GLint> locations;  // per array element, -1 for inactive ones
+		bool contiguous;               // element locations follow each other
+		int dirtyFirst;                // dirty array elements, -1 when clean
+		int dirtyLast;
+	};
+	struct Element
+	{
+		int slot;
+		int element;
+	};
+	std::vector<Slot> slots;
+	std::unordered_map<GLint, Element> elements;  // location -> array element of a slot
+	std::vector<unsigned int> words;
+	std::vector<int> dirty;
+	std::unordered_map<std::string, GLint> locations;
+	unsigned int sets = 0;
+	unsigned int avoided = 0;
+	unsigned int uploads = 0;
+
+	// ------------------------------------------------------------------------
+	static int componentCount(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_FLOAT: case GL_INT: case GL_UNSIGNED_INT: case GL_BOOL:
+		case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_ARRAY:
+			return 1;
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: return 2;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: return 3;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_FLOAT_MAT2: return 4;
+		case GL_FLOAT_MAT3: return 9;
+		case GL_FLOAT_MAT4: return 16;
+		default: return 0;
+		}
+	}
+	// ------------------------------------------------------------------------
+	static bool isInteger(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_FLOAT: case GL_FLOAT_VEC2: case GL_FLOAT_VEC3: case GL_FLOAT_VEC4:
+		case GL_FLOAT_MAT2: case GL_FLOAT_MAT3: case GL_FLOAT_MAT4:
+			return false;
+		default:
+			return true;
+		}
+	}
+	// the value one element holds in the program
+	// ------------------------------------------------------------------------
+	static void read(unsigned int program, GLint location, GLenum type, unsigned int *data)
+	{
+		if (!isInteger(type))
+			glGetUniformfv(program, location, (GLfloat*)data);
+		else if (type == GL_UNSIGNED_INT)
+			glGetUniformuiv(program, location, (GLuint*)data);
+		else
+			glGetUniformiv(program, location, (GLint*)data);
+	}
+	// ------------------------------------------------------------------------
+	static void upload(GLenum type, GLint location, GLsizei count, const unsigned int *data)
+	{
+		const GLfloat *f = (const GLfloat*)data;
+		const GLint *i = (const GLint*)data;
+		switch (type)
+		{
+		case GL_FLOAT: glUniform1fv(location, count, f); break;
+		case GL_FLOAT_VEC2: glUniform2fv(location, count, f); break;
+		case GL_FLOAT_VEC3: glUniform3fv(location, count, f); break;
+		case GL_FLOAT_VEC4: glUniform4fv(location, count, f); break;
+		case GL_FLOAT_MAT2: glUniformMatrix2fv(location, count, GL_FALSE, f); break;
+		case GL_FLOAT_MAT3: glUniformMatrix3fv(location, count, GL_FALSE, f); break;
+		case GL_FLOAT_MAT4: glUniformMatrix4fv(location, count, GL_FALSE, f); break;
+		case GL_UNSIGNED_INT: glUniform1uiv(location, count, (const GLuint*)data); break;
+		case GL_INT_VEC2: glUniform2iv(location, count, i); break;
+		case GL_INT_VEC3: glUniform3iv(location, count, i); break;
+		case GL_INT_VEC4: glUniform4iv(location, count, i); break;
+		default: glUniform1iv(location, count, i); break;  // int, bool and samplers
+		}
+	}
+};
+#endif
@@ -0,0 +1,891 @@
+#ifndef UNIVERSAL_TEXTURE_H
+#define UNIVERSAL_TEXTURE_H
+
+#include <glad/glad.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "texture.h"
+#include "lzCodec.h"
+#include "benchmark.h"
+
+// A cooked texture (.utex) is stored once, in a block format every GPU format can be
+// made from by rearranging bits, and transcoded at load time into whatever the context
+// samples natively. Each 4x4 block holds
+//   colour  one RGB555 base colour, one of the 8 ETC1 intensity tables and a 2 bit
+//           selector per texel picking one of the table's 4 offsets, added to every channel
+//   alpha   an ETC2 EAC block (base, multiplier, table, 3 bit index per texel), only in
+//           files with transparency
+// which is ETC1S: to ETC2 it is a copy, to BC1 / BC3 / BC7 the four colours of a block
+// lie on a line whose ends become the endpoints. Per level the fields are split into
+// planes (base colours, tables, selectors, alpha) and the planes LZ compressed.
+//
+// File: UniversalTextureHeader, a packed byte count per level, the packed levels.
+struct UniversalTextureHeader
+{
+	char magic[4];            // "UTEX"
+	unsigned int version;
+	unsigned int width;
+	unsigned int height;
+	unsigned int levels;
+	unsigned int flags;       // UNIVERSAL_ALPHA
+};
+const unsigned int UNIVERSAL_TEXTURE_VERSION = 1;
+const unsigned int UNIVERSAL_ALPHA = 1;
+// largest width or height a universal texture may have, a damaged header must not size the levels
+const unsigned int UNIVERSAL_TEXTURE_MAX_SIZE = 16384;
+
+// what a universal texture becomes on the GPU, best first
+enum UniversalTarget
+{
+	UNIVERSAL_TARGET_BC7,       // 16 bytes a block, the finest of them
+	UNIVERSAL_TARGET_BC1_BC3,   // 8 bytes a block, 16 with alpha
+	UNIVERSAL_TARGET_ETC2,      // 8 bytes a block, 16 with alpha; most desktop drivers decompress it
+	UNIVERSAL_TARGET_RGBA8      // no block compression in the context
+};
+
+// ------------------------------------------------------------------------
+inline const char *universalTargetName(UniversalTarget target)
+{
+	switch (target)
+	{
+	case UNIVERSAL_TARGET_BC7: return "BC7";
+	case UNIVERSAL_TARGET_BC1_BC3: return "BC1_BC3";
+	case UNIVERSAL_TARGET_ETC2: return "ETC2";
+	default: return "RGBA8";
+	}
+}
+// the context can sample target, each by its own version or extension; call on the GL thread
+// ------------------------------------------------------------------------
+inline bool universalTargetSupported(UniversalTarget target)
+{
+	switch (target)
+	{
+	case UNIVERSAL_TARGET_BC7: return GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_compression_bptc;
+	case UNIVERSAL_TARGET_BC1_BC3: return GLAD_GL_EXT_texture_compression_s3tc != 0;
+	case UNIVERSAL_TARGET_ETC2: return GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_ES3_compatibility;
+	default: return true;
+	}
+}
+// the best target the current context supports, call on the GL thread. ETC2 comes after
+// the BC formats: desktop drivers mostly expose it through ES3 compatibility and store it
+// decompressed.
+// ------------------------------------------------------------------------
+inline UniversalTarget universalTarget()
+{
+	UniversalTarget targets[3] = { UNIVERSAL_TARGET_BC7, UNIVERSAL_TARGET_BC1_BC3, UNIVERSAL_TARGET_ETC2 };
+	for (UniversalTarget target : targets)
+		if (universalTargetSupported(target))
+			return target;
+	return UNIVERSAL_TARGET_RGBA8;
+}
+// ------------------------------------------------------------------------
+inline TextureFormat universalFormat(UniversalTarget target, bool alpha)
+{
+	TextureFormat format = textureFormat(4);
+	switch (target)
+	{
+	case UNIVERSAL_TARGET_BC7: format.internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+	case UNIVERSAL_TARGET_BC1_BC3: format.internalFormat = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+	case UNIVERSAL_TARGET_ETC2: format.internalFormat = alpha ? GL_COMPRESSED_RGBA8_ETC2_EAC : GL_COMPRESSED_RGB8_ETC2; break;
+	default: break;
+	}
+	if (!alpha)
+		format.swizzle[3] = GL_ONE;
+	return format;
+}
+// the target a chain was transcoded for, from its format
+inline UniversalTarget universalTargetOf(const TextureFormat &format)
+{
+	switch (format.internalFormat)
+	{
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: return UNIVERSAL_TARGET_BC7;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return UNIVERSAL_TARGET_BC1_BC3;
+	case GL_COMPRESSED_RGB8_ETC2: case GL_COMPRESSED_RGBA8_ETC2_EAC: return UNIVERSAL_TARGET_ETC2;
+	default: return UNIVERSAL_TARGET_RGBA8;
+	}
+}
+
+namespace utex
+{
+	// ETC1 intensity tables, the smaller and the larger offset
+	const int ETC_TABLES[8][2] = { { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 } };
+	// EAC alpha offsets by table and index
+	const int EAC_TABLES[16][8] = {
+		{ -3, -6, -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 }, { -2, -5, -8, -13, 1, 4, 7, 12 }, { -2, -4, -6, -13, 1, 3, 5, 12 },
+		{ -3, -6, -8, -12, 2, 5, 7, 11 }, { -3, -7, -9, -11, 2, 6, 8, 10 }, { -4, -7, -8, -11, 3, 6, 7, 10 }, { -3, -5, -8, -11, 2, 4, 7, 10 },
+		{ -2, -6, -8, -10, 1, 5, 7, 9 }, { -2, -5, -8, -10, 1, 4, 7, 9 }, { -2, -4, -8, -10, 1, 3, 7, 9 }, { -2, -5, -7, -10, 1, 4, 6, 9 },
+		{ -3, -4, -7, -10, 2, 3, 6, 9 }, { -1, -2, -3, -10, 0, 1, 2, 9 }, { -4, -6, -8, -9, 3, 5, 7, 8 }, { -3, -5, -7, -9, 2, 4, 6, 8 } };
+	// BC7 interpolation weights for 2 and 4 bit indices
+	const int BC7_WEIGHTS2[4] = { 0, 21, 43, 64 };
+	const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// a colour block; selectors are 2 bits per texel, texel y * 4 + x at bit 2 * (y * 4 + x),
+	// and run from the darkest offset (0) to the brightest (3)
+	struct ColorBlock
+	{
+		unsigned short color;     // r << 10 | g << 5 | b, 5 bits each
+		unsigned char table;
+		unsigned int selectors;
+	};
+
+	// ------------------------------------------------------------------------
+	inline int clampByte(int v)
+	{
+		return v < 0 ? 0 : v > 255 ? 255 : v;
+	}
+	inline int expand5(int c)
+	{
+		return (c << 3) | (c >> 2);
+	}
+	// offset of selector s of an intensity table
+	inline int offset(int table, int s)
+	{
+		return s == 0 ? -ETC_TABLES[table][1] : s == 1 ? -ETC_TABLES[table][0] : s == 2 ? ETC_TABLES[table][0] : ETC_TABLES[table][1];
+	}
+	// the four colours a block can give a texel
+	// ------------------------------------------------------------------------
+	inline void palette(const ColorBlock &block, int colors[4][3])
+	{
+		int base[3] = { expand5(block.color >> 10 & 31), expand5(block.color >> 5 & 31), expand5(block.color & 31) };
+		for (int s = 0; s < 4; s++)
+			for (int c = 0; c < 3; c++)
+				colors[s][c] = clampByte(base[c] + offset(block.table, s));
+	}
+	// ------------------------------------------------------------------------
+	inline int eacValue(const unsigned char *alpha, int index)
+	{
+		return clampByte(alpha[0] + EAC_TABLES[alpha[1] & 15][index] * (alpha[1] >> 4));
+	}
+	// index of texel (x, y) of an EAC block, texels are stored column by column
+	inline int eacIndex(const unsigned char *alpha, int x, int y)
+	{
+		int bit = 45 - 3 * (x * 4 + y);
+		unsigned long long bits = 0;
+		for (int i = 2; i < 8; i++)
+			bits = bits << 8 | alpha[i];
+		return (int)(bits >> bit) & 7;
+	}
+
+	// best base colour and table for 16 RGBA texels, each texel takes its nearest offset
+	// ------------------------------------------------------------------------
+	inline ColorBlock encodeColor(const unsigned char *texels)
+	{
+		int sum[3] = { 0, 0, 0 };
+		for (int t = 0; t < 16; t++)
+			for (int c = 0; c < 3; c++)
+				sum[c] += texels[t * 4 + c];
+		ColorBlock best = { 0, 0, 0 };
+		int bestError = -1;
+		// the rounded average, and one step darker and brighter on every channel
+		for (int shift = -1; shift <= 1; shift++)
+		{
+			int base5[3], base[3];
+			for (int c = 0; c < 3; c++)
+			{
+				base5[c] = std::min(31, std::max(0, (sum[c] * 31 / 16 + 127) / 255 + shift));
+				base[c] = expand5(base5[c]);
+			}
+			for (int table = 0; table < 8; table++)
+			{
+				int colors[4][3];
+				for (int s = 0; s < 4; s++)
+					for (int c = 0; c < 3; c++)
+						colors[s][c] = clampByte(base[c] + offset(table, s));
+				int error = 0;
+				unsigned int selectors = 0;
+				for (int t = 0; t < 16 && (bestError < 0 || error < bestError); t++)
+				{
+					int nearest = 0, nearestError = -1;
+					for (int s = 0; s < 4; s++)
+					{
+						int e = 0;
+						for (int c = 0; c < 3; c++)
+							e += (texels[t * 4 + c] - colors[s][c]) * (texels[t * 4 + c] - colors[s][c]);
+						if (nearestError < 0 || e < nearestError)
+						{
+							nearest = s;
+							nearestError = e;
+						}
+					}
+					error += nearestError;
+					selectors |= (unsigned int)nearest << (2 * t);
+				}
+				if (bestError < 0 || error < bestError)
+				{
+					bestError = error;
+					best.color = (unsigned short)(base5[0] << 10 | base5[1] << 5 | base5[2]);
+					best.table = (unsigned char)table;
+					best.selectors = selectors;
+				}
+			}
+		}
+		return best;
+	}
+	// EAC block for the alpha of 16 RGBA texels
+	// ------------------------------------------------------------------------
+	inline void encodeAlpha(const unsigned char *texels, unsigned char *out)
+	{
+		int low = 255, high = 0, sum = 0;
+		for (int t = 0; t < 16; t++)
+		{
+			low = std::min(low, (int)texels[t * 4 + 3]);
+			high = std::max(high, (int)texels[t * 4 + 3]);
+			sum += texels[t * 4 + 3];
+		}
+		// a flat block: table 13 has a zero offset at index 4
+		int bestBase = high, bestTable = 13, bestMultiplier = 1, bestError = -1;
+		unsigned long long bestBits = 0x924924924924ull;
+		if (low != high)
+		{
+			int bases[2] = { (low + high + 1) / 2, (sum + 8) / 16 };
+			for (int base : bases)
+			{
+				for (int table = 0; table < 16; table++)
+				{
+					int span = EAC_TABLES[table][7] - EAC_TABLES[table][3];
+					int guess = (high - low + span / 2) / span;
+					for (int multiplier = std::max(1, guess - 1); multiplier <= std::min(15, guess + 1); multiplier++)
+					{
+						int error = 0;
+						unsigned long long bits = 0;
+						for (int x = 0; x < 4; x++)
+						{
+							for (int y = 0; y < 4; y++)
+							{
+								int a = texels[(y * 4 + x) * 4 + 3], nearest = 0, nearestError = -1;
+								for (int i = 0; i < 8; i++)
+								{
+									int e = a - clampByte(base + EAC_TABLES[table][i] * multiplier);
+									if (nearestError < 0 || e * e < nearestError)
+									{
+										nearest = i;
+										nearestError = e * e;
+									}
+								}
+								error += nearestError;
+								bits = bits << 3 | (unsigned long long)nearest;
+							}
+						}
+						if (bestError < 0 || error < bestError)
+						{
+							bestError = error;
+							bestBase = base;
+							bestTable = table;
+							bestMultiplier = multiplier;
+							bestBits = bits;
+						}
+					}
+				}
+			}
+		}
+		out[0] = (unsigned char)bestBase;
+		out[1] = (unsigned char)(bestMultiplier << 4 | bestTable);
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (unsigned char)(bestBits >> (40 - 8 * i));
+	}
+
+	// ------------------------------------------------------------------------
+	inline void etc2Color(const ColorBlock &block, unsigned char *out)
+	{
+		// differential mode with a zero difference: both halves share base colour and table
+		out[0] = (unsigned char)((block.color >> 10 & 31) << 3);
+		out[1] = (unsigned char)((block.color >> 5 & 31) << 3);
+		out[2] = (unsigned char)((block.color & 31) << 3);
+		out[3] = (unsigned char)(block.table << 5 | block.table << 2 | 2);
+		// ETC orders offsets +small, +large, -small, -large and texels column by column
+		static const int etcIndex[4] = { 3, 2, 0, 1 };
+		unsigned int high = 0, low = 0;
+		for (int y = 0; y < 4; y++)
+		{
+			for (int x = 0; x < 4; x++)
+			{
+				int index = etcIndex[block.selectors >> (2 * (y * 4 + x)) & 3];
+				high |= (unsigned int)(index >> 1) << (x * 4 + y);
+				low |= (unsigned int)(index & 1) << (x * 4 + y);
+			}
+		}
+		out[4] = (unsigned char)(high >> 8);
+		out[5] = (unsigned char)high;
+		out[6] = (unsigned char)(low >> 8);
+		out[7] = (unsigned char)low;
+	}
+	// ------------------------------------------------------------------------
+	inline unsigned short pack565(const int *color)
+	{
+		return (unsigned short)(((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 | ((color[2] * 31 + 127) / 255));
+	}
+	inline void unpack565(unsigned short v, int *color)
+	{
+		color[0] = expand5(v >> 11);
+		color[1] = (v >> 5 & 63) << 2 | (v >> 9 & 3);
+		color[2] = expand5(v & 31);
+	}
+	// the endpoints are the darkest and the brightest colour, the middle two map to the
+	// nearest thirds
+	// ------------------------------------------------------------------------
+	inline void bc1Color(const ColorBlock &block, unsigned char *out)
+	{
+		int colors[4][3];
+		palette(block, colors);
+		unsigned short c0 = pack565(colors[3]), c1 = pack565(colors[0]);
+		unsigned int indices = 0;
+		if (c0 != c1)
+		{
+			if (c0 < c1)
+				std::swap(c0, c1);
+			int e0[3], e1[3], bc1[4][3];
+			unpack565(c0, e0);
+			unpack565(c1, e1);
+			for (int c = 0; c < 3; c++)
+			{
+				bc1[0][c] = e0[c];
+				bc1[1][c] = e1[c];
+				bc1[2][c] = (2 * e0[c] + e1[c]) / 3;
+				bc1[3][c] = (e0[c] + 2 * e1[c]) / 3;
+			}
+			int map[4];
+			for (int s = 0; s < 4; s++)
+			{
+				int nearestError = -1;
+				for (int i = 0; i < 4; i++)
+				{
+					int e = 0;
+					for (int c = 0; c < 3; c++)
+						e += (colors[s][c] - bc1[i][c]) * (colors[s][c] - bc1[i][c]);
+					if (nearestError < 0 || e < nearestError)
+					{
+						map[s] = i;
+						nearestError = e;
+					}
+				}
+			}
+			for (int t = 0; t < 16; t++)
+				indices |= (unsigned int)map[block.selectors >> (2 * t) & 3] << (2 * t);
+		}
+		// c0 == c1 would select the 3 colour mode, index 0 is right in both
+		std::memcpy(out, &c0, 2);
+		std::memcpy(out + 2, &c1, 2);
+		std::memcpy(out + 4, &indices, 4);
+	}
+	// BC4 (the alpha half of BC3) from an EAC block: its extreme values become the endpoints
+	// ------------------------------------------------------------------------
+	inline void bc4Alpha(const unsigned char *alpha, unsigned char *out)
+	{
+		int values[8], low = 255, high = 0;
+		for (int i = 0; i < 8; i++)
+			values[i] = eacValue(alpha, i);
+		int indices[16];
+		for (int y = 0; y < 4; y++)
+		{
+			for (int x = 0; x < 4; x++)
+			{
+				indices[y * 4 + x] = eacIndex(alpha, x, y);
+				low = std::min(low, values[indices[y * 4 + x]]);
+				high = std::max(high, values[indices[y * 4 + x]]);
+			}
+		}
+		int bc4[8] = { high, low };
+		for (int i = 1; i < 7; i++)
+			bc4[i + 1] = ((7 - i) * high + i * low) / 7;
+		int map[8];
+		for (int i = 0; i < 8; i++)
+		{
+			map[i] = 0;
+			for (int j = 1; j < 8 && high != low; j++)
+				if (std::abs(values[i] - bc4[j]) < std::abs(values[i] - bc4[map[i]]))
+					map[i] = j;
+		}
+		unsigned long long bits = 0;
+		for (int t = 0; t < 16; t++)
+			bits |= (unsigned long long)map[indices[t]] << (3 * t);
+		out[0] = (unsigned char)high;
+		out[1] = (unsigned char)low;
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	// BC7 blocks are one 128 bit little endian number, written from bit 0 up
+	struct BitWriter
+	{
+		unsigned char *out;
+		int position;
+		void write(unsigned int value, int bits)
+		{
+			for (int i = 0; i < bits; i++, position++)
+				if (value >> i & 1)
+					out[position >> 3] |= (unsigned char)(1 << (position & 7));
+		}
+	};
+	// ------------------------------------------------------------------------
+	inline int bc7Interpolate(int e0, int e1, int weight)
+	{
+		return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+	}
+	// mode 6 for opaque blocks: RGBA 7 bit endpoints with a p bit each, 4 bit indices.
+	// The p bits are set so the alpha endpoints are exactly 255.
+	// ------------------------------------------------------------------------
+	inline void bc7Opaque(const ColorBlock &block, unsigned char *out)
+	{
+		int colors[4][3];
+		palette(block, colors);
+		int q[2][3], e[2][3];
+		for (int c = 0; c < 3; c++)
+		{
+			q[0][c] = std::min(127, colors[0][c] >> 1);
+			q[1][c] = std::min(127, colors[3][c] >> 1);
+			e[0][c] = q[0][c] << 1 | 1;
+			e[1][c] = q[1][c] << 1 | 1;
+		}
+		int map[4];
+		for (int s = 0; s < 4; s++)
+		{
+			int nearestError = -1;
+			for (int i = 0; i < 16; i++)
+			{
+				int err = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = colors[s][c] - bc7Interpolate(e[0][c], e[1][c], BC7_WEIGHTS4[i]);
+					err += d * d;
+				}
+				if (nearestError < 0 || err < nearestError)
+				{
+					map[s] = i;
+					nearestError = err;
+				}
+			}
+		}
+		// texel 0 is the anchor, its index has an implicit 0 top bit
+		if (map[block.selectors & 3] >= 8)
+		{
+			for (int c = 0; c < 3; c++)
+				std::swap(q[0][c], q[1][c]);
+			for (int s = 0; s < 4; s++)
+				map[s] = 15 - map[s];
+		}
+		std::memset(out, 0, 16);
+		BitWriter bits = { out, 0 };
+		bits.write(1 << 6, 7);
+		for (int c = 0; c < 3; c++)
+		{
+			bits.write(q[0][c], 7);
+			bits.write(q[1][c], 7);
+		}
+		bits.write(127, 7);
+		bits.write(127, 7);
+		bits.write(1, 1);
+		bits.write(1, 1);
+		for (int t = 0; t < 16; t++)
+			bits.write(map[block.selectors >> (2 * t) & 3], t == 0 ? 3 : 4);
+	}
+	// mode 5 for blocks with alpha: RGB 7 bit and alpha 8 bit endpoints, separate 2 bit
+	// indices for colour and alpha
+	// ------------------------------------------------------------------------
+	inline void bc7Alpha(const ColorBlock &block, const unsigned char *alpha, unsigned char *out)
+	{
+		int colors[4][3];
+		palette(block, colors);
+		int q[2][3], e[2][3];
+		for (int c = 0; c < 3; c++)
+		{
+			q[0][c] = (colors[0][c] * 127 + 127) / 255;
+			q[1][c] = (colors[3][c] * 127 + 127) / 255;
+			e[0][c] = q[0][c] << 1 | q[0][c] >> 6;
+			e[1][c] = q[1][c] << 1 | q[1][c] >> 6;
+		}
+		int colorMap[4];
+		for (int s = 0; s < 4; s++)
+		{
+			int nearestError = -1;
+			for (int i = 0; i < 4; i++)
+			{
+				int err = 0;
+				for (int c = 0; c < 3; c++)
+				{
+					int d = colors[s][c] - bc7Interpolate(e[0][c], e[1][c], BC7_WEIGHTS2[i]);
+					err += d * d;
+				}
+				if (nearestError < 0 || err < nearestError)
+				{
+					colorMap[s] = i;
+					nearestError = err;
+				}
+			}
+		}
+		int values[8], indices[16], a[2] = { 255, 0 };
+		for (int i = 0; i < 8; i++)
+			values[i] = eacValue(alpha, i);
+		for (int y = 0; y < 4; y++)
+		{
+			for (int x = 0; x < 4; x++)
+			{
+				indices[y * 4 + x] = eacIndex(alpha, x, y);
+				a[0] = std::min(a[0], values[indices[y * 4 + x]]);
+				a[1] = std::max(a[1], values[indices[y * 4 + x]]);
+			}
+		}
+		int alphaMap[8];
+		for (int i = 0; i < 8; i++)
+		{
+			alphaMap[i] = 0;
+			for (int j = 1; j < 4; j++)
+				if (std::abs(values[i] - bc7Interpolate(a[0], a[1], BC7_WEIGHTS2[j])) < std::abs(values[i] - bc7Interpolate(a[0], a[1], BC7_WEIGHTS2[alphaMap[i]])))
+					alphaMap[i] = j;
+		}
+		if (colorMap[block.selectors & 3] >= 2)
+		{
+			for (int c = 0; c < 3; c++)
+				std::swap(q[0][c], q[1][c]);
+			for (int s = 0; s < 4; s++)
+				colorMap[s] = 3 - colorMap[s];
+		}
+		if (alphaMap[indices[0]] >= 2)
+		{
+			std::swap(a[0], a[1]);
+			for (int i = 0; i < 8; i++)
+				alphaMap[i] = 3 - alphaMap[i];
+		}
+		std::memset(out, 0, 16);
+		BitWriter bits = { out, 0 };
+		bits.write(1 << 5, 6);
+		bits.write(0, 2);
+		for (int c = 0; c < 3; c++)
+		{
+			bits.write(q[0][c], 7);
+			bits.write(q[1][c], 7);
+		}
+		bits.write(a[0], 8);
+		bits.write(a[1], 8);
+		for (int t = 0; t < 16; t++)
+			bits.write(colorMap[block.selectors >> (2 * t) & 3], t == 0 ? 1 : 2);
+		for (int t = 0; t < 16; t++)
+			bits.write(alphaMap[indices[t]], t == 0 ? 1 : 2);
+	}
+
+	// the planes of one level: base colours, tables, selectors, then alpha blocks
+	// ------------------------------------------------------------------------
+	inline size_t levelPlaneBytes(int blocks, bool alpha)
+	{
+		return (size_t)blocks * (2 + 1 + 4 + (alpha ? 8 : 0));
+	}
+	// ------------------------------------------------------------------------
+	inline std::vector<unsigned char> encodeLevel(const unsigned char *rgba, int width, int height, bool alpha)
+	{
+		int bw = (width + 3) / 4, bh = (height + 3) / 4, blocks = bw * bh;
+		std::vector<unsigned char> planes(levelPlaneBytes(blocks, alpha));
+		unsigned char *colors = &planes[0], *tables = colors + blocks * 2, *selectors = tables + blocks, *alphas = selectors + blocks * 4;
+		unsigned char texels[64];
+		for (int by = 0; by < bh; by++)
+		{
+			for (int bx = 0; bx < bw; bx++)
+			{
+				// edge blocks repeat the last row and column
+				for (int y = 0; y < 4; y++)
+					for (int x = 0; x < 4; x++)
+						std::memcpy(texels + (y * 4 + x) * 4, rgba + ((size_t)std::min(by * 4 + y, height - 1) * width + std::min(bx * 4 + x, width - 1)) * 4, 4);
+				int b = by * bw + bx;
+				ColorBlock block = encodeColor(texels);
+				std::memcpy(colors + b * 2, &block.color, 2);
+				tables[b] = block.table;
+				std::memcpy(selectors + b * 4, &block.selectors, 4);
+				if (alpha)
+					encodeAlpha(texels, alphas + b * 8);
+			}
+		}
+		return planes;
+	}
+	// block rows first .. end of a level into the target's layout
+	// ------------------------------------------------------------------------
+	inline void transcodeRows(const unsigned char *planes, int width, int height, bool alpha, UniversalTarget target, unsigned char *out, int first, int end)
+	{
+		int bw = (width + 3) / 4, bh = (height + 3) / 4, blocks = bw * bh;
+		const unsigned char *colors = planes, *tables = colors + blocks * 2, *selectors = tables + blocks, *alphas = selectors + blocks * 4;
+		static const unsigned char opaque[8] = { 255, 1 << 4 | 13, 0x92, 0x49, 0x24, 0x92, 0x49, 0x24 };
+		int blockBytes = target == UNIVERSAL_TARGET_BC7 || alpha ? 16 : 8;
+		for (int by = first; by < end; by++)
+		{
+			for (int bx = 0; bx < bw; bx++)
+			{
+				int b = by * bw + bx;
+				ColorBlock block;
+				std::memcpy(&block.color, colors + b * 2, 2);
+				block.table = tables[b] & 7;
+				std::memcpy(&block.selectors, selectors + b * 4, 4);
+				const unsigned char *blockAlpha = alpha ? alphas + b * 8 : opaque;
+				unsigned char *dst = out + (size_t)b * blockBytes;
+				switch (target)
+				{
+				case UNIVERSAL_TARGET_BC7:
+					if (alpha)
+						bc7Alpha(block, blockAlpha, dst);
+					else
+						bc7Opaque(block, dst);
+					break;
+				case UNIVERSAL_TARGET_BC1_BC3:
+					if (alpha)
+						bc4Alpha(blockAlpha, dst);
+					bc1Color(block, dst + (alpha ? 8 : 0));
+					break;
+				case UNIVERSAL_TARGET_ETC2:
+					if (alpha)
+						std::memcpy(dst, blockAlpha, 8);
+					etc2Color(block, dst + (alpha ? 8 : 0));
+					break;
+				default:
+				{
+					int palette4[4][3];
+					palette(block, palette4);
+					for (int y = 0; y < 4 && by * 4 + y < height; y++)
+					{
+						for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+						{
+							unsigned char *texel = out + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4;
+							const int *color = palette4[block.selectors >> (2 * (y * 4 + x)) & 3];
+							texel[0] = (unsigned char)color[0];
+							texel[1] = (unsigned char)color[1];
+							texel[2] = (unsigned char)color[2];
+							texel[3] = (unsigned char)eacValue(blockAlpha, eacIndex(blockAlpha, x, y));
+						}
+					}
+				}
+				}
+			}
+		}
+	}
+}
+
+// ------------------------------------------------------------------------
+inline bool isUniversalTexture(const unsigned char *file, size_t size)
+{
+	return size >= sizeof(UniversalTextureHeader) && std::memcmp(file, "UTEX", 4) == 0;
+}
+inline bool isUniversalTexturePath(const std::string &path)
+{
+	return path.size() > 5 && path.compare(path.size() - 5, 5, ".utex") == 0;
+}
+// the file of a chain of RGBA8 levels (channels 4, not BGRA)
+// ------------------------------------------------------------------------
+inline std::vector<unsigned char> encodeUniversalTexture(const MipChain &chain)
+{
+	std::vector<unsigned char> file;
+	if (chain.levels.empty() || chain.format.channels != 4 || chain.format.format != GL_RGBA)
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::NOT_RGBA" << std::endl;
+		return file;
+	}
+	if (chain.width > (int)UNIVERSAL_TEXTURE_MAX_SIZE || chain.height > (int)UNIVERSAL_TEXTURE_MAX_SIZE)
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::TOO_LARGE " << chain.width << "x" << chain.height << std::endl;
+		return file;
+	}
+	bool alpha = false;
+	for (size_t t = 3; t < chain.levels[0].size() && !alpha; t += 4)
+		alpha = chain.levels[0][t] != 255;
+	UniversalTextureHeader header = { { 'U', 'T', 'E', 'X' }, UNIVERSAL_TEXTURE_VERSION, (unsigned int)chain.width, (unsigned int)chain.height,
+		(unsigned int)chain.levels.size(), alpha ? UNIVERSAL_ALPHA : 0u };
+	std::vector<std::vector<unsigned char> > packed;
+	for (size_t level = 0; level < chain.levels.size(); level++)
+		packed.push_back(lzCompress(utex::encodeLevel(&chain.levels[level][0], chain.levelWidth((int)level), chain.levelHeight((int)level), alpha)));
+	file.insert(file.end(), (const unsigned char*)&header, (const unsigned char*)&header + sizeof(header));
+	for (const std::vector<unsigned char> &level : packed)
+	{
+		unsigned int bytes = (unsigned int)level.size();
+		file.insert(file.end(), (const unsigned char*)&bytes, (const unsigned char*)&bytes + 4);
+	}
+	for (const std::vector<unsigned char> &level : packed)
+		file.insert(file.end(), level.begin(), level.end());
+	return file;
+}
+// decode an image with stb_image, build its mip chain and write it as a universal texture
+// ------------------------------------------------------------------------
+inline bool cookUniversalTexture(const std::string &sourcePath, const std::string &cookedPath, const MipSettings &settings = MipSettings())
+{
+	int width, height, channels;
+	unsigned char *data = stbi_load(sourcePath.c_str(), &width, &height, &channels, 4);
+	if (!data)
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::LOAD_FAILED " << sourcePath << std::endl;
+		return false;
+	}
+	MipSettings rgba = settings;
+	rgba.bgra = false;
+	std::vector<unsigned char> file = encodeUniversalTexture(buildMipChain(data, width, height, 4, rgba));
+	stbi_image_free(data);
+	std::ofstream out(cookedPath, std::ios::binary);
+	out.write((const char*)file.data(), file.size());
+	if (file.empty() || !out)
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::WRITE_FAILED " << cookedPath << std::endl;
+		return false;
+	}
+	return true;
+}
+// the cooked .utex next to an image when there is one that is not older than the image,
+// else the image itself
+// ------------------------------------------------------------------------
+inline std::string cookedTexturePath(const std::string &sourcePath)
+{
+	std::string cooked = sourcePath.substr(0, sourcePath.find_last_of('.')) + ".utex";
+	struct stat source, utex;
+	if (stat(cooked.c_str(), &utex) != 0)
+		return sourcePath;
+	if (stat(sourcePath.c_str(), &source) == 0 && source.st_mtime > utex.st_mtime)
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::OUT_OF_DATE " << cooked << ", loading " << sourcePath << " instead" << std::endl;
+		return sourcePath;
+	}
+	return cooked;
+}
+
+// transcode a universal texture file in memory into target, on `threads` threads (0: one
+// per hardware thread); an empty chain when the file is damaged
+// ------------------------------------------------------------------------
+inline MipChain decodeUniversalTexture(const unsigned char *file, size_t size, const std::string &name, UniversalTarget target, unsigned int threads = 1)
+{
+	MipChain chain;
+	UniversalTextureHeader header;
+	if (!isUniversalTexture(file, size))
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::NOT_UNIVERSAL " << name << std::endl;
+		return chain;
+	}
+	std::memcpy(&header, file, sizeof(header));
+	size_t offset = sizeof(header) + header.levels * 4;
+	if (header.version != UNIVERSAL_TEXTURE_VERSION || offset > size
+		|| header.width == 0 || header.width > UNIVERSAL_TEXTURE_MAX_SIZE || header.height == 0 || header.height > UNIVERSAL_TEXTURE_MAX_SIZE
+		|| header.levels == 0 || header.levels > (unsigned int)mipLevelCount((int)header.width, (int)header.height))
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::BAD_HEADER " << name << std::endl;
+		return chain;
+	}
+	if (threads == 0)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	bool alpha = (header.flags & UNIVERSAL_ALPHA) != 0;
+	chain.width = (int)header.width;
+	chain.height = (int)header.height;
+	chain.format = universalFormat(target, alpha);
+	std::vector<unsigned char> planes;
+	for (unsigned int level = 0; level < header.levels; level++)
+	{
+		unsigned int packedBytes;
+		std::memcpy(&packedBytes, file + sizeof(header) + level * 4, 4);
+		int w = chain.levelWidth((int)level), h = chain.levelHeight((int)level);
+		planes.resize(utex::levelPlaneBytes(((w + 3) / 4) * ((h + 3) / 4), alpha));
+		if (packedBytes > size - offset || !lzDecompress(file + offset, packedBytes, &planes[0], planes.size()))
+		{
+			std::cout << "ERROR::UNIVERSAL_TEXTURE::CORRUPT_LEVEL " << level << " of " << name << std::endl;
+			return MipChain();
+		}
+		offset += packedBytes;
+		chain.levels.push_back(std::vector<unsigned char>(textureLevelBytes(chain.format.internalFormat, w, h)));
+		unsigned char *out = &chain.levels.back()[0];
+		const unsigned char *source = &planes[0];
+		parallelRows((h + 3) / 4, threads, [&](int first, int end) { utex::transcodeRows(source, w, h, alpha, target, out, first, end); });
+	}
+	return chain;
+}
+// ------------------------------------------------------------------------
+inline MipChain loadUniversalTexture(const std::string &path, UniversalTarget target, unsigned int threads = 1)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (file.empty())
+	{
+		std::cout << "ERROR::UNIVERSAL_TEXTURE::LOAD_FAILED " << path << std::endl;
+		return MipChain();
+	}
+	return decodeUniversalTexture(&file[0], file.size(), path, target, threads);
+}
+// the same on a worker thread; target comes from universalTarget() on the GL thread
+inline std::future<MipChain> loadUniversalTextureAsync(const std::string &path, UniversalTarget target)
+{
+	return std::async(std::launch::async, [path, target]() { return loadUniversalTexture(path, target); });
+}
+
+// Cook an image, then transcode it into every target: throughput on one core and on every
+// hardware thread, the video memory of the result, and its PSNR against the source image
+// as the driver decodes it (targets the context cannot sample are transcoded only).
+// ------------------------------------------------------------------------
+inline void benchmarkUniversalTexture(const char *path, unsigned int repeats)
+{
+	const char *cookedPath = "benchmark.utex";
+	BenchmarkTimer timer;
+	if (!cookUniversalTexture(path, cookedPath))
+		return;
+	double cookMs = timer.elapsedMs();
+	std::ifstream in(cookedPath, std::ios::binary);
+	std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	std::remove(cookedPath);
+	int width, height, channels;
+	unsigned char *source = stbi_load(path, &width, &height, &channels, 4);
+	if (!source)
+		return;
+	std::ifstream original(path, std::ios::binary | std::ios::ate);
+	printBenchmarkResult("UNIVERSAL_TEXTURE::COOK", cookMs, "ms, " + std::to_string(file.size() / 1024) + " KiB cooked from "
+		+ std::to_string((size_t)original.tellg() / 1024) + " KiB");
+
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	UniversalTarget targets[4] = { UNIVERSAL_TARGET_BC7, UNIVERSAL_TARGET_BC1_BC3, UNIVERSAL_TARGET_ETC2, UNIVERSAL_TARGET_RGBA8 };
+	for (UniversalTarget target : targets)
+	{
+		MipChain chain;
+		timer.restart();
+		for (unsigned int r = 0; r < repeats; r++)
+			chain = decodeUniversalTexture(&file[0], file.size(), path, target, 1);
+		double oneMs = timer.elapsedMs() / repeats;
+		timer.restart();
+		for (unsigned int r = 0; r < repeats; r++)
+			chain = decodeUniversalTexture(&file[0], file.size(), path, target, cores);
+		double allMs = timer.elapsedMs() / repeats;
+		double texels = 0.0;
+		size_t bytes = 0;
+		for (size_t level = 0; level < chain.levels.size(); level++)
+		{
+			texels += (double)chain.levelWidth((int)level) * chain.levelHeight((int)level);
+			bytes += chain.levels[level].size();
+		}
+
+		// formats the context lacks are transcoded only, an upload would fail
+		bool sampled = universalTargetSupported(target);
+		while (glGetError() != GL_NO_ERROR)
+			;
+		Texture texture = sampled ? createTexture(chain) : Texture();
+		std::string quality = "not sampled by this context";
+		if (sampled && glGetError() != GL_NO_ERROR)
+			quality = "upload failed";
+		else if (sampled && !chain.levels.empty())
+		{
+			std::vector<unsigned char> decoded((size_t)width * height * 4);
+			glPixelStorei(GL_PACK_ALIGNMENT, 4);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &decoded[0]);
+			double squared = 0.0;
+			for (size_t i = 0; i < decoded.size(); i++)
+				if (i % 4 != 3 || channels == 4)
+					squared += (double)(decoded[i] - source[i]) * (decoded[i] - source[i]);
+			double mse = squared / ((double)width * height * (channels == 4 ? 4 : 3));
+			char psnr[32];
+			std::snprintf(psnr, sizeof(psnr), "%.1f", mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0);
+			quality = std::string(psnr) + " dB PSNR";
+		}
+		std::string name = std::string("UNIVERSAL_TEXTURE::") + universalTargetName(target);
+		printBenchmarkResult(name + "_ONE_CORE", texels / 1e6 / (oneMs / 1000.0), "Mtexel/s, " + std::to_string(oneMs) + " ms per chain");
+		printBenchmarkResult(name + "_ALL_CORES", texels / 1e6 / (allMs / 1000.0), "Mtexel/s on " + std::to_string(cores) + " threads");
+		printBenchmarkResult(name + "_VRAM", bytes / 1024.0, "KiB, " + quality);
+		texture.release();
+	}
+	stbi_image_free(source);
+}
+#endif
@@ -0,0 +1,275 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "meshOptimizer.h"
+#include "shaderProgram.h"
+#include "uniformBlocks.h"
+#include "benchmark.h"
+
+// How texture coordinates are stored in a packed vertex
+enum UvEncoding
+{
+	UV_UNORM16,  // only valid when every coordinate is inside [0, 1]
+	UV_HALF
+};
+
+// Mesh with quantized vertices, decoded by packedVertexShader.vs:
+//   position  3 x unorm16 relative to the bounding box (+ 2 bytes padding)
+//   uv        2 x unorm16 or 2 x half float
+//   normal    2 x snorm16 octahedral (only when the source mesh has normals)
+struct PackedMesh
+{
+	std::vector<unsigned char> vertices;
+	std::vector<unsigned int> indices;
+	unsigned int stride;
+	UvEncoding uvEncoding;
+	bool hasNormals;
+	glm::vec3 boundsMin;
+	glm::vec3 boundsExtent;
+};
+
+// IEEE half precision conversion, rounds to nearest and flushes denormals to zero
+// ------------------------------------------------------------------------
+inline unsigned short floatToHalf(float value)
+{
+	unsigned int bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	unsigned int sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = bits & 0x7FFFFF;
+	if (exponent <= 0)
+		return (unsigned short)sign;
+	if (exponent >= 31)
+		return (unsigned short)(sign | 0x7C00);
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+	// round to nearest, a carry into the exponent is still the correct result
+	if (mantissa & 0x1000)
+		half++;
+	return (unsigned short)half;
+}
+// ------------------------------------------------------------------------
+inline unsigned short quantizeUnorm16(float value)
+{
+	value = std::min(std::max(value, 0.0f), 1.0f);
+	return (unsigned short)(value * 65535.0f + 0.5f);
+}
+// ------------------------------------------------------------------------
+inline short quantizeSnorm16(float value)
+{
+	value = std::min(std::max(value, -1.0f), 1.0f);
+	return (short)std::floor(value * 32767.0f + 0.5f);
+}
+// map a unit normal onto the octahedron and unfold it into [-1, 1]^2
+// ------------------------------------------------------------------------
+inline glm::vec2 encodeOctahedral(glm::vec3 n)
+{
+	n = n / (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+	glm::vec2 result(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		result.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		result.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return result;
+}
+
+// Quantize a float mesh. uvOffset/normalOffset are float offsets inside the source
+// vertex, normalOffset < 0 means the mesh has no normals. UV_UNORM16 falls back to
+// half floats when a coordinate lies outside [0, 1] (e.g. repeating textures).
+// ------------------------------------------------------------------------
+inline PackedMesh packMesh(const Mesh &mesh, unsigned int uvOffset, int normalOffset = -1, UvEncoding uvEncoding = UV_UNORM16)
+{
+	PackedMesh packed;
+	packed.indices = mesh.indices;
+	packed.hasNormals = normalOffset >= 0;
+	packed.stride = packed.hasNormals ? 16 : 12;
+
+	glm::vec3 lo(1e30f), hi(-1e30f);
+	bool uvInUnitRange = true;
+	for (unsigned int v = 0; v < mesh.vertexCount(); v++)
+	{
+		lo = glm::min(lo, mesh.position(v));
+		hi = glm::max(hi, mesh.position(v));
+		const float *uv = &mesh.vertices[v * mesh.floatsPerVertex + uvOffset];
+		if (uv[0] < 0.0f || uv[0] > 1.0f || uv[1] < 0.0f || uv[1] > 1.0f)
+			uvInUnitRange = false;
+	}
+	packed.uvEncoding = (uvEncoding == UV_UNORM16 && uvInUnitRange) ? UV_UNORM16 : UV_HALF;
+	packed.boundsMin = lo;
+	packed.boundsExtent = glm::max(hi - lo, glm::vec3(1e-6f));
+
+	packed.vertices.resize(mesh.vertexCount() * packed.stride);
+	for (unsigned int v = 0; v < mesh.vertexCount(); v++)
+	{
+		unsigned short *out = (unsigned short*)&packed.vertices[v * packed.stride];
+		glm::vec3 p = (mesh.position(v) - packed.boundsMin) / packed.boundsExtent;
+		out[0] = quantizeUnorm16(p.x);
+		out[1] = quantizeUnorm16(p.y);
+		out[2] = quantizeUnorm16(p.z);
+		out[3] = 0;
+		const float *uv = &mesh.vertices[v * mesh.floatsPerVertex + uvOffset];
+		if (packed.uvEncoding == UV_UNORM16)
+		{
+			out[4] = quantizeUnorm16(uv[0]);
+			out[5] = quantizeUnorm16(uv[1]);
+		}
+		else
+		{
+			out[4] = floatToHalf(uv[0]);
+			out[5] = floatToHalf(uv[1]);
+		}
+		if (packed.hasNormals)
+		{
+			const float *n = &mesh.vertices[v * mesh.floatsPerVertex + normalOffset];
+			glm::vec2 oct = encodeOctahedral(glm::normalize(glm::vec3(n[0], n[1], n[2])));
+			short *normal = (short*)(out + 6);
+			normal[0] = quantizeSnorm16(oct.x);
+			normal[1] = quantizeSnorm16(oct.y);
+		}
+	}
+	return packed;
+}
+
+// attribute pointers for a packed mesh on the currently bound VAO and GL_ARRAY_BUFFER,
+// uses the same locations as the float layout (0 position, 1 uv, 2 normal)
+// ------------------------------------------------------------------------
+inline void setupPackedAttributes(const PackedMesh &mesh, size_t baseOffset = 0)
+{
+	// position attribute
+	glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, mesh.stride, (void*)baseOffset);
+	glEnableVertexAttribArray(0);
+	// texture coord attribute
+	if (mesh.uvEncoding == UV_UNORM16)
+		glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE, mesh.stride, (void*)(baseOffset + 8));
+	else
+		glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, mesh.stride, (void*)(baseOffset + 8));
+	glEnableVertexAttribArray(1);
+	// octahedral normal attribute
+	if (mesh.hasNormals)
+	{
+		glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, mesh.stride, (void*)(baseOffset + 12));
+		glEnableVertexAttribArray(2);
+	}
+}
+// bounding box uniforms packedVertexShader.vs needs to decode positions
+// ------------------------------------------------------------------------
+inline void setPackedMeshUniforms(Shader &shader, const PackedMesh &mesh)
+{
+	shader.setVec3("boundsMin", mesh.boundsMin);
+	shader.setVec3("boundsExtent", mesh.boundsExtent);
+}
+
+// a rippled grid, large enough that vertex fetch shows up in the draw time
+// ------------------------------------------------------------------------
+inline Mesh makeGridMesh(unsigned int cells)
+{
+	Mesh mesh;
+	mesh.floatsPerVertex = 5;
+	for (unsigned int y = 0; y <= cells; y++)
+	{
+		for (unsigned int x = 0; x <= cells; x++)
+		{
+			float u = (float)x / cells, v = (float)y / cells;
+			float vertex[5] = { u * 2.0f - 1.0f, v * 2.0f - 1.0f, 0.1f * std::sin(u * 40.0f) * std::cos(v * 40.0f), u, v };
+			mesh.vertices.insert(mesh.vertices.end(), vertex, vertex + 5);
+		}
+	}
+	for (unsigned int y = 0; y < cells; y++)
+	{
+		for (unsigned int x = 0; x < cells; x++)
+		{
+			unsigned int i = y * (cells + 1) + x;
+			unsigned int quad[6] = { i, i + 1, i + cells + 2, i, i + cells + 2, i + cells + 1 };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+	return mesh;
+}
+
+// Draw the same grid with the float layout and the packed layout and compare vertex
+// buffer size and GPU draw time (GL_TIME_ELAPSED queries).
+// ------------------------------------------------------------------------
+inline void benchmarkVertexFormats(unsigned int cells, unsigned int draws)
+{
+	Mesh mesh = makeGridMesh(cells);
+	PackedMesh packed = packMesh(mesh, 3);
+
+	Shader floatShader("basicVertexShader.vs", "textureFragment.fs");
+	Shader packedShader("packedVertexShader.vs", "textureFragment.fs");
+
+	unsigned int VAO[2], VBO[2], EBO;
+	glGenVertexArrays(2, VAO);
+	glGenBuffers(2, VBO);
+	glGenBuffers(1, &EBO);
+
+	glBindVertexArray(VAO[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO[0]);
+	glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(float), &mesh.vertices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), &mesh.indices[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+
+	glBindVertexArray(VAO[1]);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO[1]);
+	glBufferData(GL_ARRAY_BUFFER, packed.vertices.size(), &packed.vertices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	setupPackedAttributes(packed);
+
+	// both programs read the model matrix from the Object block and the camera from the Camera block
+	glm::mat4 model(1.0f);
+	glm::mat4 view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -3.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	CameraBlock camera = makeCameraBlock(view, projection, 0.0f, 0.0f, 800, 600);
+	unsigned int blocks[2];
+	glGenBuffers(2, blocks);
+	glBindBuffer(GL_UNIFORM_BUFFER, blocks[0]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), &model[0][0], GL_STATIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, blocks[0]);
+	glBindBuffer(GL_UNIFORM_BUFFER, blocks[1]);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), &camera, GL_STATIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, blocks[1]);
+
+	unsigned int query;
+	glGenQueries(1, &query);
+	size_t vertexBytes[2] = { mesh.vertices.size() * sizeof(float), packed.vertices.size() };
+	const char *names[2] = { "VERTEX_FORMAT::FLOAT", "VERTEX_FORMAT::PACKED" };
+	for (int layout = 0; layout < 2; layout++)
+	{
+		Shader &shader = layout == 0 ? floatShader : packedShader;
+		shader.use();
+		if (layout == 1)
+			setPackedMeshUniforms(shader, packed);
+		glBindVertexArray(VAO[layout]);
+
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		for (unsigned int d = 0; d < draws; d++)
+			glDrawElements(GL_TRIANGLES, (GLsizei)mesh.indices.size(), GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_TIME_ELAPSED);
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+
+		printBenchmarkResult(std::string(names[layout]) + "::BYTES_PER_VERTEX", (double)vertexBytes[layout] / mesh.vertexCount(), "bytes");
+		printBenchmarkResult(std::string(names[layout]) + "::VERTEX_BUFFER", (double)vertexBytes[layout] / 1024.0, "KiB");
+		printBenchmarkResult(std::string(names[layout]) + "::DRAW_TIME", nanoseconds / 1e6 / draws, "ms/draw");
+	}
+	glDeleteQueries(1, &query);
+	glDeleteVertexArrays(2, VAO);
+	glDeleteBuffers(2, VBO);
+	glDeleteBuffers(1, &EBO);
+	glDeleteBuffers(2, blocks);
+	glDeleteProgram(floatShader.ID);
+	glDeleteProgram(packedShader.ID);
+}
+#endif
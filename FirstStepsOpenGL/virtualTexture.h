@@ -0,0 +1,752 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <iostream>
+
+#include "texture.h"
+#include "lzCodec.h"
+#include "shaderProgram.h"
+#include "shaderPermutations.h"
+#include "uniformBlocks.h"
+#include "benchmark.h"
+
+// A page file holds one large texture cut into square pages for every mip level:
+//   PageFileHeader
+//   a PageFileEntry per page, level 0 first, each level's pages in rows
+//   the pages, (pageSize + 2 * border)^2 RGBA8 texels each, LZ compressed (lzCodec.h)
+// Pages carry `border` texels of their neighbours, clamped at the edges of the texture,
+// so bilinear filtering inside the page cache never reads into another page.
+struct PageFileHeader
+{
+	char magic[4];            // "VTPF"
+	unsigned int version;
+	unsigned int width;       // of level 0, in texels
+	unsigned int height;
+	unsigned int pageSize;    // texels of a page without its border
+	unsigned int border;
+	unsigned int levels;
+	unsigned int pageCount;
+};
+struct PageFileEntry
+{
+	unsigned long long offset;
+	unsigned int bytes;
+	unsigned int reserved;
+};
+const unsigned int PAGE_FILE_VERSION = 1;
+// largest pageSize and border, a damaged header must not size the page buffers
+const unsigned int PAGE_FILE_MAX_PAGE_SIZE = 1024;
+
+namespace vt
+{
+	// ------------------------------------------------------------------------
+	inline bool powerOfTwo(int n)
+	{
+		return n > 0 && (n & (n - 1)) == 0;
+	}
+	// first page of every level in the page file, the page count last
+	inline std::vector<int> levelStarts(int pagesX, int pagesY, int levels)
+	{
+		std::vector<int> starts(1, 0);
+		for (int level = 0; level < levels; level++)
+			starts.push_back(starts.back() + (pagesX >> level) * (pagesY >> level));
+		return starts;
+	}
+	// as many levels as the shorter side has halvings in pages
+	inline int levelCount(int pagesX, int pagesY)
+	{
+		int levels = 1;
+		while ((pagesX >> levels) > 0 && (pagesY >> levels) > 0)
+			levels++;
+		return levels;
+	}
+	// the header was written by cookVirtualTexture, its sizes can be trusted
+	// ------------------------------------------------------------------------
+	inline bool validHeader(const PageFileHeader &header)
+	{
+		if (header.pageSize == 0 || header.pageSize > PAGE_FILE_MAX_PAGE_SIZE || header.border > header.pageSize
+			|| header.width % header.pageSize || header.height % header.pageSize)
+			return false;
+		unsigned int pagesX = header.width / header.pageSize, pagesY = header.height / header.pageSize;
+		if (pagesX > 256 || pagesY > 256 || !powerOfTwo((int)pagesX) || !powerOfTwo((int)pagesY))
+			return false;
+		int levels = levelCount((int)pagesX, (int)pagesY);
+		return header.levels == (unsigned int)levels && header.pageCount == (unsigned int)levelStarts((int)pagesX, (int)pagesY, levels).back();
+	}
+	// 2x2 box filter of an RGBA8 level with even sides
+	// ------------------------------------------------------------------------
+	inline std::vector<unsigned char> halve(const std::vector<unsigned char> &src, int width, int height)
+	{
+		int w = width / 2, h = height / 2;
+		std::vector<unsigned char> dst((size_t)w * h * 4);
+		for (int y = 0; y < h; y++)
+		{
+			const unsigned char *row0 = &src[(size_t)(2 * y) * width * 4];
+			const unsigned char *row1 = row0 + (size_t)width * 4;
+			unsigned char *out = &dst[(size_t)y * w * 4];
+			for (int x = 0; x < w * 4; x++)
+			{
+				int c = (x / 4) * 8 + x % 4;
+				out[x] = (unsigned char)((row0[c] + row0[c + 4] + row1[c] + row1[c + 4] + 2) >> 2);
+			}
+		}
+		return dst;
+	}
+}
+
+// Cut a tightly packed RGBA8 image into a page file. The sides must be pageSize times a
+// power of two; there are as many levels as the shorter side has halvings in pages, so
+// every level is a whole number of pages. At most 256 pages a side, the feedback pass
+// writes page coordinates as bytes, and pages of at most PAGE_FILE_MAX_PAGE_SIZE texels
+// with a border no wider than a page.
+// ------------------------------------------------------------------------
+inline bool cookVirtualTexture(const unsigned char *rgba, int width, int height, const std::string &pagePath, int pageSize = 128, int border = 4)
+{
+	int pagesX = pageSize > 0 ? width / pageSize : 0, pagesY = pageSize > 0 ? height / pageSize : 0;
+	if (pageSize <= 0 || pageSize > (int)PAGE_FILE_MAX_PAGE_SIZE || border < 0 || border > pageSize
+		|| width % pageSize || height % pageSize || !vt::powerOfTwo(pagesX) || !vt::powerOfTwo(pagesY) || pagesX > 256 || pagesY > 256)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_SIZE " << width << "x" << height << " in pages of " << pageSize << std::endl;
+		return false;
+	}
+	std::ofstream file(pagePath, std::ios::binary);
+	if (!file)
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::WRITE_FAILED " << pagePath << std::endl;
+		return false;
+	}
+	int levels = vt::levelCount(pagesX, pagesY);
+	std::vector<int> starts = vt::levelStarts(pagesX, pagesY, levels);
+	PageFileHeader header = { { 'V', 'T', 'P', 'F' }, PAGE_FILE_VERSION, (unsigned int)width, (unsigned int)height,
+		(unsigned int)pageSize, (unsigned int)border, (unsigned int)levels, (unsigned int)starts.back() };
+	std::vector<PageFileEntry> entries(starts.back());
+	// the index is written again once the page offsets are known
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)&entries[0], entries.size() * sizeof(PageFileEntry));
+
+	int physical = pageSize + 2 * border;
+	std::vector<unsigned char> level(rgba, rgba + (size_t)width * height * 4), page((size_t)physical * physical * 4);
+	unsigned long long offset = sizeof(header) + entries.size() * sizeof(PageFileEntry);
+	for (int l = 0; l < levels; l++)
+	{
+		int w = width >> l, h = height >> l;
+		if (l > 0)
+			level = vt::halve(level, w * 2, h * 2);
+		for (int py = 0; py < (pagesY >> l); py++)
+		{
+			for (int px = 0; px < (pagesX >> l); px++)
+			{
+				for (int y = 0; y < physical; y++)
+				{
+					int sy = std::min(std::max(py * pageSize + y - border, 0), h - 1);
+					for (int x = 0; x < physical; x++)
+					{
+						int sx = std::min(std::max(px * pageSize + x - border, 0), w - 1);
+						std::memcpy(&page[((size_t)y * physical + x) * 4], &level[((size_t)sy * w + sx) * 4], 4);
+					}
+				}
+				std::vector<unsigned char> packed = lzCompress(page);
+				PageFileEntry &entry = entries[starts[l] + py * (pagesX >> l) + px];
+				entry.offset = offset;
+				entry.bytes = (unsigned int)packed.size();
+				file.write((const char*)&packed[0], packed.size());
+				offset += packed.size();
+			}
+		}
+	}
+	file.seekp(sizeof(header));
+	file.write((const char*)&entries[0], entries.size() * sizeof(PageFileEntry));
+	return file.good();
+}
+
+// numbers of one VirtualTexture::update()
+struct VirtualTextureStats
+{
+	unsigned int requested = 0;      // distinct pages in the feedback read back
+	unsigned int hits = 0;           // of those, already in the cache
+	unsigned int uploads = 0;        // pages loaded into the cache
+	unsigned int evictions = 0;
+	size_t uploadBytes = 0;          // pages and page table
+	unsigned int residentPages = 0;
+	unsigned int feedbackLatency = 0;  // frames from the feedback pass to its readback
+};
+
+// Samples a page file far larger than video memory through a fixed cache of pages.
+// Every frame the scene is drawn once more into a small framebuffer with the
+// VIRTUAL_TEXTURE_FEEDBACK variant of textureFragment.fs, which writes the page each
+// fragment needs. The framebuffer is read into a pixel buffer and mapped frames later,
+// once its fence has passed, so the readback never stalls the GPU. update() loads the
+// missing pages, coarse levels first, into the least recently needed cache slots with
+// glTexSubImage2D and rewrites the page table: a texel per page of every level, pointing
+// at the page or, while it is not resident, at its finest resident ancestor. The pages
+// of the coarsest level are loaded up front and never evicted, so there always is one.
+//
+//   VirtualTexture world("world.pages");
+//   world.beginFeedback(width, height);   // draw with the feedback variant and world.bind(shader, true)
+//   world.endFeedback();
+//   ...                                   // draw with the VIRTUAL_TEXTURE variant and world.bind(shader)
+//   world.update();
+class VirtualTexture
+{
+public:
+	// a cache of cacheSide x cacheSide pages, feedback at 1 / feedbackDivisor of the viewport
+	VirtualTexture(const std::string &pageFilePath, int cacheSide = 16, int feedbackDivisor = 8, unsigned int maxUploadsPerFrame = 16)
+		: path(pageFilePath), side(cacheSide), divisor(feedbackDivisor), maxUploads(maxUploadsPerFrame)
+	{
+		file.open(path, std::ios::binary);
+		file.read((char*)&header, sizeof(header));
+		if (!file || std::memcmp(header.magic, "VTPF", 4) != 0 || header.version != PAGE_FILE_VERSION || !vt::validHeader(header))
+		{
+			std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_PAGE_FILE " << path << std::endl;
+			return;
+		}
+		entries.resize(header.pageCount);
+		file.read((char*)&entries[0], entries.size() * sizeof(PageFileEntry));
+		pagesX = header.width / header.pageSize;
+		pagesY = header.height / header.pageSize;
+		levels = (int)header.levels;
+		starts = vt::levelStarts(pagesX, pagesY, levels);
+		physical = (int)(header.pageSize + 2 * header.border);
+		int topPages = starts[levels] - starts[levels - 1];
+		if (!file || topPages >= side * side)
+		{
+			std::cout << "ERROR::VIRTUAL_TEXTURE::BAD_PAGE_FILE " << path << std::endl;
+			return;
+		}
+
+		TextureSampling cacheSampling;
+		cacheSampling.wrap = GL_CLAMP_TO_EDGE;
+		cacheSampling.minFilter = GL_LINEAR;
+		cache.allocate(side * physical, side * physical, 1, textureFormat(4));
+		cacheSampling.apply();
+		TextureSampling tableSampling;
+		tableSampling.wrap = GL_CLAMP_TO_EDGE;
+		tableSampling.minFilter = GL_NEAREST_MIPMAP_NEAREST;
+		tableSampling.magFilter = GL_NEAREST;
+		table.allocate(pagesX, pagesY, levels, textureFormat(4));
+		tableSampling.apply();
+
+		pageSlot.assign(header.pageCount, -1);
+		lastUsed.assign(header.pageCount, 0);
+		slotPage.assign(side * side, -1);
+		for (int slot = side * side - 1; slot >= 0; slot--)
+			freeSlots.push_back(slot);
+		// the table falls back to these pages, without all of them the texture cannot be drawn
+		for (int page = starts[levels - 1]; page < starts[levels]; page++)
+		{
+			if (!load(page))
+			{
+				std::cout << "ERROR::VIRTUAL_TEXTURE::MISSING_COARSEST_PAGE " << page << " of " << path << std::endl;
+				return;
+			}
+		}
+		writeTable();
+		stats = VirtualTextureStats();
+		ready = true;
+	}
+	~VirtualTexture()
+	{
+		for (Readback &readback : readbacks)
+		{
+			if (readback.fence)
+				glDeleteSync(readback.fence);
+			if (readback.buffer)
+				glDeleteBuffers(1, &readback.buffer);
+		}
+		if (framebuffer)
+		{
+			glDeleteFramebuffers(1, &framebuffer);
+			glDeleteTextures(1, &feedbackColor);
+			glDeleteRenderbuffers(1, &feedbackDepth);
+		}
+		cache.release();
+		table.release();
+	}
+	VirtualTexture(const VirtualTexture&) = delete;
+	VirtualTexture &operator=(const VirtualTexture&) = delete;
+
+	// ------------------------------------------------------------------------
+	bool valid() const
+	{
+		return ready;
+	}
+	// bind and clear the feedback framebuffer, sized for a viewport of width x height
+	// ------------------------------------------------------------------------
+	void beginFeedback(int viewportWidth, int viewportHeight)
+	{
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+		glGetIntegerv(GL_VIEWPORT, previousViewport);
+		int w = std::max(1, viewportWidth / divisor), h = std::max(1, viewportHeight / divisor);
+		if (w != feedbackWidth || h != feedbackHeight)
+			createFeedback(w, h);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport(0, 0, w, h);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+	// queue the readback of the feedback and restore the framebuffer and viewport
+	// ------------------------------------------------------------------------
+	void endFeedback()
+	{
+		Readback &readback = readbacks[nextReadback];
+		nextReadback = (nextReadback + 1) % READBACKS;
+		if (readback.fence)
+		{
+			// update() fell behind by a whole ring, this feedback is lost
+			glDeleteSync(readback.fence);
+			readback.fence = (GLsync)0;
+			droppedFeedback++;
+		}
+		size_t bytes = (size_t)feedbackWidth * feedbackHeight * 4;
+		if (!readback.buffer)
+			glGenBuffers(1, &readback.buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		if (readback.bytes != bytes)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+			readback.bytes = bytes;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		readback.frame = frame;
+		glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+		glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+	}
+	// read back the feedback that is ready, load missing pages, update the page table
+	// ------------------------------------------------------------------------
+	void update()
+	{
+		if (!ready)
+			return;
+		stats = VirtualTextureStats();
+		requestCount.assign(header.pageCount, 0);
+		std::vector<int> requested;
+		for (int i = 0; i < READBACKS; i++)
+		{
+			Readback &readback = readbacks[(nextReadback + i) % READBACKS];
+			if (!readback.fence)
+				continue;
+			GLenum result = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+				continue;
+			glDeleteSync(readback.fence);
+			readback.fence = (GLsync)0;
+			stats.feedbackLatency = (unsigned int)(frame - readback.frame);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+			const unsigned char *pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.bytes, GL_MAP_READ_BIT);
+			if (pixels)
+				readFeedback(pixels, readback.bytes / 4, requested);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+
+		// coarse levels first, so a missing page falls back to as fine a page as possible
+		std::vector<int> missing;
+		for (int page : requested)
+		{
+			if (pageSlot[page] >= 0)
+				stats.hits++;
+			else
+				missing.push_back(page);
+		}
+		stats.requested = (unsigned int)requested.size();
+		std::sort(missing.begin(), missing.end(), [&](int a, int b)
+		{
+			int levelA = levelOf(a), levelB = levelOf(b);
+			return levelA != levelB ? levelA > levelB : requestCount[a] > requestCount[b];
+		});
+		for (int page : missing)
+		{
+			if (stats.uploads >= maxUploads || !load(page))
+				break;
+		}
+		if (stats.uploads)
+			writeTable();
+		stats.residentPages = (unsigned int)(slotPage.size() - freeSlots.size());
+		totalRequested += stats.requested;
+		totalHits += stats.hits;
+		totalUploads += stats.uploads;
+		totalUploadBytes += stats.uploadBytes;
+		frame++;
+	}
+	// bind the cache and the page table and set the uniforms of a VIRTUAL_TEXTURE variant,
+	// feedback for the VIRTUAL_TEXTURE_FEEDBACK one; shader must be in use
+	// ------------------------------------------------------------------------
+	void bind(const Shader &shader, bool feedback = false, unsigned int cacheUnit = 0, unsigned int tableUnit = 1) const
+	{
+		glActiveTexture(GL_TEXTURE0 + cacheUnit);
+		glBindTexture(GL_TEXTURE_2D, cache.ID);
+		glActiveTexture(GL_TEXTURE0 + tableUnit);
+		glBindTexture(GL_TEXTURE_2D, table.ID);
+		glActiveTexture(GL_TEXTURE0);
+		shader.setInt("pageCache", (int)cacheUnit);
+		shader.setInt("pageTable", (int)tableUnit);
+		// fragments of the feedback pass are divisor times larger, their level as much coarser
+		float bias = feedback ? -std::log2((float)divisor) : 0.0f;
+		shader.setVec4("virtualPages", glm::vec4((float)pagesX, (float)pagesY, (float)levels, bias));
+		shader.setVec4("virtualCache", glm::vec4((float)header.pageSize, (float)header.border, (float)physical, (float)(side * physical)));
+	}
+	// numbers of the last update()
+	const VirtualTextureStats &frameStats() const
+	{
+		return stats;
+	}
+	// video memory of the page cache and the page table
+	size_t bytes() const
+	{
+		return cache.bytes() + table.bytes();
+	}
+	// ------------------------------------------------------------------------
+	void printStats() const
+	{
+		std::cout << "VIRTUAL_TEXTURE::" << path << ": " << header.width << "x" << header.height << " in " << header.pageCount << " pages, "
+			<< stats.residentPages << " of " << side * side << " cache slots used, " << totalHits << " of " << totalRequested << " requested pages hit, "
+			<< totalUploads << " uploaded (" << totalUploadBytes / 1024 << " KiB), " << droppedFeedback << " feedback readbacks dropped" << std::endl;
+	}
+
+private:
+	static const int READBACKS = 3;
+	struct Readback
+	{
+		unsigned int buffer = 0;
+		size_t bytes = 0;
+		GLsync fence = (GLsync)0;
+		unsigned long long frame = 0;
+	};
+	std::string path;
+	std::ifstream file;
+	PageFileHeader header = PageFileHeader();
+	std::vector<PageFileEntry> entries;
+	std::vector<int> starts;       // first page of every level
+	int pagesX = 0, pagesY = 0, levels = 0, physical = 0;
+	int side;
+	int divisor;
+	unsigned int maxUploads;
+	bool ready = false;
+
+	Texture cache;
+	Texture table;
+	std::vector<int> pageSlot;     // cache slot of every page, -1 when not resident
+	std::vector<int> slotPage;
+	std::vector<int> freeSlots;
+	std::vector<unsigned long long> lastUsed;
+	std::vector<unsigned int> requestCount;
+	std::vector<unsigned char> pagePixels, packed;
+
+	unsigned int framebuffer = 0, feedbackColor = 0, feedbackDepth = 0;
+	int feedbackWidth = 0, feedbackHeight = 0;
+	GLint previousFramebuffer = 0;
+	GLint previousViewport[4] = { 0, 0, 0, 0 };
+	Readback readbacks[READBACKS];
+	int nextReadback = 0;
+	unsigned int droppedFeedback = 0;
+
+	unsigned long long frame = 1;
+	VirtualTextureStats stats;
+	unsigned long long totalRequested = 0, totalHits = 0, totalUploads = 0, totalUploadBytes = 0;
+
+	// ------------------------------------------------------------------------
+	int levelOf(int page) const
+	{
+		int level = 0;
+		while (page >= starts[level + 1])
+			level++;
+		return level;
+	}
+	// ------------------------------------------------------------------------
+	void createFeedback(int w, int h)
+	{
+		if (!framebuffer)
+		{
+			glGenFramebuffers(1, &framebuffer);
+			glGenTextures(1, &feedbackColor);
+			glGenRenderbuffers(1, &feedbackDepth);
+		}
+		glBindTexture(GL_TEXTURE_2D, feedbackColor);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::VIRTUAL_TEXTURE::FEEDBACK_FRAMEBUFFER_INCOMPLETE" << std::endl;
+		feedbackWidth = w;
+		feedbackHeight = h;
+	}
+	// pages in one feedback image, each page once; requested pages and their ancestors
+	// count as used this frame
+	// ------------------------------------------------------------------------
+	void readFeedback(const unsigned char *pixels, size_t count, std::vector<int> &requested)
+	{
+		for (size_t i = 0; i < count; i++, pixels += 4)
+		{
+			if (!pixels[3])
+				continue;
+			int x = pixels[0], y = pixels[1], level = pixels[2];
+			if (level >= levels || x >= (pagesX >> level) || y >= (pagesY >> level))
+				continue;
+			int page = starts[level] + y * (pagesX >> level) + x;
+			if (requestCount[page]++)
+				continue;
+			requested.push_back(page);
+			for (; level < levels; level++, x >>= 1, y >>= 1)
+				lastUsed[starts[level] + y * (pagesX >> level) + x] = frame;
+		}
+	}
+	// read a page from the file into a free or the least recently used slot
+	// ------------------------------------------------------------------------
+	bool load(int page)
+	{
+		int slot = -1;
+		if (!freeSlots.empty())
+		{
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			// never the coarsest level, nor a page used this frame; finer levels go first
+			for (int s = 0; s < (int)slotPage.size(); s++)
+			{
+				int resident = slotPage[s];
+				if (resident >= starts[levels - 1] || lastUsed[resident] >= frame)
+					continue;
+				if (slot < 0 || lastUsed[resident] < lastUsed[slotPage[slot]]
+					|| (lastUsed[resident] == lastUsed[slotPage[slot]] && resident < slotPage[slot]))
+					slot = s;
+			}
+			if (slot < 0)
+				return false;
+			pageSlot[slotPage[slot]] = -1;
+			stats.evictions++;
+		}
+
+		const PageFileEntry &entry = entries[page];
+		packed.resize(entry.bytes);
+		pagePixels.resize((size_t)physical * physical * 4);
+		file.seekg((std::streamoff)entry.offset);
+		file.read((char*)&packed[0], entry.bytes);
+		if (!file || !lzDecompress(&packed[0], packed.size(), &pagePixels[0], pagePixels.size()))
+		{
+			std::cout << "ERROR::VIRTUAL_TEXTURE::CORRUPT_PAGE " << page << " of " << path << std::endl;
+			file.clear();
+			slotPage[slot] = -1;
+			freeSlots.push_back(slot);
+			return false;
+		}
+		glBindTexture(GL_TEXTURE_2D, cache.ID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % side) * physical, (slot / side) * physical, physical, physical, GL_RGBA, GL_UNSIGNED_BYTE, &pagePixels[0]);
+		slotPage[slot] = page;
+		pageSlot[page] = slot;
+		lastUsed[page] = frame;
+		stats.uploads++;
+		stats.uploadBytes += pagePixels.size();
+		return true;
+	}
+	// every level of the page table from the coarsest down, pages that are not resident
+	// take their parent's entry
+	// ------------------------------------------------------------------------
+	void writeTable()
+	{
+		std::vector<unsigned char> parent, entriesOfLevel;
+		for (int level = levels - 1; level >= 0; level--)
+		{
+			int w = pagesX >> level, h = pagesY >> level;
+			entriesOfLevel.resize((size_t)w * h * 4);
+			for (int y = 0; y < h; y++)
+			{
+				for (int x = 0; x < w; x++)
+				{
+					unsigned char *out = &entriesOfLevel[((size_t)y * w + x) * 4];
+					int slot = pageSlot[starts[level] + y * w + x];
+					if (slot >= 0)
+					{
+						out[0] = (unsigned char)(slot % side);
+						out[1] = (unsigned char)(slot / side);
+						out[2] = (unsigned char)level;
+						out[3] = 255;
+					}
+					else
+						std::memcpy(out, &parent[((size_t)(y / 2) * (w / 2) + x / 2) * 4], 4);
+				}
+			}
+			table.uploadLevel(level, &entriesOfLevel[0]);
+			stats.uploadBytes += entriesOfLevel.size();
+			parent.swap(entriesOfLevel);
+		}
+	}
+};
+
+// A 4096x4096 virtual texture of tinted container and awesomeface tiles on a 200 unit
+// ground plane, flown over low by a camera for `frames` frames at 800x600. The texture
+// with its mips would need 85 MiB; the cache holds 256 pages of 136x136 in 18 MiB.
+// Reported: frame time with the feedback pass, how many requested pages were already
+// resident and the upload bandwidth into the cache.
+// ------------------------------------------------------------------------
+inline void benchmarkVirtualTexture(unsigned int frames)
+{
+	const int size = 4096, tile = 512;
+	const char *files[2] = { ".\\resources\\texture\\container.jpg", ".\\resources\\texture\\awesomeface.jpg" };
+	int widths[2], heights[2], channels;
+	unsigned char *images[2];
+	for (int f = 0; f < 2; f++)
+		images[f] = stbi_load(files[f], &widths[f], &heights[f], &channels, 4);
+	if (!images[0] || !images[1])
+	{
+		std::cout << "ERROR::VIRTUAL_TEXTURE::LOAD_FAILED" << std::endl;
+		stbi_image_free(images[0]);
+		stbi_image_free(images[1]);
+		return;
+	}
+	std::vector<unsigned char> world((size_t)size * size * 4);
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			int t = (y / tile) * (size / tile) + x / tile, f = t % 2;
+			const unsigned char *src = images[f] + ((size_t)(y % tile % heights[f]) * widths[f] + x % tile % widths[f]) * 4;
+			unsigned char *dst = &world[((size_t)y * size + x) * 4];
+			for (int c = 0; c < 3; c++)
+				dst[c] = (unsigned char)(src[c] * (160 + (t * 37 + c * 53) % 96) / 255);
+			dst[3] = 255;
+		}
+	}
+	stbi_image_free(images[0]);
+	stbi_image_free(images[1]);
+
+	const char *pagePath = "virtualTexture.pages";
+	BenchmarkTimer timer;
+	bool cooked = cookVirtualTexture(&world[0], size, size, pagePath);
+	double cookMs = timer.elapsedMs();
+	world = std::vector<unsigned char>();
+	if (!cooked)
+		return;
+	std::ifstream cookedFile(pagePath, std::ios::binary | std::ios::ate);
+	double fileKiB = (double)cookedFile.tellg() / 1024.0;
+	cookedFile.close();
+
+	{
+		VirtualTexture virtualTexture(pagePath);
+		if (!virtualTexture.valid())
+			return;
+		ShaderPermutations permutations;
+		permutations.declare("texture", "basicVertexShader.vs", "textureFragment.fs");
+		ShaderDefines sampled, feedback;
+		sampled["VIRTUAL_TEXTURE"] = "1";
+		feedback["VIRTUAL_TEXTURE"] = "1";
+		feedback["VIRTUAL_TEXTURE_FEEDBACK"] = "1";
+		Shader &sampledShader = permutations.get("texture", sampled);
+		Shader &feedbackShader = permutations.get("texture", feedback);
+
+		// the ground, two triangles with the whole texture on them
+		float ground[] = {
+			-100.0f, 0.0f, -100.0f, 0.0f, 1.0f,   100.0f, 0.0f, -100.0f, 1.0f, 1.0f,   100.0f, 0.0f, 100.0f, 1.0f, 0.0f,
+			-100.0f, 0.0f, -100.0f, 0.0f, 1.0f,   100.0f, 0.0f, 100.0f, 1.0f, 0.0f,   -100.0f, 0.0f, 100.0f, 0.0f, 0.0f,
+		};
+		unsigned int vao, vbo, blocks[2];
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glGenBuffers(1, &vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(ground), ground, GL_STATIC_DRAW);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+		glEnableVertexAttribArray(1);
+		glGenBuffers(2, blocks);
+		glm::mat4 model(1.0f);
+		glBindBuffer(GL_UNIFORM_BUFFER, blocks[1]);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), &model, GL_STATIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, blocks[1]);
+		glBindBuffer(GL_UNIFORM_BUFFER, blocks[0]);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_STREAM_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, blocks[0]);
+
+		// an offscreen target so the benchmark does not depend on the window
+		const int width = 800, height = 600;
+		unsigned int target, color, depth;
+		glGenFramebuffers(1, &target);
+		glGenRenderbuffers(1, &color);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+		glViewport(0, 0, width, height);
+		glEnable(GL_DEPTH_TEST);
+
+		unsigned int requested = 0, hits = 0, uploads = 0;
+		size_t uploadBytes = 0;
+		timer.restart();
+		for (unsigned int f = 0; f < frames; f++)
+		{
+			// fly along the texture, 3 units up, looking ahead and down
+			float along = 90.0f - 180.0f * f / frames;
+			glm::vec3 eye(20.0f * std::sin(f * 0.02f), 3.0f, along);
+			glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.0f, -0.35f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)width / height, 0.1f, 300.0f);
+			CameraBlock camera = makeCameraBlock(view, projection, f / 60.0f, 1.0f / 60.0f, width, height);
+			glBindBuffer(GL_UNIFORM_BUFFER, blocks[0]);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &camera);
+
+			virtualTexture.beginFeedback(width, height);
+			feedbackShader.use();
+			virtualTexture.bind(feedbackShader, true);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+			virtualTexture.endFeedback();
+
+			glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			sampledShader.use();
+			virtualTexture.bind(sampledShader);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+			virtualTexture.update();
+
+			const VirtualTextureStats &stats = virtualTexture.frameStats();
+			requested += stats.requested;
+			hits += stats.hits;
+			uploads += stats.uploads;
+			uploadBytes += stats.uploadBytes;
+		}
+		glFinish();
+		double ms = timer.elapsedMs();
+
+		printBenchmarkResult("VIRTUAL_TEXTURE::COOK", cookMs, "ms, " + std::to_string((int)fileKiB) + " KiB page file");
+		printBenchmarkResult("VIRTUAL_TEXTURE::FRAME", ms / frames, "ms with the feedback pass");
+		printBenchmarkResult("VIRTUAL_TEXTURE::PAGE_HIT_RATE", requested ? 100.0 * hits / requested : 0.0, "% of " + std::to_string(requested / frames) + " pages/frame");
+		printBenchmarkResult("VIRTUAL_TEXTURE::UPLOADS", (double)uploads / frames, "pages/frame");
+		printBenchmarkResult("VIRTUAL_TEXTURE::UPLOAD_BANDWIDTH", uploadBytes / (1024.0 * 1024.0) / (ms / 1000.0), "MiB/s");
+		printBenchmarkResult("VIRTUAL_TEXTURE::VRAM", virtualTexture.bytes() / 1024.0, "KiB for the cache and page table");
+		virtualTexture.printStats();
+
+		glDisable(GL_DEPTH_TEST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &target);
+		glDeleteRenderbuffers(1, &color);
+		glDeleteRenderbuffers(1, &depth);
+		glDeleteBuffers(2, blocks);
+		glDeleteBuffers(1, &vbo);
+		glDeleteVertexArrays(1, &vao);
+	}
+	std::remove(pagePath);
+}
+#endif
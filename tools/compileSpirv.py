@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Compile the project's GLSL stages to optimized SPIR-V for GL_ARB_gl_spirv.
+
+Every stage listed in shaders.manifest is preprocessed the same way the application
+does it (#include "file", optional -D defines injected after #version), compiled with
+glslangValidator for OpenGL (-G) and run through a spirv-opt pass list. The module is
+written next to the source as <file>.spv, where Shader::load() looks for it.
+
+    python3 tools/compileSpirv.py                      # whole manifest
+    python3 tools/compileSpirv.py --no-opt textureFragment.fs
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+SHADER_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "FirstStepsOpenGL")
+
+STAGES = {".vs": "vert", ".fs": "frag", ".gs": "geom"}
+
+# roughly spirv-opt -O, spelled out so the list can be tuned and diffed
+OPT_PASSES = [
+    "--merge-return",
+    "--inline-entry-points-exhaustive",
+    "--eliminate-dead-functions",
+    "--private-to-local",
+    "--scalar-replacement=100",
+    "--ssa-rewrite",
+    "--ccp",
+    "--loop-unroll",
+    "--simplify-instructions",
+    "--redundancy-elimination",
+    "--eliminate-dead-branches",
+    "--merge-blocks",
+    "--eliminate-local-single-block",
+    "--eliminate-local-single-store",
+    "--copy-propagate-arrays",
+    "--vector-dce",
+    "--eliminate-dead-inserts",
+    "--eliminate-dead-code-aggressive",
+    "--eliminate-dead-variables",
+    "--cfg-cleanup",
+]
+
+# layout (binding) and layout (location) on uniforms need these below #version 420 / 430
+SPIRV_EXTENSIONS = (
+    "#extension GL_ARB_shading_language_420pack : enable\n"
+    "#extension GL_ARB_explicit_uniform_location : enable\n"
+)
+
+INCLUDE = re.compile(r'^\s*#include\s+"([^"]+)"')
+
+
+def expand_includes(path, seen):
+    """Same rules as ShaderPreprocessor: includes relative to the includer, each file once."""
+    seen.add(os.path.normpath(path))
+    lines = []
+    with open(path) as source:
+        for line in source:
+            match = INCLUDE.match(line)
+            if not match:
+                lines.append(line if line.endswith("\n") else line + "\n")
+                continue
+            included = os.path.join(os.path.dirname(path), match.group(1))
+            if os.path.normpath(included) not in seen:
+                lines.append(expand_includes(included, seen))
+    return "".join(lines)
+
+
+def preprocess(path, defines):
+    header = SPIRV_EXTENSIONS + "".join("#define %s %s\n" % item for item in sorted(defines.items()))
+    return insert_after_version(expand_includes(path, set()), header)
+
+
+def insert_after_version(text, header):
+    match = re.search(r"#version[^\n]*\n", text)
+    if not match:
+        return header + text
+    return text[:match.end()] + header + text[match.end():]
+
+
+def manifest_stages(manifest):
+    stages = []
+    with open(manifest) as entries:
+        for line in entries:
+            fields = line.split("#")[0].split()
+            for path in fields[1:4]:
+                if path not in stages:
+                    stages.append(path)
+    return stages
+
+
+def run(command):
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    return result.returncode, result.stdout
+
+
+def compile_stage(path, defines, args, scratch):
+    stage = STAGES.get(os.path.splitext(path)[1])
+    if stage is None:
+        print("ERROR::SPIRV::UNKNOWN_STAGE " + path)
+        return False
+    source = os.path.join(scratch, os.path.basename(path) + "." + stage)
+    with open(source, "w") as out:
+        out.write(preprocess(path, defines))
+    unoptimized = source + ".spv"
+    output = path + ".spv"
+
+    start = time.time()
+    code, log = run([args.glslang, "-G", "--auto-map-locations", "--auto-map-bindings",
+                     "-S", stage, "-o", unoptimized, source])
+    compile_ms = (time.time() - start) * 1000.0
+    if code != 0:
+        print("ERROR::SPIRV::COMPILE " + path + "\n" + log)
+        return False
+
+    start = time.time()
+    if args.no_opt:
+        shutil.copyfile(unoptimized, output)
+    else:
+        code, log = run([args.spirv_opt] + OPT_PASSES + [unoptimized, "-o", output])
+        if code != 0:
+            print("ERROR::SPIRV::OPTIMIZE " + path + "\n" + log)
+            return False
+    opt_ms = (time.time() - start) * 1000.0
+    print("%-28s %6d -> %6d bytes  compile %6.1f ms  opt %6.1f ms" % (
+        path, os.path.getsize(unoptimized), os.path.getsize(output), compile_ms, opt_ms))
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("stages", nargs="*", help="stage files, default: every stage of the manifest")
+    parser.add_argument("--dir", default=SHADER_DIR, help="shader directory (default: %(default)s)")
+    parser.add_argument("--manifest", default="shaders.manifest")
+    parser.add_argument("-D", dest="defines", action="append", default=[], help="NAME[=VALUE] to inject")
+    parser.add_argument("--glslang", default="glslangValidator")
+    parser.add_argument("--spirv-opt", default="spirv-opt")
+    parser.add_argument("--no-opt", action="store_true", help="write glslang's output unoptimized")
+    args = parser.parse_args()
+
+    for tool in [args.glslang] + ([] if args.no_opt else [args.spirv_opt]):
+        if shutil.which(tool) is None:
+            print("ERROR::SPIRV::TOOL_NOT_FOUND " + tool + " (Vulkan SDK or the glslang / spirv-tools packages)")
+            return 1
+
+    defines = dict((d.split("=", 1) + ["1"])[:2] for d in args.defines)
+    os.chdir(args.dir)
+    stages = args.stages or manifest_stages(args.manifest)
+    scratch = tempfile.mkdtemp(prefix="spirv")
+    try:
+        failed = [path for path in stages if not compile_stage(path, defines, args, scratch)]
+    finally:
+        shutil.rmtree(scratch)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+"""Static cost report for every shader stage and permutation, no GPU needed.
+
+Each stage of shaders.manifest (and the permutations listed below) is compiled to
+SPIR-V with glslangValidator and optimized with the same spirv-opt pass list the
+SPIR-V build step uses, so the numbers describe code close to what a driver sees.
+The module is then parsed directly and reported per stage:
+
+    instructions   every instruction inside function bodies
+    alu            arithmetic, conversion, comparison, bit and GLSL.std.450 operations
+    alu_scalar     the same weighted by vector width (a vec4 add counts 4)
+    texture        image sample, fetch and gather operations
+    branches       conditional branches, switches and discards
+    loops          loop headers
+    registers      peak number of vec4 registers live at once, from SSA live ranges
+                   over the instruction stream (control flow ignored, an estimate)
+
+Results are appended to tools/shaderCosts.csv keyed by the current git commit, and
+the report shows the change against the newest earlier commit in that file, so a
+regression shows up as a +N next to the stage.
+
+    python3 tools/shaderCostReport.py              # report, store and compare
+    python3 tools/shaderCostReport.py --no-store   # report only
+"""
+
+import argparse
+import csv
+import datetime
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from compileSpirv import OPT_PASSES, SHADER_DIR, STAGES, manifest_stages, preprocess, run  # noqa: E402
+
+COSTS_CSV = os.path.join(os.path.dirname(os.path.abspath(__file__)), "shaderCosts.csv")
+
+# define sets worth tracking besides the plain stage, see textureFragment.fs
+PERMUTATIONS = {
+    "basicVertexShader.vs": [
+        {"TEXTURE_ARRAY": "1"},
+    ],
+    "textureFragment.fs": [
+        {"SINGLE_TEXTURE": "1"},
+        {"VERTEX_COLOR": "1"},
+        {"SINGLE_TEXTURE": "1", "VERTEX_COLOR": "1"},
+        {"TEXTURE_ARRAY": "1"},
+        {"VIRTUAL_TEXTURE": "1"},
+        {"VIRTUAL_TEXTURE": "1", "VIRTUAL_TEXTURE_FEEDBACK": "1"},
+    ],
+}
+
+METRICS = ["instructions", "alu", "alu_scalar", "texture", "branches", "loops", "registers"]
+
+# SPIR-V opcodes, from the SPIR-V specification
+OP_EXT_INST = 12
+OP_TYPE_BOOL, OP_TYPE_INT, OP_TYPE_FLOAT, OP_TYPE_VECTOR, OP_TYPE_MATRIX = 20, 21, 22, 23, 24
+OP_FUNCTION, OP_FUNCTION_END = 54, 56
+OP_LABEL, OP_LOOP_MERGE = 248, 246
+OP_BRANCH_CONDITIONAL, OP_SWITCH, OP_KILL = 250, 251, 252
+TEXTURE_OPS = set(range(87, 99)) | set(range(305, 316))  # OpImageSample* .. OpImageRead, sparse variants
+ALU_OPS = (set(range(109, 125))      # conversions
+           | set(range(126, 153))    # arithmetic, matrix and vector products
+           | set(range(154, 162))    # any, all, isnan ...
+           | set(range(164, 192))    # logical and comparisons, select
+           | set(range(194, 206))    # shifts and bit operations
+           | set(range(207, 216))    # derivatives
+           | {OP_EXT_INST})          # GLSL.std.450: mix, dot, normalize ...
+# instructions in function bodies that produce no value
+NO_RESULT_OPS = {8, 56, 62, 63, 99, 218, 219, 224, 225, 246, 247, 249, 250, 251, 252, 253, 254, 317}
+
+
+def parse_spirv(data):
+    """Count the metrics of one SPIR-V module."""
+    words = struct.unpack("<%dI" % (len(data) // 4), data)
+    if words[0] != 0x07230203:
+        raise ValueError("not a SPIR-V module")
+    costs = dict((metric, 0) for metric in METRICS)
+    components = {}   # type id -> scalar components
+    position = 5
+    function = None   # instructions of the current function body
+    while position < len(words):
+        count, opcode = words[position] >> 16, words[position] & 0xFFFF
+        operands = words[position + 1:position + count]
+        position += max(count, 1)
+
+        if opcode in (OP_TYPE_BOOL, OP_TYPE_INT, OP_TYPE_FLOAT):
+            components[operands[0]] = 1
+        elif opcode in (OP_TYPE_VECTOR, OP_TYPE_MATRIX):
+            components[operands[0]] = components.get(operands[1], 1) * operands[2]
+        elif opcode == OP_FUNCTION:
+            function = []
+        elif opcode == OP_FUNCTION_END:
+            costs["registers"] = max(costs["registers"], register_pressure(function, components))
+            function = None
+        elif function is not None:
+            function.append((opcode, operands))
+            if opcode == OP_LABEL:
+                continue
+            costs["instructions"] += 1
+            if opcode in TEXTURE_OPS:
+                costs["texture"] += 1
+            elif opcode in ALU_OPS:
+                costs["alu"] += 1
+                costs["alu_scalar"] += components.get(operands[0], 1)
+            elif opcode in (OP_BRANCH_CONDITIONAL, OP_SWITCH, OP_KILL):
+                costs["branches"] += 1
+            elif opcode == OP_LOOP_MERGE:
+                costs["loops"] += 1
+    return costs
+
+
+def register_pressure(function, components):
+    """Peak live scalar components over the linear instruction order, in vec4 registers."""
+    defined = {}    # id -> (index, scalar components)
+    last_use = {}
+    for index, (opcode, operands) in enumerate(function):
+        # operand words that match a value defined earlier are uses (literals may alias, rarely)
+        first = 0 if opcode in NO_RESULT_OPS or opcode == OP_LABEL else 2
+        for word in operands[first:]:
+            if word in defined:
+                last_use[word] = index
+        if opcode not in NO_RESULT_OPS and opcode != OP_LABEL and len(operands) >= 2:
+            defined[operands[1]] = (index, components.get(operands[0], 0))
+    live = [0] * (len(function) + 1)
+    for value, (start, width) in defined.items():
+        for index in range(start, last_use.get(value, start) + 1):
+            live[index] += width
+    peak = max(live) if live else 0
+    return (peak + 3) // 4
+
+
+def commit_id():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"], universal_newlines=True,
+                                       stderr=subprocess.DEVNULL).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+
+
+def permutation_name(defines):
+    return "+".join("%s=%s" % item for item in sorted(defines.items())) or "-"
+
+
+def measure(path, defines, args, scratch):
+    stage = STAGES[os.path.splitext(path)[1]]
+    source = os.path.join(scratch, "stage." + stage)
+    with open(source, "w") as out:
+        out.write(preprocess(path, defines))
+    module = source + ".spv"
+    code, log = run([args.glslang, "-G", "--auto-map-locations", "--auto-map-bindings", "-S", stage, "-o", module, source])
+    if code != 0:
+        print("ERROR::SHADER_COST::COMPILE %s %s\n%s" % (path, permutation_name(defines), log))
+        return None
+    if not args.no_opt:
+        code, log = run([args.spirv_opt] + OPT_PASSES + [module, "-o", module])
+        if code != 0:
+            print("ERROR::SHADER_COST::OPTIMIZE %s %s\n%s" % (path, permutation_name(defines), log))
+            return None
+    with open(module, "rb") as binary:
+        return parse_spirv(binary.read())
+
+
+def previous_rows(commit):
+    """Rows of the newest commit stored before this one, keyed by (stage, permutation)."""
+    if not os.path.exists(COSTS_CSV):
+        return None, {}
+    with open(COSTS_CSV) as table:
+        rows = [row for row in csv.DictReader(table) if row["commit"] != commit]
+    if not rows:
+        return None, {}
+    last = rows[-1]["commit"]
+    return last, dict(((row["stage"], row["permutation"]), row) for row in rows if row["commit"] == last)
+
+
+def store(commit, results):
+    new_file = not os.path.exists(COSTS_CSV)
+    kept = []
+    if not new_file:
+        # rerunning on the same commit replaces its rows
+        with open(COSTS_CSV) as table:
+            kept = [row for row in csv.DictReader(table) if row["commit"] != commit]
+    date = datetime.date.today().isoformat()
+    with open(COSTS_CSV, "w", newline="") as table:
+        writer = csv.DictWriter(table, ["commit", "date", "stage", "permutation"] + METRICS)
+        writer.writeheader()
+        writer.writerows(kept)
+        for (path, permutation), costs in results:
+            row = dict(costs, commit=commit, date=date, stage=path, permutation=permutation)
+            writer.writerow(row)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--dir", default=SHADER_DIR, help="shader directory (default: %(default)s)")
+    parser.add_argument("--manifest", default="shaders.manifest")
+    parser.add_argument("--glslang", default="glslangValidator")
+    parser.add_argument("--spirv-opt", default="spirv-opt")
+    parser.add_argument("--no-opt", action="store_true", help="measure glslang's unoptimized output")
+    parser.add_argument("--no-store", action="store_true", help="do not write tools/shaderCosts.csv")
+    args = parser.parse_args()
+
+    for tool in [args.glslang] + ([] if args.no_opt else [args.spirv_opt]):
+        if shutil.which(tool) is None:
+            print("ERROR::SHADER_COST::TOOL_NOT_FOUND " + tool + " (Vulkan SDK or the glslang / spirv-tools packages)")
+            return 1
+
+    commit = commit_id()
+    baseline, before = previous_rows(commit)
+    os.chdir(args.dir)
+    results = []
+    scratch = tempfile.mkdtemp(prefix="shadercost")
+    try:
+        for path in manifest_stages(args.manifest):
+            for defines in [{}] + PERMUTATIONS.get(path, []):
+                costs = measure(path, defines, args, scratch)
+                if costs is not None:
+                    results.append(((path, permutation_name(defines)), costs))
+    finally:
+        shutil.rmtree(scratch)
+
+    print("%-24s %-32s" % ("stage", "permutation") + "".join("%13s" % metric for metric in METRICS))
+    for key, costs in results:
+        old = before.get(key)
+        cells = ""
+        for metric in METRICS:
+            delta = costs[metric] - int(old[metric]) if old else 0
+            cells += "%13s" % ("%d%s" % (costs[metric], " (%+d)" % delta if delta else ""))
+        print("%-24s %-32s" % key + cells)
+    if baseline:
+        print("compared with " + baseline)
+    if not args.no_store:
+        store(commit, results)
+    return 0 if len(results) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())